@@ -0,0 +1,286 @@
+#include "MidiFile.hpp"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+/* struct for command parsing */
+static struct
+        option long_options[] = {
+
+{"help", 0, 0, 'h'},
+{"quantize", required_argument, 0, 'q'},
+{"transpose", required_argument, 0, 't'},
+{"scale", required_argument, 0, 's'},
+{"velocity", required_argument, 0, 'v'},
+{"measures", required_argument, 0, 'm'},
+{"jobs", required_argument, 0, 'j'},
+{0, 0, 0, 0}
+
+};
+
+/* what is done to every sequence of every file, 0 leaves it be */
+static long quantize_snap = 0;
+static int transpose_steps = 0;
+static int transpose_scale = c_scale_off;
+static int velocity_change = 0;
+static long measures = 0;
+
+static QString input_dir;
+static QString output_dir;
+static QStringList input_files;
+
+/* the workers take files by index and add up what they did */
+static volatile int next_file = 0;
+static volatile int failed_files = 0;
+static volatile long bytes_done = 0;
+
+
+static void
+transform (MidiSequence *a_seq)
+{
+    /* the edits work on the selected events, as in the editor */
+    if (quantize_snap > 0)
+    {
+        a_seq->select_all();
+        a_seq->quanize_events(EVENT_NOTE_ON, 0, quantize_snap, 1, true);
+    }
+
+    if (transpose_steps != 0)
+    {
+        a_seq->select_all();
+        a_seq->transpose_notes(transpose_steps, transpose_scale);
+    }
+
+    if (velocity_change > 0)
+    {
+        a_seq->select_all();
+        a_seq->change_event_data_relative(0, a_seq->getLength(),
+                                          EVENT_NOTE_ON, 0, velocity_change);
+    }
+    else if (velocity_change < 0)
+    {
+        /* a note on at velocity 0 is a note off, so they stop at 1.
+           the change clamps at 0, taking one more off and adding it
+           back leaves every note at least 1. a note on is never at 0
+           to begin with, the decoder makes those note offs */
+        a_seq->select_all();
+        a_seq->change_event_data_relative(0, a_seq->getLength(),
+                                          EVENT_NOTE_ON, 0, velocity_change - 1);
+        a_seq->change_event_data_relative(0, a_seq->getLength(),
+                                          EVENT_NOTE_ON, 0, 1);
+    }
+
+    /* drops whatever falls past the end */
+    if (measures > 0)
+        a_seq->setNumMeasures(measures);
+
+    a_seq->unselect();
+}
+
+
+static bool
+process_file (const QString &a_name)
+{
+    /* the sequences never play, so they need no bus. there is a
+       worker per core already, each file is done on one thread */
+    MidiFile in(QDir(input_dir).filePath(a_name));
+    in.set_workers(1);
+
+    if (!in.decode(NULL))
+        return false;
+
+    MidiSequence *seqs[c_max_sequence];
+    in.place_sequences(seqs);
+
+    for (int i = 0; i < c_max_sequence; i++)
+        if (seqs[i] != NULL)
+            transform(seqs[i]);
+
+    /* the settings after the tracks go out as they came in */
+    const unsigned char *trailer;
+    unsigned long trailer_size;
+    in.trailer(&trailer, &trailer_size);
+
+    MidiFile out(QDir(output_dir).filePath(a_name));
+    out.set_workers(1);
+    out.snapshot(seqs, trailer, trailer_size);
+
+    bool ok = out.write_snapshot();
+
+    for (int i = 0; i < c_max_sequence; i++)
+        delete seqs[i];
+
+    return ok;
+}
+
+
+static void *
+batch_thread_func (void *)
+{
+    int file;
+
+    while ((file = __sync_fetch_and_add(&next_file, 1)) < input_files.size())
+    {
+        const QString &name = input_files.at(file);
+
+        if (process_file(name))
+        {
+            QFileInfo info(QDir(input_dir).filePath(name));
+            __sync_fetch_and_add(&bytes_done, (long) info.size());
+        }
+        else
+        {
+            fprintf(stderr, "Error processing %s\n", name.toUtf8().constData());
+            __sync_fetch_and_add(&failed_files, 1);
+        }
+    }
+
+    return NULL;
+}
+
+
+int main (int argc, char *argv[])
+{
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* parse parameters */
+    int c;
+
+    while (true) {
+
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "hj:m:q:s:t:v:", long_options,
+                        &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c){
+
+        case 'q':
+        {
+            /* divisions of a whole note, 16 for sixteenths */
+            int divisions = atoi(optarg);
+            if (divisions <= 0 || divisions > c_ppqn * 4) {
+                fprintf(stderr, "Invalid quantize value %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            quantize_snap = c_ppqn * 4 / divisions;
+            break;
+        }
+
+        case 't':
+            transpose_steps = atoi(optarg);
+            break;
+
+        case 's':
+            if (QString(optarg) == "major")
+                transpose_scale = c_scale_major;
+            else if (QString(optarg) == "minor")
+                transpose_scale = c_scale_minor;
+            else
+                transpose_scale = c_scale_off;
+            break;
+
+        case 'v':
+            velocity_change = atoi(optarg);
+            break;
+
+        case 'm':
+            measures = atol(optarg);
+            break;
+
+        case 'j':
+            workers = atoi(optarg);
+            break;
+
+        case '?':
+        case 'h':
+        default:
+
+            printf( "Usage: kepler34-batch [OPTIONS] INPUT_DIR OUTPUT_DIR\n\n" );
+            printf( "Edits every MIDI file in INPUT_DIR and writes it to OUTPUT_DIR\n\n" );
+            printf( "Options:\n" );
+            printf( "   -h, --help: show this message\n" );
+            printf( "   -q, --quantize <n>: quantize notes to 1/n notes\n" );
+            printf( "   -t, --transpose <steps>: transpose notes by steps\n" );
+            printf( "   -s, --scale <major|minor>: transpose within the scale\n" );
+            printf( "   -v, --velocity <change>: add change to note velocities\n" );
+            printf( "   -m, --measures <n>: trim each pattern to n measures\n" );
+            printf( "   -j, --jobs <n>: files processed at once (default: cores)\n" );
+            printf( "\n" );
+
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: kepler34-batch [OPTIONS] INPUT_DIR OUTPUT_DIR\n");
+        return EXIT_FAILURE;
+    }
+
+    input_dir = argv[optind];
+    output_dir = argv[optind + 1];
+
+    QDir dir(input_dir);
+    if (!dir.exists()) {
+        fprintf(stderr, "No such directory %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    if (!QDir().mkpath(output_dir)) {
+        fprintf(stderr, "Can't create directory %s\n", argv[optind + 1]);
+        return EXIT_FAILURE;
+    }
+
+    input_files = dir.entryList(QStringList() << "*.mid" << "*.midi",
+                                QDir::Files, QDir::Name);
+
+    if (workers > input_files.size())
+        workers = input_files.size();
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* this thread is a worker too */
+    vector<pthread_t> threads;
+
+    for (int w = 1; w < workers; w++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, batch_thread_func, NULL) == 0)
+            threads.push_back(thread);
+    }
+
+    batch_thread_func(NULL);
+
+    for (unsigned int w = 0; w < threads.size(); w++)
+        pthread_join(threads[w], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) +
+            (end.tv_nsec - start.tv_nsec) / 1e9;
+    double megabytes = bytes_done / (1024.0 * 1024.0);
+    int done = input_files.size() - failed_files;
+
+    if (seconds <= 0)
+        seconds = 1e-9;
+
+    printf("%d files, %d failed, %.2f MB in %.3f s: %.1f files/s, %.2f MB/s\n",
+           done, failed_files, megabytes, seconds,
+           done / seconds, megabytes / seconds);
+
+    return failed_files == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,42 @@
+#-------------------------------------------------
+#
+# kepler34-batch, edits whole directories of MIDI files
+# with the sequence engine, no GUI
+#
+#-------------------------------------------------
+
+QT       += core gui
+QT       -= widgets
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = kepler34-batch
+TEMPLATE = app
+
+SRC = ../src
+INCLUDEPATH += $$SRC
+
+SOURCES += \
+    BatchMain.cpp \
+    $$SRC/Globals.cpp \
+    $$SRC/MidiSequence.cpp \
+    $$SRC/MidiEvent.cpp \
+    $$SRC/Mutex.cpp \
+    $$SRC/ChangeQueue.cpp \
+    $$SRC/CommandQueue.cpp \
+    $$SRC/EventRing.cpp \
+    $$SRC/MidiFileCache.cpp \
+    $$SRC/MidiBus.cpp \
+    $$SRC/Lash.cpp \
+    $$SRC/MidiFile.cpp \
+    $$SRC/MidiPerformance.cpp
+
+HEADERS += \
+    $$SRC/Lash.hpp
+
+unix:!macx: LIBS += -lasound -llash -ljack -lrt
+
+# This is where lash is stored on certain Linux distros,
+# so we must check here too
+INCLUDEPATH += /usr/include/lash-1.0
@@ -0,0 +1,156 @@
+#include "MidiFile.hpp"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* MidiFile reads from a path, so each input goes through this file */
+static char input_path[] = "/tmp/kepler34-fuzz-XXXXXX";
+static bool input_ready = false;
+
+
+static bool
+write_input (const uint8_t *a_data, size_t a_size)
+{
+    if (!input_ready)
+    {
+        int fd = mkstemp(input_path);
+        if (fd < 0)
+            return false;
+
+        close(fd);
+        input_ready = true;
+    }
+
+    int fd = open(input_path, O_WRONLY | O_TRUNC);
+    if (fd < 0)
+        return false;
+
+    size_t done = 0;
+    while (done < a_size)
+    {
+        ssize_t written = write(fd, a_data + done, a_size - done);
+        if (written <= 0)
+            break;
+        done += written;
+    }
+
+    close(fd);
+    return done == a_size;
+}
+
+
+extern "C" int
+LLVMFuzzerTestOneInput (const uint8_t *a_data, size_t a_size)
+{
+    /* a cache file beside the input would be read instead of it */
+    global_file_cache = false;
+
+    if (!write_input(a_data, a_size))
+        return 0;
+
+    MidiFile in(QString::fromUtf8(input_path));
+
+    if (!in.decode(NULL))
+        return 0;
+
+    MidiSequence *seqs[c_max_sequence];
+    in.place_sequences(seqs);
+
+    /* whatever was decoded has to encode, and decode back again */
+    vector<unsigned char> bytes;
+
+    for (int i = 0; i < c_max_sequence; i++)
+    {
+        if (seqs[i] == NULL)
+            continue;
+
+        bytes.clear();
+        seqs[i]->fill_buffer(&bytes, i);
+
+        MidiSequence copy;
+        if (!in.decode_sequence(bytes.empty() ? NULL : &bytes[0],
+                                bytes.size(), &copy))
+        {
+            fprintf(stderr, "Sequence %d doesn't decode after encoding\n", i);
+            abort();
+        }
+    }
+
+    for (int i = 0; i < c_max_sequence; i++)
+        delete seqs[i];
+
+    return 0;
+}
+
+
+#ifndef LIBFUZZER
+
+/* without libFuzzer it runs each file given once, or each file in
+   each directory given, to replay a corpus or a crash */
+static bool
+run_file (const QString &a_name)
+{
+    QFile file(a_name);
+
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "Can't read %s\n", a_name.toUtf8().constData());
+        return false;
+    }
+
+    QByteArray data = file.readAll();
+    LLVMFuzzerTestOneInput((const uint8_t *) data.constData(), data.size());
+
+    return true;
+}
+
+
+int main (int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: kepler34-fuzz FILE_OR_DIR...\n");
+        return EXIT_FAILURE;
+    }
+
+    int runs = 0;
+    bool ok = true;
+
+    for (int a = 1; a < argc; a++)
+    {
+        QString name = QString::fromUtf8(argv[a]);
+        QFileInfo info(name);
+
+        if (info.isDir())
+        {
+            QDir dir(name);
+            QStringList files = dir.entryList(QDir::Files, QDir::Name);
+
+            for (int f = 0; f < files.size(); f++)
+            {
+                ok = run_file(dir.filePath(files.at(f))) && ok;
+                runs++;
+            }
+        }
+        else
+        {
+            ok = run_file(name) && ok;
+            runs++;
+        }
+    }
+
+    if (input_ready)
+        unlink(input_path);
+
+    printf("%d inputs run\n", runs);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
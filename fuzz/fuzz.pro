@@ -0,0 +1,49 @@
+#-------------------------------------------------
+#
+# kepler34-fuzz, feeds MIDI files to the file decoder
+# looking for input that crashes it. qmake CONFIG+=libfuzzer
+# builds it as a libFuzzer target instead
+#
+#-------------------------------------------------
+
+QT       += core gui
+QT       -= widgets
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = kepler34-fuzz
+TEMPLATE = app
+
+SRC = ../src
+INCLUDEPATH += $$SRC
+
+SOURCES += \
+    FuzzMain.cpp \
+    $$SRC/Globals.cpp \
+    $$SRC/MidiSequence.cpp \
+    $$SRC/MidiEvent.cpp \
+    $$SRC/Mutex.cpp \
+    $$SRC/ChangeQueue.cpp \
+    $$SRC/CommandQueue.cpp \
+    $$SRC/EventRing.cpp \
+    $$SRC/MidiFileCache.cpp \
+    $$SRC/MidiBus.cpp \
+    $$SRC/Lash.cpp \
+    $$SRC/MidiFile.cpp \
+    $$SRC/MidiPerformance.cpp
+
+HEADERS += \
+    $$SRC/Lash.hpp
+
+libfuzzer {
+    DEFINES += LIBFUZZER
+    QMAKE_CXXFLAGS += -fsanitize=fuzzer,address
+    QMAKE_LFLAGS += -fsanitize=fuzzer,address
+}
+
+unix:!macx: LIBS += -lasound -llash -ljack -lrt
+
+# This is where lash is stored on certain Linux distros,
+# so we must check here too
+INCLUDEPATH += /usr/include/lash-1.0
@@ -1,4 +1,4 @@
 # kepler34.pro
 #
 TEMPLATE = subdirs
-SUBDIRS = src
+SUBDIRS = src batch fuzz loadbench paintbench
@@ -0,0 +1,170 @@
+#include "MidiFile.hpp"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* struct for command parsing */
+static struct
+        option long_options[] = {
+
+{"help", 0, 0, 'h'},
+{"repeat", required_argument, 0, 'r'},
+{0, 0, 0, 0}
+
+};
+
+
+static double
+seconds_since (const struct timespec &a_start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - a_start.tv_sec) +
+            (now.tv_nsec - a_start.tv_nsec) / 1e9;
+}
+
+
+int main (int argc, char *argv[])
+{
+    int repeat = 5;
+
+    /* parse parameters */
+    int c;
+
+    while (true) {
+
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "hr:", long_options,
+                        &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c){
+
+        case 'r':
+            repeat = atoi(optarg);
+            if (repeat <= 0) {
+                fprintf(stderr, "Invalid repeat count %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case '?':
+        case 'h':
+        default:
+
+            printf( "Usage: kepler34-loadbench [OPTIONS] CORPUS_DIR\n\n" );
+            printf( "Times decoding and encoding every MIDI file in CORPUS_DIR\n\n" );
+            printf( "Options:\n" );
+            printf( "   -h, --help: show this message\n" );
+            printf( "   -r, --repeat <n>: passes over the corpus (default: 5)\n" );
+            printf( "\n" );
+
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: kepler34-loadbench [OPTIONS] CORPUS_DIR\n");
+        return EXIT_FAILURE;
+    }
+
+    QDir dir(argv[optind]);
+    if (!dir.exists()) {
+        fprintf(stderr, "No such directory %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    QStringList files = dir.entryList(QStringList() << "*.mid" << "*.midi",
+                                      QDir::Files, QDir::Name);
+
+    /* the cache would time reading the cache, not the decoder */
+    global_file_cache = false;
+
+    long bytes = 0;
+    long encoded = 0;
+    int failed = 0;
+    double decode_seconds = 0;
+    double encode_seconds = 0;
+
+    vector<unsigned char> buffer;
+
+    for (int r = 0; r < repeat; r++)
+    {
+        for (int f = 0; f < files.size(); f++)
+        {
+            QString name = dir.filePath(files.at(f));
+            struct timespec start;
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            MidiFile in(name);
+            bool ok = in.decode(NULL);
+
+            MidiSequence *seqs[c_max_sequence];
+            if (ok)
+                in.place_sequences(seqs);
+
+            decode_seconds += seconds_since(start);
+
+            if (!ok)
+            {
+                /* counted once, not on every pass */
+                if (r == 0) {
+                    fprintf(stderr, "Error decoding %s\n",
+                            name.toUtf8().constData());
+                    failed++;
+                }
+                continue;
+            }
+
+            bytes += QFileInfo(name).size();
+
+            clock_gettime(CLOCK_MONOTONIC, &start);
+
+            for (int i = 0; i < c_max_sequence; i++)
+            {
+                if (seqs[i] == NULL)
+                    continue;
+
+                buffer.clear();
+                seqs[i]->fill_buffer(&buffer, i);
+                encoded += buffer.size();
+            }
+
+            encode_seconds += seconds_since(start);
+
+            for (int i = 0; i < c_max_sequence; i++)
+                delete seqs[i];
+        }
+    }
+
+    double megabytes = bytes / (1024.0 * 1024.0);
+    double encoded_megabytes = encoded / (1024.0 * 1024.0);
+
+    if (decode_seconds <= 0)
+        decode_seconds = 1e-9;
+    if (encode_seconds <= 0)
+        encode_seconds = 1e-9;
+
+    printf("%d files x %d passes, %d failed\n",
+           files.size(), repeat, failed);
+    printf("decode: %.2f MB in %.3f s, %.2f MB/s\n",
+           megabytes, decode_seconds, megabytes / decode_seconds);
+    printf("encode: %.2f MB in %.3f s, %.2f MB/s\n",
+           encoded_megabytes, encode_seconds,
+           encoded_megabytes / encode_seconds);
+
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
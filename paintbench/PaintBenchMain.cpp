@@ -0,0 +1,165 @@
+#include "LiveFrame.hpp"
+#include "Lash.hpp"
+
+#include <QApplication>
+#include <QPixmap>
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* struct for command parsing */
+static struct
+        option long_options[] = {
+
+{"help", 0, 0, 'h'},
+{"frames", required_argument, 0, 'f'},
+{0, 0, 0, 0}
+
+};
+
+/* each pattern is four bars of sixteenths, this many notes deep */
+static const int c_bench_chord = 6;
+static const int c_bench_steps = 64;
+
+
+static double
+seconds_since (const struct timespec &a_start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - a_start.tv_sec) +
+            (now.tv_nsec - a_start.tv_nsec) / 1e9;
+}
+
+
+/* paints the whole frame a_frames times. uncached, every sequence
+   looks edited first so each preview is rendered again */
+static double
+time_paints (LiveFrame *a_frame, MidiPerformance *a_perf,
+             QPixmap *a_target, int a_frames, bool a_cached)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int f = 0; f < a_frames; f++)
+    {
+        if (!a_cached)
+            for (int i = 0; i < cSeqsInBank; i++)
+                a_perf->get_sequence(i)->set_dirty();
+
+        a_frame->render(a_target);
+    }
+
+    return seconds_since(start);
+}
+
+
+int main (int argc, char *argv[])
+{
+    /* no display needed unless one is asked for */
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication a(argc, argv);
+
+    int frames = 200;
+
+    /* parse parameters */
+    int c;
+
+    while (true) {
+
+        /* getopt_long stores the option index here. */
+        int option_index = 0;
+
+        c = getopt_long(argc, argv, "hf:", long_options,
+                        &option_index);
+
+        /* Detect the end of the options. */
+        if (c == -1)
+            break;
+
+        switch (c){
+
+        case 'f':
+            frames = atoi(optarg);
+            if (frames <= 0) {
+                fprintf(stderr, "Invalid frame count %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+
+        case '?':
+        case 'h':
+        default:
+
+            printf( "Usage: kepler34-paintbench [OPTIONS]\n\n" );
+            printf( "Times painting the live frame with a bank of dense patterns\n\n" );
+            printf( "Options:\n" );
+            printf( "   -h, --help: show this message\n" );
+            printf( "   -f, --frames <n>: frames painted each way (default: 200)\n" );
+            printf( "\n" );
+
+            return c == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    //the live frame looks the thumbnail colours up here
+    colourMap = QMap<thumb_colours_e, QColor>();
+    colourMap[White]  = Qt::white;
+    colourMap[Red]    = QColor(173, 33, 33);
+    colourMap[Green]  = QColor(26, 139, 26);
+    colourMap[Blue]   = QColor(28, 72, 112);
+    colourMap[Yellow] = QColor(169, 173, 33);
+    colourMap[Purple] = QColor(87, 26, 115);
+    colourMap[Pink]   = QColor(152, 29, 72);
+    colourMap[Orange] = QColor(173, 115, 33);
+
+#ifdef LASH_SUPPORT
+    lash_driver = new Lash(&argc, &argv);
+#endif
+
+    /* nothing plays, so it's never started */
+    MidiPerformance p;
+
+    for (int s = 0; s < cSeqsInBank; s++)
+    {
+        p.new_sequence(s);
+
+        MidiSequence *seq = p.get_sequence(s);
+        seq->set_length(c_bench_steps * c_ppqn / 4);
+
+        for (int step = 0; step < c_bench_steps; step++)
+            for (int v = 0; v < c_bench_chord; v++)
+                seq->add_note(step * c_ppqn / 4, c_ppqn / 4 - 1,
+                              36 + (step * 7 + v * 5 + s) % 60);
+    }
+
+    LiveFrame frame(NULL, &p);
+    frame.resize(1280, 800);
+    frame.show();
+    a.processEvents();
+
+    QPixmap target(frame.size());
+
+    /* fills the cache */
+    frame.render(&target);
+
+    double cached = time_paints(&frame, &p, &target, frames, true);
+    double uncached = time_paints(&frame, &p, &target, frames, false);
+
+    printf("%d patterns of %d notes, %d frames at %dx%d\n",
+           cSeqsInBank, c_bench_steps * c_bench_chord, frames,
+           frame.width(), frame.height());
+    printf("cached:   %.3f ms a frame\n", cached * 1000 / frames);
+    printf("uncached: %.3f ms a frame\n", uncached * 1000 / frames);
+
+#ifdef LASH_SUPPORT
+    delete lash_driver;
+#endif
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+#-------------------------------------------------
+#
+# kepler34-paintbench, times painting the live frame
+# with a bank of dense patterns, with and without its
+# note preview cache. Runs offscreen, no display needed
+#
+#-------------------------------------------------
+
+QT       += core gui widgets
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = kepler34-paintbench
+TEMPLATE = app
+
+SRC = ../src
+INCLUDEPATH += $$SRC
+
+SOURCES += \
+    PaintBenchMain.cpp \
+    $$SRC/Globals.cpp \
+    $$SRC/LiveFrame.cpp \
+    $$SRC/MidiSequence.cpp \
+    $$SRC/MidiEvent.cpp \
+    $$SRC/Mutex.cpp \
+    $$SRC/ChangeQueue.cpp \
+    $$SRC/CommandQueue.cpp \
+    $$SRC/EventRing.cpp \
+    $$SRC/MidiFileCache.cpp \
+    $$SRC/MidiBus.cpp \
+    $$SRC/Lash.cpp \
+    $$SRC/MidiFile.cpp \
+    $$SRC/MidiPerformance.cpp
+
+HEADERS += \
+    $$SRC/LiveFrame.hpp \
+    $$SRC/Lash.hpp
+
+FORMS += \
+    $$SRC/LiveFrame.ui
+
+unix:!macx: LIBS += -lasound -llash -ljack -lrt
+
+# This is where lash is stored on certain Linux distros,
+# so we must check here too
+INCLUDEPATH += /usr/include/lash-1.0
@@ -29,7 +29,10 @@ void BeatIndicator::paintEvent(QPaintEvent *)
     mPainter->setFont(mFont);
     mPainter->setBrush(*mBrush);
 
-    long tick = m_main_perf->get_tick();
+    TransportState state;
+    m_main_perf->get_transport_state(&state);
+
+    long tick = state.m_tick;
     int metro = (tick / (c_ppqn / 4 * beatWidth)) % beatsPerMeasure;
     int divX = (width() - 1) / beatsPerMeasure;
 
@@ -56,7 +59,7 @@ void BeatIndicator::paintEvent(QPaintEvent *)
         int offsetX = divX * i;
 
         //with flash if on current beat
-        if (i == metro && m_main_perf->is_running())
+        if (i == metro && state.m_running)
         {
             mBrush->setStyle(Qt::SolidPattern);
             mPen->setColor(Qt::black);
@@ -91,7 +94,7 @@ void BeatIndicator::paintEvent(QPaintEvent *)
 
     //lessen alpha on each redraw to have smooth fading
     //done as a factor of the bpm to get useful fades
-    alpha *= 0.7 - m_main_perf->get_bpm() / 300;
+    alpha *= 0.7 - state.m_bpm / 300;
 
     lastMetro = metro;
 
@@ -0,0 +1,54 @@
+#include "ChangeQueue.hpp"
+
+ChangeQueue::ChangeQueue( ) :
+    m_head(0),
+    m_tail(0)
+{
+    for ( int i = 0; i <= c_max_sequence; i++ )
+        m_changes[i] = 0;
+
+    for ( int i = 0; i < c_change_ring_size; i++ )
+        m_ring[i] = -1;
+}
+
+void
+ChangeQueue::push( int a_id, int a_changes )
+{
+    if ( a_id < 0 || a_id > c_max_sequence || a_changes == 0 )
+        return;
+
+    /* only the push that finds no flags pending queues the id,
+       everyone after it just adds to the flags */
+    int old = __sync_fetch_and_or( &m_changes[a_id], a_changes );
+    if ( old != 0 )
+        return;
+
+    unsigned int slot =
+        __sync_fetch_and_add( &m_tail, 1 ) & (c_change_ring_size - 1);
+
+    m_ring[slot] = a_id;
+    __sync_synchronize();
+}
+
+bool
+ChangeQueue::pop( int *a_id, int *a_changes )
+{
+    unsigned int slot = m_head & (c_change_ring_size - 1);
+
+    /* a slot claimed but not yet written reads as empty,
+       we pick it up on the next pop */
+    int id = m_ring[slot];
+    if ( id < 0 )
+        return false;
+
+    m_ring[slot] = -1;
+    m_head++;
+    __sync_synchronize();
+
+    /* clearing the flags after the id left the ring lets the
+       next push queue it again, nothing pushed in between is lost */
+    *a_id = id;
+    *a_changes = __sync_fetch_and_and( &m_changes[id], 0 );
+
+    return true;
+}
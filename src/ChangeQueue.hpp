@@ -0,0 +1,55 @@
+#pragma once
+
+#include "Globals.hpp"
+
+/* what changed, sequences and the performance push these
+   and the GUI repaints whatever shows them */
+enum change_e
+{
+    e_change_events   = 1 << 0, //notes or other events edited
+    e_change_triggers = 1 << 1, //song editor triggers edited
+    e_change_state    = 1 << 2, //playing, queued, name, bus...
+    e_change_active   = 1 << 3, //sequence created or deleted
+    e_change_tick     = 1 << 4, //transport position moved
+    e_change_markers  = 1 << 5  //song L/R markers moved
+};
+
+/* id used for changes belonging to the whole performance
+   rather than to one sequence */
+const int c_change_perf = c_max_sequence;
+
+/* must be a power of two larger than c_max_sequence + 1, each
+   id sits in the ring at most once so it can never overflow */
+const int c_change_ring_size = 2048;
+
+///
+/// \brief The ChangeQueue class
+///
+/// Lock free queue of pending GUI changes. Any thread may push,
+/// only the GUI thread pops. Changes to an id already waiting in
+/// the queue are merged into its flags instead of queued again
+
+class ChangeQueue {
+
+private:
+
+    /* pending change flags per id */
+    volatile int m_changes[c_max_sequence + 1];
+
+    /* ids with pending flags, -1 marks an empty slot */
+    volatile int m_ring[c_change_ring_size];
+
+    volatile unsigned int m_head;
+    volatile unsigned int m_tail;
+
+public:
+
+    ChangeQueue();
+
+    /* safe from any thread, never blocks */
+    void push( int a_id, int a_changes );
+
+    /* GUI thread only, false when nothing is pending */
+    bool pop( int *a_id, int *a_changes );
+
+};
@@ -0,0 +1,69 @@
+#include "CommandQueue.hpp"
+
+CommandQueue::CommandQueue( ) :
+    m_head(0),
+    m_tail(0)
+{
+    for ( int i = 0; i < c_command_ring_size; i++ )
+        m_ring[i].m_sequence = i;
+}
+
+bool
+CommandQueue::push( int a_command, int a_arg, int a_value )
+{
+    unsigned int pos = m_tail;
+    slot *s;
+
+    /* a slot is free for position pos when its sequence equals pos,
+       claim it by moving the tail past it */
+    while ( true ) {
+
+        s = &m_ring[pos & (c_command_ring_size - 1)];
+
+        unsigned int seq = s->m_sequence;
+        __sync_synchronize();
+
+        int diff = (int) (seq - pos);
+
+        if ( diff == 0 ) {
+            if ( __sync_bool_compare_and_swap( &m_tail, pos, pos + 1 ))
+                break;
+        }
+        /* the popper has not emptied this slot yet, we are full */
+        else if ( diff < 0 )
+            return false;
+
+        pos = m_tail;
+    }
+
+    s->m_command.m_command = a_command;
+    s->m_command.m_arg = a_arg;
+    s->m_command.m_value = a_value;
+
+    /* publish the slot to the popper */
+    __sync_synchronize();
+    s->m_sequence = pos + 1;
+
+    return true;
+}
+
+bool
+CommandQueue::pop( PerfCommand *a_command )
+{
+    slot *s = &m_ring[m_head & (c_command_ring_size - 1)];
+
+    /* a slot claimed but not yet written reads as empty,
+       we pick it up on the next pop */
+    if ( s->m_sequence != m_head + 1 )
+        return false;
+
+    __sync_synchronize();
+    *a_command = s->m_command;
+    __sync_synchronize();
+
+    /* hand the slot back to pushers one lap later */
+    s->m_sequence = m_head + c_command_ring_size;
+    m_head++;
+
+    return true;
+}
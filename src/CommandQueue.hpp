@@ -0,0 +1,70 @@
+#pragma once
+
+#include "Globals.hpp"
+
+/* engine state changes requested by the GUI and input threads,
+   the output thread applies them at the start of a cycle */
+enum command_e
+{
+    e_command_toggle,      //sequence_playing_toggle( arg )
+    e_command_playing_on,  //sequence_playing_on( arg )
+    e_command_playing_off, //sequence_playing_off( arg )
+    e_command_bpm,         //set_bpm( arg )
+    e_command_status_on,   //set_sequence_control_status( arg )
+    e_command_status_off,  //unset_sequence_control_status( arg )
+    e_command_control,     //handle_midi_control( arg, value )
+    e_command_merge_input, //merge recorded input while stopped
+    e_command_swap_standby,//swap_standby() at the next bar of arg ticks
+    e_command_set_playing, //set_playing( value ) on sequence arg
+    e_command_screen_set,  //setBank( arg )
+    e_command_offset,      //set_offset( arg )
+    e_command_start,       //inner_start()
+    e_command_stop,        //inner_stop()
+    e_command_midi_clock_start, //midi_clock_start( value ), value is continue
+    e_command_publish      //nothing, publish_state() while stopped
+};
+
+/* must be a power of two */
+const int c_command_ring_size = 256;
+
+struct PerfCommand
+{
+    int m_command;
+    int m_arg;
+    int m_value;
+};
+
+///
+/// \brief The CommandQueue class
+///
+/// Bounded lock free queue of commands for the output thread.
+/// Any thread may push, only the output thread pops. Each slot
+/// carries a sequence number telling pushers and the popper
+/// whose turn it is, so a pusher never waits on another one
+
+class CommandQueue {
+
+private:
+
+    struct slot
+    {
+        volatile unsigned int m_sequence;
+        PerfCommand m_command;
+    };
+
+    slot m_ring[c_command_ring_size];
+
+    volatile unsigned int m_head;
+    volatile unsigned int m_tail;
+
+public:
+
+    CommandQueue();
+
+    /* safe from any thread, never blocks, false when full */
+    bool push( int a_command, int a_arg, int a_value );
+
+    /* output thread only, false when nothing is pending */
+    bool pop( PerfCommand *a_command );
+
+};
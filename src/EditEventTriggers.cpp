@@ -26,27 +26,20 @@ EditEventTriggers::EditEventTriggers(MidiSequence *a_seq,
 
     setSizePolicy(QSizePolicy::Fixed,
                   QSizePolicy::Fixed);
-
-    //start refresh timer to queue regular redraws
-    mTimer = new QTimer(this);
-    mTimer->setInterval(20);
-    QObject::connect(mTimer,
-                     SIGNAL(timeout()),
-                     this,
-                     SLOT(update()));
-    mTimer->start();
 }
 
 void EditEventTriggers::zoomIn()
 {
     if (m_zoom > 1)
         m_zoom *= 0.5;
+    update();
 }
 
 void EditEventTriggers::zoomOut()
 {
     if (m_zoom < 32)
         m_zoom *= 2;
+    update();
 }
 
 QSize EditEventTriggers::sizeHint() const
@@ -54,7 +47,7 @@ QSize EditEventTriggers::sizeHint() const
     return QSize(m_seq->getLength() / m_zoom + 100 + c_keyboard_padding_x, c_eventarea_y + 1);
 }
 
-void EditEventTriggers::paintEvent(QPaintEvent *)
+void EditEventTriggers::paintEvent(QPaintEvent *event)
 {
     mPainter = new QPainter(this);
     mPen = new QPen(Qt::black);
@@ -76,7 +69,6 @@ void EditEventTriggers::paintEvent(QPaintEvent *)
     int ticks_per_step = 6 * m_zoom;
     int ticks_per_m_line =  ticks_per_measure * measures_per_line;
     int start_tick = 0;
-    int end_tick = width() * m_zoom;
 
     //printf ( "ticks_per_step[%d] start_tick[%d] end_tick[%d]\n",
     //         ticks_per_step, start_tick, end_tick );
@@ -113,47 +105,51 @@ void EditEventTriggers::paintEvent(QPaintEvent *)
     //draw event boxes
     long tick;
     int x;
-    unsigned char d0,d1;
     bool selected;
 
+    //only fetch the events under the exposed area
+    QRect exposed = event->rect();
+    long first_tick = (exposed.left() - c_keyboard_padding_x - c_eventevent_x) * m_zoom;
+    long last_tick = (exposed.right() - c_keyboard_padding_x) * m_zoom;
+
     /* draw boxes from sequence */
     mPen->setColor(Qt::black);
     mPen->setStyle(Qt::SolidLine);
 
-    m_seq->reset_draw_marker();
-    while ( m_seq->get_next_event( m_status,
-                                   m_cc,
-                                   &tick, &d0, &d1,
-                                   &selected ) == true ){
-        if ( (tick >= start_tick && tick <= end_tick )){
+    m_seq->get_lane_events_in_range( m_status, m_cc,
+                                     first_tick, last_tick,
+                                     &m_lane_events );
 
+    for ( unsigned n = 0; n < m_lane_events.size(); ++n ){
 
-            /* turn into screen corrids */
-            x = tick / m_zoom + c_keyboard_padding_x;
+        tick = m_lane_events[n].m_tick;
+        selected = m_lane_events[n].m_selected;
 
-            //draw outer note border
-            mPen->setColor(Qt::black);
-            mBrush->setStyle(Qt::SolidPattern);
-            mBrush->setColor(Qt::black);
-            mPainter->setBrush(*mBrush);
-            mPainter->setPen(*mPen);
-            mPainter->drawRect(x,
-                               (c_eventarea_y - c_eventevent_y)/2,
-                               c_eventevent_x,
-                               c_eventevent_y );
-
-            if ( selected )
-                mBrush->setColor(Qt::red);
-            else
-                mBrush->setColor(Qt::white);
-
-            //draw note highlight
-            mPainter->setBrush(*mBrush);
-            mPainter->drawRect(x,
-                               (c_eventarea_y - c_eventevent_y) / 2,
-                               c_eventevent_x - 1,
-                               c_eventevent_y - 1 );
-        }
+        /* turn into screen corrids */
+        x = tick / m_zoom + c_keyboard_padding_x;
+
+        //draw outer note border
+        mPen->setColor(Qt::black);
+        mBrush->setStyle(Qt::SolidPattern);
+        mBrush->setColor(Qt::black);
+        mPainter->setBrush(*mBrush);
+        mPainter->setPen(*mPen);
+        mPainter->drawRect(x,
+                           (c_eventarea_y - c_eventevent_y)/2,
+                           c_eventevent_x,
+                           c_eventevent_y );
+
+        if ( selected )
+            mBrush->setColor(Qt::red);
+        else
+            mBrush->setColor(Qt::white);
+
+        //draw note highlight
+        mPainter->setBrush(*mBrush);
+        mPainter->drawRect(x,
+                           (c_eventarea_y - c_eventevent_y) / 2,
+                           c_eventevent_x - 1,
+                           c_eventevent_y - 1 );
     }
 
     //draw selection
@@ -346,6 +342,8 @@ void EditEventTriggers::mousePressEvent(QMouseEvent *event)
             set_adding(true);
         }
     }
+
+    update();
 }
 
 void EditEventTriggers::mouseReleaseEvent(QMouseEvent *event)
@@ -407,6 +405,8 @@ void EditEventTriggers::mouseReleaseEvent(QMouseEvent *event)
     m_painting = false;
 
     m_seq->unpaint_all();
+
+    update();
 }
 
 void EditEventTriggers::mouseMoveEvent(QMouseEvent *event)
@@ -434,6 +434,8 @@ void EditEventTriggers::mouseMoveEvent(QMouseEvent *event)
         convert_x( m_current_x, &tick );
         drop_event( tick );
     }
+
+    update();
 }
 
 void EditEventTriggers::keyPressEvent(QKeyEvent *event)
@@ -483,6 +485,8 @@ void EditEventTriggers::keyPressEvent(QKeyEvent *event)
 
     if ( ret == true )
         m_seq->set_dirty();
+
+    update();
 }
 
 void EditEventTriggers::keyReleaseEvent(QKeyEvent *event)
@@ -538,6 +542,8 @@ void EditEventTriggers::start_paste()
 
     /* adjust for clipboard being shifted to tick 0 */
     m_selected->setX(m_selected->x() + m_drop_x);
+
+    update();
 }
 
 void EditEventTriggers::convert_x(int a_x, long *a_tick)
@@ -613,4 +619,5 @@ void EditEventTriggers::set_data_type(unsigned char a_status,
 {
     m_status = a_status;
     m_cc = a_control;
+    update();
 }
@@ -7,7 +7,6 @@
 #include <QWidget>
 #include <QPainter>
 #include <QMouseEvent>
-#include <QTimer>
 #include <QPen>
 
 ///
@@ -72,7 +71,9 @@ private:
     QFont        mFont;
     QRect       *m_old;
     QRect       *m_selected;
-    QTimer      *mTimer;
+
+    //lane events found in the last redraw
+    vector<MidiEventInfo> m_lane_events;
 
     /* one pixel == m_zoom ticks */
     int          m_zoom;
@@ -15,27 +15,20 @@ EditEventValues::EditEventValues(MidiSequence *a_seq,
     m_cc = 1;
 
     mOld = new QRect();
-
-    //start refresh timer to queue regular redraws
-    mTimer = new QTimer(this);
-    mTimer->setInterval(20);
-    QObject::connect(mTimer,
-                     SIGNAL(timeout()),
-                     this,
-                     SLOT(update()));
-    mTimer->start();
 }
 
 void EditEventValues::zoomIn()
 {
     if (m_zoom > 1)
         m_zoom *= 0.5;
+    update();
 }
 
 void EditEventValues::zoomOut()
 {
     if (m_zoom < 32)
         m_zoom *= 2;
+    update();
 }
 
 QSize EditEventValues::sizeHint() const
@@ -43,7 +36,7 @@ QSize EditEventValues::sizeHint() const
     return QSize(m_seq->getLength() / m_zoom + 100 + c_keyboard_padding_x, c_dataarea_y);
 }
 
-void EditEventValues::paintEvent(QPaintEvent *)
+void EditEventValues::paintEvent(QPaintEvent *event)
 {
     mPainter = new QPainter(this);
     mPen = new QPen(Qt::black);
@@ -62,66 +55,66 @@ void EditEventValues::paintEvent(QPaintEvent *)
     int event_x;
     int event_height;
 
-    bool selected;
-
-    int start_tick = 0 ;
-    int end_tick = (width() * m_zoom);
+    //only fetch the events under the exposed area,
+    //padded for the value numbers
+    QRect exposed = event->rect();
+    long start_tick = (exposed.left() - c_keyboard_padding_x - 10) * m_zoom;
+    long end_tick = (exposed.right() - c_keyboard_padding_x) * m_zoom;
 
     mPainter->drawRect(0,
                        0,
                        width() - 1,
                        height() - 1);
 
-    m_seq->reset_draw_marker();
-    while ( m_seq->get_next_event( m_status,
-                                   m_cc,
-                                   &tick, &d0, &d1,
-                                   &selected ) == true )
+    m_seq->get_lane_events_in_range( m_status, m_cc,
+                                     start_tick, end_tick,
+                                     &m_lane_events );
+
+    for ( unsigned n = 0; n < m_lane_events.size(); ++n )
     {
+        tick = m_lane_events[n].m_tick;
+        d0 = m_lane_events[n].m_d0;
+        d1 = m_lane_events[n].m_d1;
 
-        if ( tick >= start_tick && tick <= end_tick )
-        {
+        /* turn into screen corrids */
 
-            /* turn into screen corrids */
-
-            event_x = tick / m_zoom + c_keyboard_padding_x;
-
-            /* generate the value */
-            event_height = d1;
-
-            if ( m_status == EVENT_PROGRAM_CHANGE ||
-                 m_status == EVENT_CHANNEL_PRESSURE  ){
-
-                event_height = d0;
-            }
-
-            /* draw vert lines */
-            mPen->setWidth(2);
-            mPainter->setPen(*mPen);
-            mPainter->drawLine(event_x + 1,
-                               height() - event_height,
-                               event_x + 1,
-                               height());
-
-            //draw numbers
-            QString val = QString::number(d1);
-
-            mPen->setColor(Qt::black);
-            mPen->setWidth(1);
-            mPainter->setPen(*mPen);
-            if (val.length() >= 1)
-                mPainter->drawText(event_x + 3,
-                                   c_dataarea_y - 25,
-                                   val.at(0));
-            if (val.length() >= 2)
-                mPainter->drawText(event_x + 3,
-                                   c_dataarea_y - 25 + 8,\
-                                   val.at(1));
-            if (val.length() >= 3)
-                mPainter->drawText(event_x + 3,
-                                   c_dataarea_y - 25 + 16,
-                                   val.at(2));
+        event_x = tick / m_zoom + c_keyboard_padding_x;
+
+        /* generate the value */
+        event_height = d1;
+
+        if ( m_status == EVENT_PROGRAM_CHANGE ||
+             m_status == EVENT_CHANNEL_PRESSURE  ){
+
+            event_height = d0;
         }
+
+        /* draw vert lines */
+        mPen->setWidth(2);
+        mPainter->setPen(*mPen);
+        mPainter->drawLine(event_x + 1,
+                           height() - event_height,
+                           event_x + 1,
+                           height());
+
+        //draw numbers
+        QString val = QString::number(d1);
+
+        mPen->setColor(Qt::black);
+        mPen->setWidth(1);
+        mPainter->setPen(*mPen);
+        if (val.length() >= 1)
+            mPainter->drawText(event_x + 3,
+                               c_dataarea_y - 25,
+                               val.at(0));
+        if (val.length() >= 2)
+            mPainter->drawText(event_x + 3,
+                               c_dataarea_y - 25 + 8,\
+                               val.at(1));
+        if (val.length() >= 3)
+            mPainter->drawText(event_x + 3,
+                               c_dataarea_y - 25 + 16,
+                               val.at(2));
     }
 
     //draw edit line
@@ -187,6 +180,8 @@ void EditEventValues::mousePressEvent(QMouseEvent *event)
     mOld->setY(0);
     mOld->setWidth(0);
     mOld->setHeight(0);
+
+    update();
 }
 
 void EditEventValues::mouseReleaseEvent(QMouseEvent *event)
@@ -221,7 +216,7 @@ void EditEventValues::mouseReleaseEvent(QMouseEvent *event)
         mRelativeAdjust = false;
     }
 
-
+    update();
 }
 
 void EditEventValues::mouseMoveEvent(QMouseEvent *event)
@@ -274,6 +269,8 @@ void EditEventValues::mouseMoveEvent(QMouseEvent *event)
         //move the drop location so we increment properly on next mouse move
         mDropY = mCurrentY;
     }
+
+    update();
 }
 
 void EditEventValues::xy_to_rect(  int a_x1,  int a_y1,
@@ -305,6 +302,7 @@ void EditEventValues::set_data_type( unsigned char a_status, unsigned char a_con
 {
     m_status = a_status;
     m_cc = a_control;
+    update();
 }
 
 void EditEventValues::convert_x( int a_x, long *a_tick )
@@ -4,7 +4,6 @@
 #include "MidiSequence.hpp"
 
 #include <QWidget>
-#include <QTimer>
 #include <QMouseEvent>
 #include <QPainter>
 #include <QPen>
@@ -62,7 +61,9 @@ private:
     QFont        mFont;
     QRect       *mOld;
     QString      mNumbers;
-    QTimer      *mTimer;
+
+    //lane events found in the last redraw
+    vector<MidiEventInfo> m_lane_events;
 
     int m_zoom;
 
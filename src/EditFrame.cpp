@@ -490,6 +490,29 @@ void EditFrame::updateBackgroundSeq(int newIndex)
 
 }
 
+void EditFrame::refreshSequence(int seqId, int changes)
+{
+    if (seqId != mSeqId)
+        return;
+
+    if (changes & e_change_events)
+    {
+        mNoteGrid->update();
+        mEventValues->update();
+        mEventTriggers->update();
+    }
+
+    //length and time signature live on the time bar
+    if (changes & (e_change_events | e_change_state))
+        mTimeBar->update();
+}
+
+void EditFrame::refreshPerformance(int changes)
+{
+    if (changes & e_change_tick)
+        mNoteGrid->refreshPlayhead();
+}
+
 void EditFrame::updateDrawGeometry()
 {
     QString seqLenText(QString::number(mSeq->getNumMeasures()));
@@ -534,7 +557,7 @@ void EditFrame::updateRecVol()
 
 void EditFrame::toggleMidiPlay(bool newVal)
 {
-    mSeq->set_playing(newVal);
+    mPerformance->post_command(e_command_set_playing, mSeqId, newVal);
 }
 
 void EditFrame::toggleMidiQRec(bool newVal)
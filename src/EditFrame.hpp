@@ -41,6 +41,10 @@ public:
     //set a new editing mode
     void setEditorMode(edit_mode_e mode);
 
+    //repaint whatever shows a change pushed by the performance
+    void refreshSequence(int seqId, int changes);
+    void refreshPerformance(int changes);
+
 private:
     Ui::EditFrame   *ui;
 
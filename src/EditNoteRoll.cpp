@@ -21,7 +21,7 @@ EditNoteRoll::EditNoteRoll(MidiPerformance *a_perf,
     m_is_drag_pasting(false),
     m_is_drag_pasting_start(false),
     m_justselected_one(false),
-    m_old_progress_x(0),
+    m_progress_x(0),
     m_background_sequence(0),
     m_drawing_background_seq(false),
     editMode(mode),
@@ -34,19 +34,15 @@ EditNoteRoll::EditNoteRoll(MidiPerformance *a_perf,
                   QSizePolicy::Fixed);
 
     setFocusPolicy(Qt::StrongFocus);
-
-    //start refresh timer to queue regular redraws
-    mTimer = new QTimer(this);
-    mTimer->setInterval(20);
-    QObject::connect(mTimer,
-                     SIGNAL(timeout()),
-                     this,
-                     SLOT(update()));
-    mTimer->start();
 }
 
 void EditNoteRoll::paintEvent(QPaintEvent *)
 {
+    //the grid and the notes come from cached layers covering the
+    //visible part of the roll, only the playhead and the gesture
+    //overlays are drawn fresh every time
+    updateLayers(visibleRegion().boundingRect());
+
     mPainter = new QPainter(this);
     mBrush = new QBrush(Qt::NoBrush);
     mPen = new QPen(Qt::black);
@@ -55,6 +51,187 @@ void EditNoteRoll::paintEvent(QPaintEvent *)
     mPainter->setBrush(*mBrush);
     mPainter->setFont(mFont);
 
+    mPainter->drawPixmap(m_layer_rect.topLeft(), m_grid_layer);
+
+    //draw the playhead
+    m_progress_x = m_seq->get_last_tick() / m_zoom + c_keyboard_padding_x;
+
+    mPen->setColor(Qt::red);
+    mPen->setStyle(Qt::SolidLine);
+    mPainter->setPen(*mPen);
+    mPainter->drawLine(m_progress_x,
+                       0,
+                       m_progress_x,
+                       height() * 8);
+
+    //notes sit on top of the playhead
+    mPainter->drawPixmap(m_layer_rect.topLeft(), m_note_layer);
+
+    /* draw selections */
+    int x,y,w,h;
+
+    //painter reset
+    mBrush->setStyle(Qt::NoBrush);
+    mPainter->setBrush(*mBrush);
+
+    if ( m_selecting  ||  m_moving
+         || m_paste ||  m_growing )
+        mPen->setStyle(Qt::SolidLine);
+
+    if ( m_selecting ){
+
+        xy_to_rect ( m_drop_x,
+                     m_drop_y,
+                     m_current_x,
+                     m_current_y,
+                     &x, &y,
+                     &w, &h );
+
+        m_old.x = x;
+        m_old.y = y;
+        m_old.width = w;
+        m_old.height = h + keyY;
+
+        mPen->setColor(Qt::black);
+        mPainter->setPen(*mPen);
+        mPainter->drawRect(x + c_keyboard_padding_x,
+                           y,
+                           w,
+                           h + keyY );
+    }
+
+    if ( m_moving || m_paste )
+    {
+        int delta_x = m_current_x - m_drop_x;
+        int delta_y = m_current_y - m_drop_y;
+
+        x = m_selected.x + delta_x;
+        y = m_selected.y + delta_y;
+
+        mPen->setColor(Qt::black);
+        mPainter->setPen(*mPen);
+        switch (editMode)
+        {
+        case NOTE:
+            mPainter->drawRect(x + c_keyboard_padding_x,
+                               y,
+                               m_selected.width,
+                               m_selected.height);
+            break;
+        case DRUM:
+            mPainter->drawRect(x - note_height * 0.5 + c_keyboard_padding_x,
+                               y,
+                               m_selected.width + note_height,
+                               m_selected.height);
+            break;
+        }
+        m_old.x = x;
+        m_old.y = y;
+        m_old.width = m_selected.width;
+        m_old.height = m_selected.height;
+    }
+
+    if ( m_growing )
+    {
+        int delta_x = m_current_x - m_drop_x;
+        int width = delta_x + m_selected.width;
+
+        if ( width < 1 )
+            width = 1;
+
+        x = m_selected.x;
+        y = m_selected.y;
+
+        mPen->setColor(Qt::black);
+        mPainter->setPen(*mPen);
+        mPainter->drawRect(x + c_keyboard_padding_x,
+                           y,
+                           width,
+                           m_selected.height );
+
+        m_old.x = x;
+        m_old.y = y;
+        m_old.width = width;
+        m_old.height = m_selected.height;
+
+    }
+    delete mPainter;
+    delete mBrush;
+    delete mPen;
+}
+
+void EditNoteRoll::updateLayers(const QRect &a_view)
+{
+    //nothing on screen, nothing to render
+    if ( a_view.isEmpty() )
+        return;
+
+    //everything the grid depends on
+    QString grid_key = QString("%1 %2 %3 %4 %5 %6 %7 %8 %9 %10 %11")
+            .arg(a_view.x()).arg(a_view.y())
+            .arg(a_view.width()).arg(a_view.height())
+            .arg(m_zoom).arg(m_snap).arg(m_scale).arg(m_key)
+            .arg(editMode)
+            .arg(m_seq->getBeatsPerMeasure())
+            .arg(m_seq->getBeatWidth());
+
+    //and the notes on top of that
+    QString note_key = grid_key + QString(" %1").arg(m_seq->get_edit_generation());
+
+    if ( m_drawing_background_seq && m_perform->is_active( m_background_sequence ))
+    {
+        note_key += QString(" %1 %2")
+                .arg(m_background_sequence)
+                .arg(m_perform->get_sequence( m_background_sequence )->get_edit_generation());
+    }
+
+    m_layer_rect = a_view;
+
+    if ( grid_key != m_grid_key )
+    {
+        m_grid_layer = QPixmap(a_view.size());
+        m_grid_layer.fill(Qt::transparent);
+
+        mPainter = new QPainter(&m_grid_layer);
+        mBrush = new QBrush(Qt::NoBrush);
+        mPen = new QPen(Qt::black);
+        mPainter->translate(-a_view.topLeft());
+        mPainter->setPen(*mPen);
+        mPainter->setBrush(*mBrush);
+
+        drawGrid();
+
+        delete mPainter;
+        delete mBrush;
+        delete mPen;
+
+        m_grid_key = grid_key;
+    }
+
+    if ( note_key != m_note_key )
+    {
+        m_note_layer = QPixmap(a_view.size());
+        m_note_layer.fill(Qt::transparent);
+
+        mPainter = new QPainter(&m_note_layer);
+        mBrush = new QBrush(Qt::NoBrush);
+        mPen = new QPen(Qt::black);
+        mPainter->translate(-a_view.topLeft());
+        mPainter->setPen(*mPen);
+        mPainter->setBrush(*mBrush);
+
+        drawNotes(a_view);
+
+        delete mPainter;
+        delete mBrush;
+        delete mPen;
+
+        m_note_key = note_key;
+    }
+}
+
+void EditNoteRoll::drawGrid()
+{
     //draw border
     //    m_painter->drawRect(0, 0, width(), height());
 
@@ -158,31 +335,29 @@ void EditNoteRoll::paintEvent(QPaintEvent *)
                            base_line,
                            keyAreaY);
     }
+}
 
-    //draw the playhead
-    mPen->setColor(Qt::red);
-    mPen->setStyle(Qt::SolidLine);
-    mPainter->setPen(*mPen);
-    mPainter->drawLine(m_old_progress_x,
-                       0,
-                       m_old_progress_x,
-                       height() * 8);
-
-    m_old_progress_x = (m_seq->get_last_tick() / m_zoom + c_keyboard_padding_x);
-
-    //draw notes
+void EditNoteRoll::drawNotes(const QRect &a_area)
+{
     long tick_s;
     long tick_f;
     int note;
 
     bool selected;
 
-    int velocity;
-
     draw_type dt;
 
-    int start_tick = 0;
-    int end_tick = (width() * m_zoom);
+    //only ask for the notes inside the layer's area,
+    //padded for drum hits
+    long start_tick = (a_area.left() - c_keyboard_padding_x - keyY) * m_zoom;
+    long end_tick = (a_area.right() - c_keyboard_padding_x + keyY) * m_zoom;
+    int note_h = (keyAreaY - a_area.top()) / keyY + 1;
+    int note_l = (keyAreaY - a_area.bottom()) / keyY - 1;
+
+    if ( note_h > c_num_keys - 1 )
+        note_h = c_num_keys - 1;
+    if ( note_l < 0 )
+        note_l = 0;
 
     MidiSequence *seq = NULL;
 
@@ -213,256 +388,168 @@ void EditNoteRoll::paintEvent(QPaintEvent *)
         /* draw boxes from sequence */
         mPen->setColor(Qt::black);
         mPen->setStyle(Qt::SolidLine);
-        seq->reset_draw_marker();
+        seq->get_note_events_in_range( start_tick, end_tick,
+                                       note_l, note_h,
+                                       &m_visible_notes );
 
-        while ( (dt = seq->get_next_note_event( &tick_s, &tick_f, &note, &selected, &velocity )) != DRAW_FIN ) {
+        for ( unsigned n = 0; n < m_visible_notes.size(); ++n ) {
 
-            if ((tick_s >= start_tick && tick_s <= end_tick) ||
-                    ( (dt == DRAW_NORMAL_LINKED) && (tick_f >= start_tick && tick_f <= end_tick))
-                    ) {
+            dt = m_visible_notes[n].m_type;
+            tick_s = m_visible_notes[n].m_tick_start;
+            tick_f = m_visible_notes[n].m_tick_finish;
+            note = m_visible_notes[n].m_note;
+            selected = m_visible_notes[n].m_selected;
 
-                /* turn into screen corrids */
-                note_x = tick_s / m_zoom + c_keyboard_padding_x;
-                note_y = keyAreaY -(note * keyY) - keyY - 1 + 2;
-                switch (editMode)
-                {
-                case NOTE:
-                    note_height = keyY - 3;
-                    break;
-                case DRUM:
-                    note_height = keyY;
-                    break;
-                }
-
-                int in_shift = 0;
-                int length_add = 0;
+            /* turn into screen corrids */
+            note_x = tick_s / m_zoom + c_keyboard_padding_x;
+            note_y = keyAreaY -(note * keyY) - keyY - 1 + 2;
+            switch (editMode)
+            {
+            case NOTE:
+                note_height = keyY - 3;
+                break;
+            case DRUM:
+                note_height = keyY;
+                break;
+            }
 
-                if ( dt == DRAW_NORMAL_LINKED )
-                {
-                    if (tick_f >= tick_s) {
-                        note_width = (tick_f - tick_s) / m_zoom;
-                        if ( note_width < 1 )
-                            note_width = 1;
-                    }
-                    else
-                    {
-                        note_width = (m_seq->getLength() - tick_s) / m_zoom;
-                    }
+            int in_shift = 0;
+            int length_add = 0;
 
+            if ( dt == DRAW_NORMAL_LINKED )
+            {
+                if (tick_f >= tick_s) {
+                    note_width = (tick_f - tick_s) / m_zoom;
+                    if ( note_width < 1 )
+                        note_width = 1;
                 }
                 else
                 {
-                    note_width = 16 / m_zoom;
+                    note_width = (m_seq->getLength() - tick_s) / m_zoom;
                 }
 
-                if ( dt == DRAW_NOTE_ON )
-                {
-                    in_shift = 0;
-                    length_add = 2;
-                }
+            }
+            else
+            {
+                note_width = 16 / m_zoom;
+            }
 
-                if ( dt == DRAW_NOTE_OFF )
-                {
-                    in_shift = -1;
-                    length_add = 1;
-                }
+            if ( dt == DRAW_NOTE_ON )
+            {
+                in_shift = 0;
+                length_add = 2;
+            }
 
-                mPen->setColor(Qt::black);
+            if ( dt == DRAW_NOTE_OFF )
+            {
+                in_shift = -1;
+                length_add = 1;
+            }
 
-                if ( method == 0 )
-                    mPen->setColor(Qt::darkGray);
+            mPen->setColor(Qt::black);
 
-                mBrush->setStyle(Qt::SolidPattern);
-                mBrush->setColor(Qt::black);
-                mPainter->setBrush(*mBrush);
-                mPainter->setPen(*mPen);
+            if ( method == 0 )
+                mPen->setColor(Qt::darkGray);
 
-                switch (editMode)
+            mBrush->setStyle(Qt::SolidPattern);
+            mBrush->setColor(Qt::black);
+            mPainter->setBrush(*mBrush);
+            mPainter->setPen(*mPen);
+
+            switch (editMode)
+            {
+            case NOTE:
+                //draw outer note boundary (shadow)
+                mPainter->drawRect(note_x,
+                                   note_y,
+                                   note_width,
+                                   note_height);
+                //draw shadow for notes starting before zero
+                if (tick_f < tick_s)
                 {
-                case NOTE:
-                    //draw outer note boundary (shadow)
-                    mPainter->drawRect(note_x,
+                    mPainter->setPen(*mPen);
+                    mPainter->drawRect(c_keyboard_padding_x,
                                        note_y,
-                                       note_width,
+                                       tick_f / m_zoom,
                                        note_height);
-                    //draw shadow for notes starting before zero
-                    if (tick_f < tick_s)
-                    {
-                        mPainter->setPen(*mPen);
-                        mPainter->drawRect(c_keyboard_padding_x,
-                                           note_y,
-                                           tick_f / m_zoom,
-                                           note_height);
-                    }
-                    break;
-                case DRUM:
-                    //draw polygon for drum hits
-                    QPointF points[4] = {
-                        QPointF(note_x - note_height * 0.5,
-                        note_y + note_height * 0.5),
-                        QPointF(note_x,
-                        note_y),
-                        QPointF(note_x + note_height * 0.5,
-                        note_y + note_height * 0.5),
-                        QPointF(note_x,
-                        note_y + note_height)
-                    };
-                    mPainter->drawPolygon(points, 4);
-                    break;
                 }
+                break;
+            case DRUM:
+                //draw polygon for drum hits
+                QPointF points[4] = {
+                    QPointF(note_x - note_height * 0.5,
+                    note_y + note_height * 0.5),
+                    QPointF(note_x,
+                    note_y),
+                    QPointF(note_x + note_height * 0.5,
+                    note_y + note_height * 0.5),
+                    QPointF(note_x,
+                    note_y + note_height)
+                };
+                mPainter->drawPolygon(points, 4);
+                break;
+            }
 
-                //draw note highlight if there's room
-                //always draw them in drum mode
-                if (note_width > 3 || editMode == DRUM)
-                {
-                    //red noted selected, otherwise plain white
-                    if ( selected )
-                        mBrush->setColor(Qt::red);
-                    else
-                        mBrush->setColor(Qt::white);
+            //draw note highlight if there's room
+            //always draw them in drum mode
+            if (note_width > 3 || editMode == DRUM)
+            {
+                //red noted selected, otherwise plain white
+                if ( selected )
+                    mBrush->setColor(Qt::red);
+                else
+                    mBrush->setColor(Qt::white);
 
-                    mPainter->setBrush(*mBrush);
-                    if ( method == 1 )
+                mPainter->setBrush(*mBrush);
+                if ( method == 1 )
+                {
+                    switch (editMode)
                     {
-                        switch (editMode)
+                    case NOTE:
+                        //if the note fits in the grid
+                        if (tick_f >= tick_s)
                         {
-                        case NOTE:
-                            //if the note fits in the grid
-                            if (tick_f >= tick_s)
-                            {
-                                //draw inner note (highlight)
-                                mPainter->drawRect(note_x + in_shift,
-                                                   note_y,
-                                                   note_width - 1 + length_add,
-                                                   note_height - 1 );
-                            }
-                            else
-                            {
-                                mPainter->drawRect(note_x + in_shift,
-                                                   note_y,
-                                                   note_width ,
-                                                   note_height - 1);
-
-                                mPainter->drawRect(c_keyboard_padding_x,
-                                                   note_y,
-                                                   (tick_f/m_zoom) - 3 + length_add,
-                                                   note_height - 1);
-                            }
-                            break;
-                        case DRUM:
                             //draw inner note (highlight)
-                            QPointF points[4] = {
-                                QPointF(note_x - note_height * 0.5,
-                                note_y + note_height * 0.5),
-                                QPointF(note_x,
-                                note_y),
-                                QPointF(note_x + note_height * 0.5 - 1,
-                                note_y + note_height * 0.5),
-                                QPointF(note_x,
-                                note_y + note_height - 1)
-                            };
-                            mPainter->drawPolygon(points, 4);
-                            break;
+                            mPainter->drawRect(note_x + in_shift,
+                                               note_y,
+                                               note_width - 1 + length_add,
+                                               note_height - 1 );
                         }
+                        else
+                        {
+                            mPainter->drawRect(note_x + in_shift,
+                                               note_y,
+                                               note_width ,
+                                               note_height - 1);
+
+                            mPainter->drawRect(c_keyboard_padding_x,
+                                               note_y,
+                                               (tick_f/m_zoom) - 3 + length_add,
+                                               note_height - 1);
+                        }
+                        break;
+                    case DRUM:
+                        //draw inner note (highlight)
+                        QPointF points[4] = {
+                            QPointF(note_x - note_height * 0.5,
+                            note_y + note_height * 0.5),
+                            QPointF(note_x,
+                            note_y),
+                            QPointF(note_x + note_height * 0.5 - 1,
+                            note_y + note_height * 0.5),
+                            QPointF(note_x,
+                            note_y + note_height - 1)
+                        };
+                        mPainter->drawPolygon(points, 4);
+                        break;
                     }
                 }
             }
         }
     }
-
-    /* draw selections */
-    int x,y,w,h;
-
-    //painter reset
-    mBrush->setStyle(Qt::NoBrush);
-    mPainter->setBrush(*mBrush);
-
-    if ( m_selecting  ||  m_moving
-         || m_paste ||  m_growing )
-        mPen->setStyle(Qt::SolidLine);
-
-    if ( m_selecting ){
-
-        xy_to_rect ( m_drop_x,
-                     m_drop_y,
-                     m_current_x,
-                     m_current_y,
-                     &x, &y,
-                     &w, &h );
-
-        m_old.x = x;
-        m_old.y = y;
-        m_old.width = w;
-        m_old.height = h + keyY;
-
-        mPen->setColor(Qt::black);
-        mPainter->setPen(*mPen);
-        mPainter->drawRect(x + c_keyboard_padding_x,
-                           y,
-                           w,
-                           h + keyY );
-    }
-
-    if ( m_moving || m_paste )
-    {
-        int delta_x = m_current_x - m_drop_x;
-        int delta_y = m_current_y - m_drop_y;
-
-        x = m_selected.x + delta_x;
-        y = m_selected.y + delta_y;
-
-        mPen->setColor(Qt::black);
-        mPainter->setPen(*mPen);
-        switch (editMode)
-        {
-        case NOTE:
-            mPainter->drawRect(x + c_keyboard_padding_x,
-                               y,
-                               m_selected.width,
-                               m_selected.height);
-            break;
-        case DRUM:
-            mPainter->drawRect(x - note_height * 0.5 + c_keyboard_padding_x,
-                               y,
-                               m_selected.width + note_height,
-                               m_selected.height);
-            break;
-        }
-        m_old.x = x;
-        m_old.y = y;
-        m_old.width = m_selected.width;
-        m_old.height = m_selected.height;
-    }
-
-    if ( m_growing )
-    {
-        int delta_x = m_current_x - m_drop_x;
-        int width = delta_x + m_selected.width;
-
-        if ( width < 1 )
-            width = 1;
-
-        x = m_selected.x;
-        y = m_selected.y;
-
-        mPen->setColor(Qt::black);
-        mPainter->setPen(*mPen);
-        mPainter->drawRect(x + c_keyboard_padding_x,
-                           y,
-                           width,
-                           m_selected.height );
-
-        m_old.x = x;
-        m_old.y = y;
-        m_old.width = width;
-        m_old.height = m_selected.height;
-
-    }
-    delete mPainter;
-    delete mBrush;
-    delete mPen;
 }
 
+
 void EditNoteRoll::mousePressEvent(QMouseEvent *event)
 {
     int numsel;
@@ -673,6 +760,7 @@ void EditNoteRoll::mousePressEvent(QMouseEvent *event)
         m_seq->set_dirty();
     }
 
+    update();
 }
 
 void EditNoteRoll::mouseReleaseEvent(QMouseEvent *event)
@@ -791,6 +879,8 @@ void EditNoteRoll::mouseReleaseEvent(QMouseEvent *event)
     {
         m_seq->set_dirty();
     }
+
+    update();
 }
 
 void EditNoteRoll::mouseMoveEvent(QMouseEvent *event)
@@ -826,10 +916,15 @@ void EditNoteRoll::mouseMoveEvent(QMouseEvent *event)
 
         m_seq->add_note( tick, m_note_length - 2, note, true );
     }
+
+    update();
 }
 
 void EditNoteRoll::keyPressEvent(QKeyEvent *event)
 {
+    //most keys return straight after acting,
+    //the repaint happens once we're back in the event loop
+    update();
 
     if (event->key() == Qt::Key_Delete ||
             event->key() == Qt::Key_Backspace)
@@ -1007,6 +1102,7 @@ void EditNoteRoll::setNote_length(int length)
 void EditNoteRoll::set_snap(int snap)
 {
     m_snap = snap;
+    update();
 }
 
 void EditNoteRoll::start_paste( )
@@ -1037,21 +1133,38 @@ void EditNoteRoll::start_paste( )
     /* adjust for clipboard being shifted to tick 0 */
     m_selected.x += m_drop_x;
     m_selected.y += (m_drop_y - m_selected.y);
+
+    update();
+}
+
+void EditNoteRoll::refreshPlayhead()
+{
+    int progress_x = m_seq->get_last_tick() / m_zoom + c_keyboard_padding_x;
+
+    //only the strips under the old and new playhead need repainting
+    if (progress_x != m_progress_x)
+    {
+        update(m_progress_x - 1, 0, 3, height());
+        update(progress_x - 1, 0, 3, height());
+    }
 }
 
 void EditNoteRoll::zoomIn()
 {
     if (m_zoom > 1)
         m_zoom *= 0.5;
+    update();
 }
 
 void EditNoteRoll::zoomOut()
 {
     if (m_zoom < 32)
         m_zoom *= 2;
+    update();
 }
 
 void EditNoteRoll::updateEditMode(edit_mode_e mode)
 {
     editMode = mode;
+    update();
 }
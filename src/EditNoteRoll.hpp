@@ -7,8 +7,8 @@
 
 #include <QWidget>
 #include <QPainter>
+#include <QPixmap>
 #include <QPen>
-#include <QTimer>
 #include <QMouseEvent>
 
 ///
@@ -35,6 +35,9 @@ public:
     void zoomIn();
     void zoomOut();
 
+    //repaint the playhead if it has moved
+    void refreshPlayhead();
+
 protected:
     //override painting event to draw on the frame
     void paintEvent         (QPaintEvent *);
@@ -52,6 +55,14 @@ protected:
     QSize sizeHint() const;
 
 private:
+    //re-renders whichever cached layer is out of date for the
+    //visible area of the roll
+    void updateLayers(const QRect &a_view);
+
+    //draw the note grid and the notes, into the current painter
+    void drawGrid();
+    void drawNotes(const QRect &a_area);
+
     //performs a 'snap' on y
     void snap_y( int *a_y );
 
@@ -88,7 +99,6 @@ private:
     QBrush      *mBrush;
     QPainter    *mPainter;
     QFont        mFont;
-    QTimer      *mTimer;
 
     int m_scale;
     int m_key;
@@ -97,6 +107,17 @@ private:
 
     int m_note_length;
 
+    //notes found in the last redraw, kept to reuse the storage
+    vector<MidiNoteInfo> m_visible_notes;
+
+    //cached grid and note layers, with the settings and sequence
+    //edit generation they were rendered for
+    QPixmap m_grid_layer;
+    QPixmap m_note_layer;
+    QRect   m_layer_rect;
+    QString m_grid_key;
+    QString m_note_key;
+
     /* when highlighting a bunch of events */
     bool m_selecting;
     bool m_adding;
@@ -119,7 +140,7 @@ private:
     int m_move_snap_offset_x;
 
     //playhead tracking
-    int m_old_progress_x;
+    int m_progress_x;
 
     //background sequence
     int m_background_sequence;
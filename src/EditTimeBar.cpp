@@ -4,15 +4,6 @@ EditTimeBar::EditTimeBar(MidiSequence *a_seq, QWidget *parent):
     QWidget(parent),
     m_seq(a_seq)
 {
-    //start refresh timer to queue regular redraws
-    m_timer = new QTimer(this);
-    m_timer->setInterval(50);
-    QObject::connect(m_timer,
-                     SIGNAL(timeout()),
-                     this,
-                     SLOT(update()));
-    m_timer->start();
-
     m_zoom = 1;
 
     setSizePolicy(QSizePolicy::Fixed,
@@ -119,10 +110,12 @@ void EditTimeBar::zoomIn()
 {
     if (m_zoom > 1)
         m_zoom *= 0.5;
+    update();
 }
 
 void EditTimeBar::zoomOut()
 {
     if (m_zoom < 32)
         m_zoom *= 2;
+    update();
 }
@@ -4,7 +4,6 @@
 #include "MidiSequence.hpp"
 
 #include <QWidget>
-#include <QTimer>
 #include <QPainter>
 #include <QPen>
 
@@ -42,7 +41,6 @@ private slots:
 private:
     MidiSequence *m_seq;
 
-    QTimer      *m_timer;
     QPen        *m_pen;
     QBrush      *m_brush;
     QPainter    *m_painter;
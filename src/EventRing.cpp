@@ -0,0 +1,51 @@
+#include "EventRing.hpp"
+
+EventRing::EventRing( ) :
+    m_head(0),
+    m_tail(0)
+{
+}
+
+bool
+EventRing::push( MidiEvent *a_ev )
+{
+    unsigned int tail = m_tail;
+
+    if ( tail - m_head >= (unsigned int) c_event_ring_size )
+        return false;
+
+    slot *s = &m_ring[tail & (c_event_ring_size - 1)];
+
+    s->m_timestamp = a_ev->get_timestamp();
+    s->m_status = a_ev->get_status();
+    a_ev->get_data( &s->m_data[0], &s->m_data[1] );
+
+    /* the slot must be complete before the consumer sees it */
+    __sync_synchronize();
+    m_tail = tail + 1;
+
+    return true;
+}
+
+bool
+EventRing::pop( MidiEvent *a_ev )
+{
+    unsigned int head = m_head;
+
+    if ( head == m_tail )
+        return false;
+
+    __sync_synchronize();
+
+    slot *s = &m_ring[head & (c_event_ring_size - 1)];
+
+    a_ev->set_timestamp( s->m_timestamp );
+    a_ev->set_status( s->m_status );
+    a_ev->set_data( s->m_data[0], s->m_data[1] );
+
+    /* done reading the slot before handing it back */
+    __sync_synchronize();
+    m_head = head + 1;
+
+    return true;
+}
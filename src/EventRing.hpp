@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Globals.hpp"
+#include "MidiEvent.hpp"
+
+/* must be a power of two */
+const int c_event_ring_size = 512;
+
+///
+/// \brief The EventRing class
+///
+/// Lock free single producer, single consumer ring of short MIDI
+/// events. The input thread pushes what it records into a
+/// sequence, the output thread pops and merges them at a point
+/// where it isn't playing that sequence
+
+class EventRing {
+
+private:
+
+    struct slot
+    {
+        long m_timestamp;
+        unsigned char m_status;
+        unsigned char m_data[2];
+    };
+
+    slot m_ring[c_event_ring_size];
+
+    /* only the consumer moves the head, only the producer the tail */
+    volatile unsigned int m_head;
+    volatile unsigned int m_tail;
+
+public:
+
+    EventRing();
+
+    /* producer only, false when full */
+    bool push( MidiEvent *a_ev );
+
+    /* consumer only, false when empty */
+    bool pop( MidiEvent *a_ev );
+
+    bool is_empty() const { return m_head == m_tail; }
+
+};
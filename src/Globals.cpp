@@ -0,0 +1,37 @@
+#include "Globals.hpp"
+
+#ifdef LASH_SUPPORT
+#    include "Lash.hpp"
+#endif
+
+/* some default config settings stored here, apart from main() so
+   the engine links into the tools as well */
+
+bool global_manual_alsa_ports = true;
+bool global_showmidi = false;
+bool global_priority = false;
+bool global_stats = false;
+bool global_pass_sysex = false;
+bool global_file_cache = false;
+bool global_lazy_banks = false;
+QString global_filename = "";
+QString last_used_dir ="/";
+QString recent_files[10];
+bool global_print_keys = false;
+interaction_method_e global_interactionmethod = e_seq24_interaction;
+
+bool global_with_jack_transport = false;
+bool global_with_jack_master = false;
+bool global_with_jack_master_cond = false;
+bool global_jack_start_mode = true;
+QString global_jack_session_uuid = "";
+QMap<thumb_colours_e, QColor> colourMap;
+
+user_midi_bus_definition   global_user_midi_bus_definitions[c_maxBuses];
+user_instrument_definition global_user_instrument_definitions[c_max_instruments];
+
+bool is_pattern_playing = false;
+
+#ifdef LASH_SUPPORT
+Lash *lash_driver = NULL;
+#endif
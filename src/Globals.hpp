@@ -149,6 +149,8 @@ extern bool global_with_jack_master;
 extern bool global_with_jack_master_cond;
 extern bool global_jack_start_mode;
 extern bool global_manual_alsa_ports;
+extern bool global_file_cache;
+extern bool global_lazy_banks;
 
 extern QString global_filename;
 extern QString global_jack_session_uuid;
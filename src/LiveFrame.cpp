@@ -17,6 +17,12 @@ LiveFrame::LiveFrame(QWidget *parent, MidiPerformance *perf) :
 
     ui->setupUi(this);
 
+    for (int i = 0; i < cSeqsInBank; i++)
+    {
+        mPreviewSeqs[i] = NULL;
+        mPreviewGenerations[i] = 0;
+    }
+
     mMsgBoxNewSeqCheck = new QMessageBox(this);
     mMsgBoxNewSeqCheck->setText(tr("Sequence already present"));
     mMsgBoxNewSeqCheck->setInformativeText(tr("There is already a sequence stored in this slot. Overwrite it and create a new blank sequence?"));
@@ -38,43 +44,37 @@ LiveFrame::LiveFrame(QWidget *parent, MidiPerformance *perf) :
             this,
             SLOT(updateBankName()));
 
-    //start refresh timer to queue regular redraws
-    mRedrawTimer = new QTimer(this);
-    mRedrawTimer->setInterval(50);
-    connect(mRedrawTimer,
-            SIGNAL(timeout()),
-            this,
-            SLOT(update()));
-    mRedrawTimer->start();
-
 }
 
-void LiveFrame::paintEvent(QPaintEvent *)
+void LiveFrame::paintEvent(QPaintEvent *event)
 {
-    drawAllSequences();
+    //one consistent view of what's playing for the whole paint
+    mPerf->get_transport_state(&mState);
+
+    mPainter = new QPainter(this);
+    drawAllSequences(event->region());
+    delete mPainter;
 }
 
 LiveFrame::~LiveFrame()
 {
     delete ui;
     delete mMsgBoxNewSeqCheck;
-    delete mRedrawTimer;
 }
 
 void LiveFrame::drawSequence(int a_seq)
 {
-    mPainter = new QPainter(this);
-    mPen = new QPen(Qt::black);
-    mBrush = new QBrush(Qt::darkGray);
+    mPen = QPen(Qt::black);
+    mBrush = QBrush(Qt::darkGray);
     mFont.setPointSize(6);
     mFont.setLetterSpacing(QFont::AbsoluteSpacing,
                            1);
-    mPainter->setPen(*mPen);
-    mPainter->setBrush(*mBrush);
+    mPainter->setPen(mPen);
+    mPainter->setBrush(mBrush);
     mPainter->setFont(mFont);
 
     //timing info for timed draw elements
-    long tick = mPerf->get_tick();
+    long tick = mState.m_tick;
     int metro = (tick / c_ppqn) % 2;
 
     //grab frame dimensions for scaled drawing
@@ -105,64 +105,64 @@ void LiveFrame::drawSequence(int a_seq)
             //get seq's assigned colour
             QColor backColour = QColor(colourMap.value(mPerf->getSequenceColour(a_seq)));
 
-            mPen->setColor(Qt::black);
-            mPen->setStyle(Qt::SolidLine);
+            mPen.setColor(Qt::black);
+            mPen.setStyle(Qt::SolidLine);
 
-            if (seq->get_playing() &&
-                    (seq->get_queued() || seq->getOffFromSnap()))
+            if (mState.is_playing(a_seq) &&
+                    (mState.is_queued(a_seq) || mState.is_off_from_snap(a_seq)))
                 //playing but queued to mute, or
                 //turning off after snapping
             {
-                mPen->setWidth(2);
-                mPen->setColor(Qt::black);
-                mPen->setStyle(Qt::DashLine);
-                mPainter->setPen(*mPen);
+                mPen.setWidth(2);
+                mPen.setColor(Qt::black);
+                mPen.setStyle(Qt::DashLine);
+                mPainter->setPen(mPen);
                 backColour.setAlpha(210);
-                mBrush->setColor(backColour);
-                mPainter->setBrush(*mBrush);
+                mBrush.setColor(backColour);
+                mPainter->setBrush(mBrush);
                 mPainter->drawRect(base_x,
                                    base_y,
                                    thumbW + 1,
                                    thumbH + 1);
             }
-            else if (seq->get_playing())
+            else if (mState.is_playing(a_seq))
                 //playing, no queueing
             {
-                mPen->setWidth(2);
-                mPainter->setPen(*mPen);
+                mPen.setWidth(2);
+                mPainter->setPen(mPen);
                 backColour.setAlpha(210);
-                mBrush->setColor(backColour);
-                mPainter->setBrush(*mBrush);
+                mBrush.setColor(backColour);
+                mPainter->setBrush(mBrush);
                 mPainter->drawRect(base_x,
                                    base_y,
                                    thumbW + 1,
                                    thumbH + 1);
             }
-            else if (seq->get_queued())
+            else if (mState.is_queued(a_seq))
                 //not playing but queued
             {
-                mPen->setWidth(2);
-                mPen->setColor(Qt::darkGray);
-                mPen->setStyle(Qt::DashLine);
+                mPen.setWidth(2);
+                mPen.setColor(Qt::darkGray);
+                mPen.setStyle(Qt::DashLine);
                 backColour.setAlpha(180);
-                mBrush->setColor(backColour);
-                mPainter->setPen(*mPen);
-                mPainter->setBrush(*mBrush);
+                mBrush.setColor(backColour);
+                mPainter->setPen(mPen);
+                mPainter->setBrush(mBrush);
                 mPainter->drawRect(base_x,
                                    base_y,
                                    thumbW,
                                    thumbH);
             }
-            else if (seq->getOneshot())
+            else if (mState.is_oneshot(a_seq))
                 //queued for one-shot
             {
-                mPen->setWidth(2);
-                mPen->setColor(Qt::darkGray);
-                mPen->setStyle(Qt::DotLine);
+                mPen.setWidth(2);
+                mPen.setColor(Qt::darkGray);
+                mPen.setStyle(Qt::DotLine);
                 backColour.setAlpha(180);
-                mBrush->setColor(backColour);
-                mPainter->setPen(*mPen);
-                mPainter->setBrush(*mBrush);
+                mBrush.setColor(backColour);
+                mPainter->setPen(mPen);
+                mPainter->setBrush(mBrush);
                 mPainter->drawRect(base_x,
                                    base_y,
                                    thumbW,
@@ -171,11 +171,11 @@ void LiveFrame::drawSequence(int a_seq)
             else
                 //just not playing
             {
-                mPen->setStyle(Qt::NoPen);
+                mPen.setStyle(Qt::NoPen);
                 backColour.setAlpha(180);
-                mBrush->setColor(backColour);
-                mPainter->setPen(*mPen);
-                mPainter->setBrush(*mBrush);
+                mBrush.setColor(backColour);
+                mPainter->setPen(mPen);
+                mPainter->setBrush(mBrush);
                 mPainter->drawRect(base_x,
                                    base_y,
                                    thumbW,
@@ -184,10 +184,10 @@ void LiveFrame::drawSequence(int a_seq)
 
             //write seq data strings
             ///name
-            mPen->setColor(Qt::black);
-            mPen->setWidth(1);
-            mPen->setStyle(Qt::SolidLine);
-            mPainter->setPen(*mPen);
+            mPen.setColor(Qt::black);
+            mPen.setWidth(1);
+            mPen.setStyle(Qt::SolidLine);
+            mPainter->setPen(mPen);
             char name[20];
             snprintf(name, sizeof name, "%.13s", seq->get_name());
             mPainter->drawText(base_x + c_text_x,
@@ -218,89 +218,62 @@ void LiveFrame::drawSequence(int a_seq)
             int rectangle_x = base_x + 7;
             int rectangle_y = base_y + 15;
 
-            mPen->setColor(Qt::gray);
-            mBrush->setStyle(Qt::NoBrush);
-            mPainter->setBrush(*mBrush);
-            mPainter->setPen(*mPen);
+            mPen.setColor(Qt::gray);
+            mBrush.setStyle(Qt::NoBrush);
+            mPainter->setBrush(mBrush);
+            mPainter->setPen(mPen);
             //draw inner box for notes
             mPainter->drawRect(rectangle_x - 2,
                                rectangle_y - 1,
                                previewW,
                                previewH);
 
-            int lowest_note = seq->get_lowest_note_event( );
-            int highest_note = seq->get_highest_note_event( );
-
-            int height = highest_note - lowest_note;
-            height += 2;
-
             int length = seq->getLength();
 
-            long tick_s;
-            long tick_f;
-            int note;
-
-            bool selected;
-
-            int velocity;
-            draw_type dt;
-
-            seq->reset_draw_marker();
-
             //add padding to box measurements
             previewH -= 6;
             previewW -= 6;
             rectangle_x += 2;
             rectangle_y += 2;
 
-            while ( (dt = seq->get_next_note_event( &tick_s, &tick_f, &note,
-                                                    &selected, &velocity )) != DRAW_FIN ){
-
-                int note_y = previewH -
-                        (previewH  * (note + 1 - lowest_note)) / height ;
-
-                int tick_s_x = (tick_s * previewW)  / length;
-                int tick_f_x = (tick_f * previewH)  / length;
-
-                if ( dt == DRAW_NOTE_ON || dt == DRAW_NOTE_OFF )
-                    tick_f_x = tick_s_x + 1;
-                if ( tick_f_x <= tick_s_x )
-                    tick_f_x = tick_s_x + 1;
-
-                //draw line representing this note
-                mPen->setColor(Qt::black);
-                mPen->setWidth(2);
-                mPainter->setPen(*mPen);
-                mPainter->drawLine(rectangle_x + tick_s_x,
-                                   rectangle_y + note_y,
-                                   rectangle_x + tick_f_x,
-                                   rectangle_y + note_y );
+            //the notes are only re-rendered when the sequence
+            //has changed, the rest of the thumbnail is cheap
+            int slot = a_seq - m_bank_id * cSeqsInBank;
+            if (mPreviewGenerations[slot] != seq->get_edit_generation() ||
+                    mPreviewSeqs[slot] != seq ||
+                    mPreviews[slot].size() != QSize(previewW + 2, previewH + 2))
+            {
+                updatePreview(slot, seq);
             }
 
+            mPainter->drawPixmap(rectangle_x - 1,
+                                 rectangle_y - 1,
+                                 mPreviews[slot]);
+
             //draw playhead
-            int a_tick = mPerf->get_tick();
+            int a_tick = mState.m_tick;
             a_tick += (length - seq->get_trigger_offset( ));
             a_tick %= length;
 
             long tick_x = a_tick * previewW / length;
 
-            if (seq->get_playing())
-                mPen->setColor(Qt::red);
+            if (mState.is_playing(a_seq))
+                mPen.setColor(Qt::red);
             else
-                mPen->setColor(Qt::black);
+                mPen.setColor(Qt::black);
 
-            if ( seq->get_queued() ||
-                 (seq->getOffFromSnap() && seq->get_playing()))
+            if ( mState.is_queued(a_seq) ||
+                 (mState.is_off_from_snap(a_seq) && mState.is_playing(a_seq)))
             {
-                mPen->setColor(Qt::green);
+                mPen.setColor(Qt::green);
             }
-            else if (seq->getOneshot())
+            else if (mState.is_oneshot(a_seq))
             {
-                mPen->setColor(Qt::blue);
+                mPen.setColor(Qt::blue);
             }
 
-            mPen->setWidth(1);
-            mPainter->setPen(*mPen);
+            mPen.setWidth(1);
+            mPainter->setPen(mPen);
             mPainter->drawLine(rectangle_x + tick_x - 1,
                                rectangle_y - 1,
                                rectangle_x + tick_x - 1,
@@ -308,10 +281,10 @@ void LiveFrame::drawSequence(int a_seq)
         }
         else
         {
-            mPen->setColor(Qt::black);
-            mPen->setStyle(Qt::NoPen);
+            mPen.setColor(Qt::black);
+            mPen.setStyle(Qt::NoPen);
             mFont.setPointSize(15);
-            mPainter->setPen(*mPen);
+            mPainter->setPen(mPen);
             mPainter->setFont(mFont);
 
             //draw outline of this seq thumbnail
@@ -321,8 +294,8 @@ void LiveFrame::drawSequence(int a_seq)
                                thumbH);
 
             //no sequence present. Insert placeholder
-            mPen->setStyle(Qt::SolidLine);
-            mPainter->setPen(*mPen);
+            mPen.setStyle(Qt::SolidLine);
+            mPainter->setPen(mPen);
             mPainter->drawText(base_x + 2,
                                base_y + 17,
                                "+");
@@ -330,21 +303,111 @@ void LiveFrame::drawSequence(int a_seq)
     }
     //lessen alpha on each redraw to have smooth fading
     //done as a factor of the bpm to get useful fades
-    alpha *= 0.7 - mPerf->get_bpm() / 300;
+    alpha *= 0.7 - mState.m_bpm / 300;
 
     lastMetro = metro;
+}
 
-    delete mPainter;
-    delete mPen;
-    delete mBrush;
+void LiveFrame::updatePreview(int a_slot, MidiSequence *a_seq)
+{
+    //one pixel of margin around the preview for the pen width
+    mPreviewSeqs[a_slot] = a_seq;
+    mPreviewGenerations[a_slot] = a_seq->get_edit_generation();
+    mPreviews[a_slot] = QPixmap(previewW + 2, previewH + 2);
+    mPreviews[a_slot].fill(Qt::transparent);
+
+    int lowest_note = a_seq->get_lowest_note_event( );
+    int highest_note = a_seq->get_highest_note_event( );
+
+    int height = highest_note - lowest_note;
+    height += 2;
+
+    int length = a_seq->getLength();
+
+    a_seq->get_note_events_in_range(0, length,
+                                    0, c_num_keys - 1,
+                                    &mPreviewNotes);
+
+    QPainter painter(&mPreviews[a_slot]);
+    QPen pen(Qt::black);
+    pen.setWidth(2);
+    painter.setPen(pen);
+
+    for (unsigned n = 0; n < mPreviewNotes.size(); ++n)
+    {
+        MidiNoteInfo &info = mPreviewNotes[n];
+
+        int note_y = previewH -
+                (previewH  * (info.m_note + 1 - lowest_note)) / height ;
+
+        int tick_s_x = (info.m_tick_start * previewW)  / length;
+        int tick_f_x = (info.m_tick_finish * previewW)  / length;
+
+        if ( info.m_type == DRAW_NOTE_ON || info.m_type == DRAW_NOTE_OFF )
+            tick_f_x = tick_s_x + 1;
+        if ( tick_f_x <= tick_s_x )
+            tick_f_x = tick_s_x + 1;
+
+        //draw line representing this note
+        painter.drawLine(1 + tick_s_x,
+                         1 + note_y,
+                         1 + tick_f_x,
+                         1 + note_y );
+    }
 }
-void LiveFrame::drawAllSequences()
+
+void LiveFrame::drawAllSequences(const QRegion &a_area)
 {
     for (int i=0; i < (c_mainwnd_rows * c_mainwnd_cols); i++)
     {
-        drawSequence(i + (m_bank_id * c_mainwnd_rows * c_mainwnd_cols));
+        int seqId = i + (m_bank_id * c_mainwnd_rows * c_mainwnd_cols);
 
-        m_last_tick_x[i + (m_bank_id * c_mainwnd_rows * c_mainwnd_cols)] = 0;
+        if (a_area.intersects(sequenceRect(seqId)))
+            drawSequence(seqId);
+
+        m_last_tick_x[seqId] = 0;
+    }
+}
+
+QRect LiveFrame::sequenceRect(int a_seq)
+{
+    int w = (ui->frame->width() - 1 - c_mainwid_spacing * 8)
+            / c_mainwnd_cols;
+    int h = (ui->frame->height() - 1 - c_mainwid_spacing * 5)
+            / c_mainwnd_rows;
+
+    int i =  (a_seq / c_mainwnd_rows) % c_mainwnd_cols;
+    int j =  a_seq % c_mainwnd_rows;
+
+    int base_x = (ui->frame->x() + 1 + (w + c_mainwid_spacing) * i);
+    int base_y = (ui->frame->y() + 1 + (h + c_mainwid_spacing) * j);
+
+    //the playing outline has a 2px pen
+    return QRect(base_x - 1, base_y - 1, w + 4, h + 4);
+}
+
+void LiveFrame::refreshSequence(int seqId, int changes)
+{
+    //song triggers don't show here
+    if (changes == e_change_triggers)
+        return;
+
+    if (seqId >= m_bank_id * cSeqsInBank &&
+            seqId < (m_bank_id + 1) * cSeqsInBank)
+        update(sequenceRect(seqId));
+}
+
+void LiveFrame::refreshPerformance(int changes)
+{
+    if (!(changes & (e_change_tick | e_change_state)))
+        return;
+
+    //every active sequence draws a playhead
+    for (int i = 0; i < cSeqsInBank; i++)
+    {
+        int seqId = i + m_bank_id * cSeqsInBank;
+        if (mPerf->is_active(seqId))
+            update(sequenceRect(seqId));
     }
 }
 
@@ -358,7 +421,10 @@ void LiveFrame::setBank(int newBank)
     if (m_bank_id >= c_max_num_banks)
         m_bank_id = 0;
 
-    mPerf->set_offset(m_bank_id);
+    mPerf->post_command(e_command_offset, m_bank_id);
+
+    //decode it now if it was loaded lazily
+    mPerf->load_bank(m_bank_id);
 
     QString bankName = (*mPerf->getBankName(m_bank_id)).c_str();
     ui->txtBankName->setPlainText(bankName);
@@ -375,12 +441,12 @@ void LiveFrame::setBank(int newBank)
 
 void LiveFrame::redraw()
 {
-    drawAllSequences();
+    update();
 }
 
 void LiveFrame::updateBank(int newBank)
 {
-    mPerf->setBank(newBank);
+    mPerf->post_command(e_command_screen_set, newBank);
     setBank(newBank);
     mPerf->setModified(true);
 }
@@ -468,7 +534,7 @@ void LiveFrame::mouseReleaseEvent(QMouseEvent *event)
         {
             if (!mAddingNew)
             {
-                mPerf->sequence_playing_toggle(mCurrentSeq);
+                mPerf->post_command(e_command_toggle, mCurrentSeq);
             }
             mAddingNew = false;
             update();
@@ -702,16 +768,16 @@ void LiveFrame::keyPressEvent(QKeyEvent *event)
         setBank(m_bank_id + 1);
         break;
     case Qt::Key_Semicolon: //replace
-        mPerf->set_sequence_control_status(c_status_replace);
+        mPerf->post_command(e_command_status_on, c_status_replace);
         break;
     case Qt::Key_Slash: //queue
-        mPerf->set_sequence_control_status(c_status_queue);
+        mPerf->post_command(e_command_status_on, c_status_queue);
         break;
     case Qt::Key_Apostrophe || Qt::Key_NumberSign: //snapshot
-        mPerf->set_sequence_control_status(c_status_snapshot);
+        mPerf->post_command(e_command_status_on, c_status_snapshot);
         break;
     case Qt::Key_Period: //one-shot
-        mPerf->set_sequence_control_status(c_status_oneshot);
+        mPerf->post_command(e_command_status_on, c_status_oneshot);
         break;
     default: //sequence mute toggling
         quint32 keycode =  event->key();
@@ -730,16 +796,16 @@ void LiveFrame::keyReleaseEvent(QKeyEvent *event)
     switch (event->key())
     {
     case Qt::Key_Semicolon: //replace
-        mPerf->unset_sequence_control_status(c_status_replace);
+        mPerf->post_command(e_command_status_off, c_status_replace);
         break;
     case Qt::Key_Slash: //queue
-        mPerf->unset_sequence_control_status(c_status_queue);
+        mPerf->post_command(e_command_status_off, c_status_queue);
         break;
     case Qt::Key_Apostrophe || Qt::Key_NumberSign: //snapshot
-        mPerf->unset_sequence_control_status(c_status_snapshot);
+        mPerf->post_command(e_command_status_off, c_status_snapshot);
         break;
     case Qt::Key_Period: //one-shot
-        mPerf->unset_sequence_control_status(c_status_oneshot);
+        mPerf->post_command(e_command_status_off, c_status_oneshot);
         break;
     }
 }
@@ -751,7 +817,7 @@ void LiveFrame::sequence_key( int a_seq )
 
     if ( mPerf->is_active( a_seq ) ){
 
-        mPerf->sequence_playing_toggle( a_seq );
+        mPerf->post_command( e_command_toggle, a_seq );
     }
 }
 
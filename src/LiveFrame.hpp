@@ -6,9 +6,9 @@
 
 #include <QFrame>
 #include <QPainter>
+#include <QPixmap>
 #include <QDebug>
 #include <QMenu>
-#include <QTimer>
 #include <QMessageBox>
 
 namespace Ui {
@@ -30,6 +30,10 @@ public:
     //set bank of sequences displayed
     void setBank(int newBank);
 
+    //repaint whatever shows a change pushed by the performance
+    void refreshSequence(int seqId, int changes);
+    void refreshPerformance(int changes);
+
 protected:
     //override painting event to draw on the frame
     void paintEvent             (QPaintEvent *event);
@@ -48,8 +52,15 @@ private:
     //draw a single sequence thumbnail at index
     void drawSequence(int a_seq);
 
-    //draw all sequences
-    void drawAllSequences();
+    //render the note preview of a bank slot into its cache
+    void updatePreview(int a_slot, MidiSequence *a_seq);
+
+    //draw all sequences touching the area being painted
+    void drawAllSequences(const QRegion &a_area);
+
+    //area covered by a sequence thumbnail, including
+    //the outline drawn around playing sequences
+    QRect sequenceRect(int a_seq);
 
     //used to grab std::string bank name and
     //convert it to QString for display
@@ -68,21 +79,30 @@ private:
     MidiSequence    mSeqClipboard;
 
     QPainter    *mPainter;
-    QBrush      *mBrush;
-    QPen        *mPen;
+    QBrush       mBrush;
+    QPen         mPen;
     QMenu       *mPopup;
     QFont        mFont;
-    QTimer      *mRedrawTimer;
     QMessageBox *mMsgBoxNewSeqCheck;
 
     int     m_bank_id;
 
+    //transport state as of the current paint
+    TransportState mState;
+
     //thumbnail dimensions
     int     thumbW, thumbH;
 
     //internal seq MIDI preview dimensions
     int     previewW, previewH;
 
+    //note previews of the current bank, only re-rendered
+    //when their sequence has been edited
+    QPixmap         mPreviews[cSeqsInBank];
+    MidiSequence   *mPreviewSeqs[cSeqsInBank];
+    unsigned long   mPreviewGenerations[cSeqsInBank];
+    vector<MidiNoteInfo> mPreviewNotes;
+
     //beat pulsing
     int         lastMetro;
     int         alpha;
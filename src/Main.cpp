@@ -37,6 +37,8 @@ static struct
 {"jack_session_uuid", required_argument, 0, 'U'},
 {"manual_alsa_ports", 0, 0, 'm'},
 {"pass_sysex", 0, 0, 'P'},
+{"file_cache", 0, 0, 'c'},
+{"lazy_banks", 0, 0, 'l'},
 {"version", 0, 0, 'V'},
 {0, 0, 0, 0}
 
@@ -44,38 +46,12 @@ static struct
 
 static const char versiontext[] = PACKAGE " " VERSION "\n";
 
-/* some default config settings stored here */
+/* settings only the command line sets, the rest are in Globals.cpp */
 
-bool global_manual_alsa_ports = true;
-bool global_showmidi = false;
-bool global_priority = false;
 bool global_device_ignore = false;
 int global_device_ignore_num = 0;
-bool global_stats = false;
-bool global_pass_sysex = false;
-QString global_filename = "";
-QString last_used_dir ="/";
-QString recent_files[10];
 QString config_filename = ".kepler34rc";
 QString user_filename = ".kepler34usr";
-bool global_print_keys = false;
-interaction_method_e global_interactionmethod = e_seq24_interaction;
-
-bool global_with_jack_transport = false;
-bool global_with_jack_master = false;
-bool global_with_jack_master_cond = false;
-bool global_jack_start_mode = true;
-QString global_jack_session_uuid = "";
-QMap<thumb_colours_e, QColor> colourMap;
-
-user_midi_bus_definition   global_user_midi_bus_definitions[c_maxBuses];
-user_instrument_definition global_user_instrument_definitions[c_max_instruments];
-
-//font *p_font_renderer;
-
-#ifdef LASH_SUPPORT
-Lash *lash_driver = NULL;
-#endif
 
 #ifdef __WIN32__
 #   define HOME "HOMEPATH"
@@ -172,7 +148,7 @@ int main(int argc, char *argv[])
         /* getopt_long stores the option index here. */
         int option_index = 0;
 
-        c = getopt_long(argc, argv, "C:hi:jJmM:pPsSU:Vx:", long_options,
+        c = getopt_long(argc, argv, "cC:hi:jJlmM:pPsSU:Vx:", long_options,
                         &option_index);
 
         /* Detect the end of the options. */
@@ -202,6 +178,8 @@ int main(int argc, char *argv[])
             printf( "                          modes are available (0 = live mode)\n");
             printf( "                                              (1 = song mode) (default)\n" );
             printf( "   -S, --stats: show statistics\n" );
+            printf( "   -c, --file_cache: keep a .cache beside MIDI files to load them faster\n" );
+            printf( "   -l, --lazy_banks: decode the banks of a file as they are selected\n" );
             printf( "   -U, --jack_session_uuid <uuid>: set uuid for jack session\n" );
             printf( "\n\n\n" );
 
@@ -212,6 +190,14 @@ int main(int argc, char *argv[])
             global_stats = true;
             break;
 
+        case 'c':
+            global_file_cache = true;
+            break;
+
+        case 'l':
+            global_lazy_banks = true;
+            break;
+
         case 's':
             global_showmidi = true;
             break;
@@ -286,7 +272,11 @@ int main(int argc, char *argv[])
     MainWindow *w = new MainWindow(0,&p);
     w->show();
 
-    if (optind < argc)
+    bool recovered = w->startJournal(config_dir + "journal");
+
+    if (recovered && optind < argc)
+        printf("Recovered changes, not opening: %s\n", argv[optind]);
+    else if (optind < argc)
     {
         QFile m_qfile(argv[optind]);
         if (m_qfile.exists())
@@ -1,8 +1,6 @@
 #include "MainWindow.hpp"
 #include "ui_MainWindow.h"
 
-bool is_pattern_playing = false;
-
 MainWindow::MainWindow(QWidget *parent, MidiPerformance *a_p ) :
     QMainWindow(parent),
     ui(new Ui::MainWindow),
@@ -25,6 +23,9 @@ MainWindow::MainWindow(QWidget *parent, MidiPerformance *a_p ) :
     //    setWindowState(Qt::WindowMaximized);
 
     m_modified = false;
+    m_save_file = NULL;
+    m_journal = NULL;
+    m_setlist = new MidiSetlist(m_main_perf);
 
     // fill options for beats per measure combo box and set default
     for (int i = 0; i < 16; i++)
@@ -75,9 +76,10 @@ MainWindow::MainWindow(QWidget *parent, MidiPerformance *a_p ) :
 
     m_live_frame->setFocus();
 
-    //timer to refresh GUI elements every few ms
+    //timer to collect the changes pushed by the performance,
+    //nothing gets repainted unless something has changed
     m_timer = new QTimer(this);
-    m_timer->setInterval(50);
+    m_timer->setInterval(20);
     connect(m_timer,
             SIGNAL(timeout()),
             this,
@@ -100,6 +102,16 @@ MainWindow::MainWindow(QWidget *parent, MidiPerformance *a_p ) :
             this,
             SLOT(saveFileAs()));
 
+    connect(ui->actionSetlist,
+            SIGNAL(triggered(bool)),
+            this,
+            SLOT(showSetlistDialog()));
+
+    connect(ui->actionNext_Song,
+            SIGNAL(triggered(bool)),
+            this,
+            SLOT(nextSong()));
+
     connect(ui->actionImport_MIDI,
             SIGNAL(triggered(bool)),
             this,
@@ -186,11 +198,20 @@ MainWindow::MainWindow(QWidget *parent, MidiPerformance *a_p ) :
 
 MainWindow::~MainWindow()
 {
+    //don't leave a save half written
+    delete m_save_file;
+    delete m_journal;
+    delete m_setlist;
+
     delete ui;
 }
 
 void MainWindow::startPlaying()
 {
+    //the song can call on any bank
+    if (m_main_perf->get_playback_mode())
+        m_main_perf->load_all_banks();
+
     m_main_perf->start();
     m_main_perf->start_jack();
     is_pattern_playing = true;
@@ -234,7 +255,7 @@ void MainWindow::setSongPlayback(bool playSongData)
 
 void MainWindow::updateBpm(int newBpm)
 {
-    m_main_perf->set_bpm(newBpm);
+    m_main_perf->post_command(e_command_bpm, newBpm);
     m_modified = true;
 }
 
@@ -261,10 +282,23 @@ void MainWindow::openMidiFile(const QString &path)
 {
     bool result;
 
+    //whatever setlist was playing is over
+    m_setlist->cancel();
     m_main_perf->clear_all();
 
-    MidiFile f(path);
-    result = f.parse(m_main_perf, 0);
+    if (global_lazy_banks)
+    {
+        //the performance keeps it to decode the other banks from
+        MidiFile *f = new MidiFile(path);
+        result = f->parse_lazy(m_main_perf);
+        if (!result)
+            delete f;
+    }
+    else
+    {
+        MidiFile f(path);
+        result = f.parse(m_main_perf, 0);
+    }
     m_modified = !result;
 
     if (!result) {
@@ -283,6 +317,20 @@ void MainWindow::openMidiFile(const QString &path)
 
     updateWindowTitle();
 
+    reloadFrames();
+
+    //add to recent files list
+    m_dialog_prefs->addRecentFile(path);
+
+    //update recent menu
+    updateRecentFilesMenu();
+
+    if (m_journal != NULL)
+        m_journal->reset(m_main_perf, path);
+}
+
+void MainWindow::reloadFrames()
+{
     //reinitialize live frame
     ui->LiveTabLayout->removeWidget(m_live_frame);
     if (m_live_frame)
@@ -295,19 +343,56 @@ void MainWindow::openMidiFile(const QString &path)
             SLOT(loadEditor(int)));
     m_live_frame->show();
 
-    //add to recent files list
-    m_dialog_prefs->addRecentFile(path);
-
     m_live_frame->setFocus();
 
-    //update recent menu
-    updateRecentFilesMenu();
-
     m_live_frame->redraw();
     ui->spinBpm->setValue(m_main_perf->get_bpm());
     m_song_frame->updateSizes();
 }
 
+bool MainWindow::startJournal(const QString &path)
+{
+    bool recovered = false;
+    QString name;
+
+    m_journal = new MidiJournal(path);
+
+    //a journal with changes in it means we didn't get to quit
+    if (m_journal->can_recover(&name))
+    {
+        QString file = name.isEmpty() ? tr("an unsaved file") : name;
+
+        QMessageBox::StandardButton choice = QMessageBox::question(
+                    this,
+                    tr("Recover changes"),
+                    tr("Kepler34 didn't shut down cleanly.\n"
+                       "Recover the changes made to %1?").arg(file),
+                    QMessageBox::Yes | QMessageBox::No);
+
+        if (choice == QMessageBox::Yes)
+        {
+            if (m_journal->recover(m_main_perf))
+            {
+                recovered = true;
+                global_filename = name;
+                updateWindowTitle();
+                reloadFrames();
+                m_modified = true;
+            }
+            else
+            {
+                m_main_perf->clear_all();
+                m_msg_error->showMessage(tr("Error recovering changes."));
+                m_msg_error->exec();
+            }
+        }
+    }
+
+    m_journal->start(m_main_perf, global_filename);
+
+    return recovered;
+}
+
 void MainWindow::updateWindowTitle()
 {
     QString title;
@@ -333,7 +418,77 @@ void MainWindow::updateWindowTitle()
 
 void MainWindow::refresh()
 {
-    m_beat_ind->update();
+    ChangeQueue *changes = m_main_perf->get_change_queue();
+
+    if (m_save_file != NULL && m_save_file->write_done())
+        finishSave();
+
+    int id;
+    int kinds;
+    bool state_changed = false;
+
+    //the queue has already merged repeated changes to the same
+    //sequence, and the widgets only queue repaints of the areas
+    //showing them, so a busy burst still costs one paint each
+    while (changes->pop(&id, &kinds))
+    {
+        if (kinds & (e_change_state | e_change_active))
+            state_changed = true;
+
+        if (id == c_change_perf)
+        {
+            if (kinds & (e_change_tick | e_change_state))
+                m_beat_ind->update();
+
+            m_live_frame->refreshPerformance(kinds);
+            m_song_frame->refreshPerformance(kinds);
+            if (m_edit_frame)
+                m_edit_frame->refreshPerformance(kinds);
+        }
+        else
+        {
+            if (m_journal != NULL &&
+                    (kinds & (e_change_events | e_change_triggers |
+                              e_change_state | e_change_active)))
+                m_journal->mark(id);
+
+            m_live_frame->refreshSequence(id, kinds);
+            m_song_frame->refreshSequence(id, kinds);
+            if (m_edit_frame)
+                m_edit_frame->refreshSequence(id, kinds);
+        }
+    }
+
+    //the output thread republishes the transport state every cycle,
+    //while it's stopped it does so once it has been asked
+    if (state_changed && !m_main_perf->is_running())
+        m_main_perf->post_command(e_command_publish, 0);
+
+    //decode the banks of a lazily loaded file as they're needed,
+    //the song editor and song playback need all of them
+    if (ui->tabWidget->currentIndex() == 1 ||
+            m_main_perf->get_playback_mode())
+        m_main_perf->load_all_banks();
+    else
+        m_main_perf->load_banks();
+
+    //a pedal or the menu asked for the next song
+    if (m_main_perf->take_next_song_request())
+        nextSong();
+
+    if (m_setlist->poll())
+    {
+        global_filename = m_setlist->current();
+        updateWindowTitle();
+        reloadFrames();
+
+        m_modified = false;
+        if (m_journal != NULL)
+            m_journal->reset(m_main_perf, global_filename);
+    }
+
+    if (m_journal != NULL)
+        m_journal->flush(m_main_perf);
 }
 
 bool MainWindow::saveCheck()
@@ -344,7 +499,9 @@ bool MainWindow::saveCheck()
         int choice = m_msg_save_changes->exec();
         switch (choice) {
         case QMessageBox::Save:
-            if (saveFile())
+            //whatever comes next may discard the performance,
+            //so wait to hear the save worked
+            if (saveFile() && finishSave())
                 result = true;
             break;
         case QMessageBox::Discard:
@@ -365,6 +522,7 @@ void MainWindow::newFile()
 {
     if (saveCheck())
     {
+        m_setlist->cancel();
         m_main_perf->clear_all();
 
         //TODO ensure proper reset on load
@@ -372,6 +530,9 @@ void MainWindow::newFile()
         global_filename = "";
         updateWindowTitle();
         m_modified = false;
+
+        if (m_journal != NULL)
+            m_journal->reset(m_main_perf, global_filename);
     }
 }
 
@@ -379,30 +540,60 @@ bool MainWindow::saveFile()
 {
     bool result = false;
 
-    if (global_filename == "") {
-        saveFileAs();
-        return true;
-    }
+    //false if they cancel the dialog
+    if (global_filename == "")
+        return saveFileAs();
+
+    //one save at a time, so the last one to finish is the newest
+    if (m_save_file != NULL)
+        finishSave();
+
+    //the performance is taken here, the file gets written behind
+    //our back and refresh() reports how it went
+    m_save_file = new MidiFile(global_filename);
+    m_save_name = global_filename;
+    result = m_save_file->write_async(m_main_perf);
+
+    if (!result)
+        finishSave();
+    else
+        m_modified = false;
+
+    return result;
+
+}
+
+bool MainWindow::finishSave()
+{
+    //nothing was started, so nothing could go wrong
+    if (m_save_file == NULL)
+        return !m_modified;
+
+    bool result = m_save_file->wait_write();
 
-    MidiFile file(global_filename);
-    result = file.write(m_main_perf);
+    delete m_save_file;
+    m_save_file = NULL;
 
     if (!result) {
+        m_modified = true;
         m_msg_error->showMessage("Error writing file.");
         m_msg_error->exec();
     } else {
         /* add to recent files list */
-        m_dialog_prefs->addRecentFile(global_filename);
+        m_dialog_prefs->addRecentFile(m_save_name);
 
         /* update recent menu */
         updateRecentFilesMenu();
+
+        /* the journal only needs what came after */
+        if (m_journal != NULL)
+            m_journal->reset(m_main_perf, m_save_name);
     }
-    m_modified = !result;
-    return result;
 
+    return result;
 }
 
-void MainWindow::saveFileAs()
+bool MainWindow::saveFileAs()
 {
     QString file;
 
@@ -428,8 +619,10 @@ void MainWindow::saveFileAs()
 
         global_filename = file;
         updateWindowTitle();
-        saveFile();
+        return saveFile();
     }
+
+    return false;
 }
 
 void MainWindow::showImportDialog()
@@ -463,6 +656,37 @@ void MainWindow::showImportDialog()
     }
 }
 
+void MainWindow::showSetlistDialog()
+{
+    if (!saveCheck())
+        return;
+
+    QStringList files = QFileDialog::getOpenFileNames(
+                this,
+                tr("Open setlist, in the order to play"),
+                last_used_dir,
+                tr("MIDI files (*.midi *.mid);;"
+                   "All files (*)"));
+
+    if (files.isEmpty())
+        return;
+
+    //the first song is opened as usual, the rest preload behind it
+    openMidiFile(files[0]);
+    if (global_filename == files[0])
+        m_setlist->set_files(files);
+}
+
+void MainWindow::nextSong()
+{
+    //swap on the bar lines the song editor shows
+    long bar = c_ppqn * 4 * m_song_frame->getBeatsPerMeasure() /
+            m_song_frame->getBeatWidth();
+
+    if (!m_setlist->queue_next(bar))
+        qDebug() << "No setlist song ready to swap in" << endl;
+}
+
 void MainWindow::showAboutDialog()
 {
     mDialogAbout->show();
@@ -700,8 +924,15 @@ void MainWindow::updateRecentFilesMenu()
 
 void MainWindow::quit()
 {
-    if (saveCheck())
+    //a save still being written has to land before we go
+    if (saveCheck() && (m_save_file == NULL || finishSave()))
+    {
+        //nothing left to recover
+        if (m_journal != NULL)
+            m_journal->discard();
+
         QCoreApplication::exit();
+    }
 }
 
 void MainWindow::load_recent_1()
@@ -15,6 +15,8 @@
 #include "PreferencesDialog.hpp"
 #include "MidiPerformance.hpp"
 #include "MidiFile.hpp"
+#include "MidiJournal.hpp"
+#include "MidiSetlist.hpp"
 #include "BeatIndicator.hpp"
 #include "KeplerStyle.hpp"
 #include "AboutDialog.hpp"
@@ -42,6 +44,10 @@ public:
     //open the file at the given path
     void openMidiFile(const QString& path);
 
+    //journal changes at the given path, first offering to recover
+    //what an earlier session left there. true if it was recovered
+    bool startJournal(const QString& path);
+
 protected:
     //override keyboard events for interaction
     void keyPressEvent          (QKeyEvent * event);
@@ -52,6 +58,12 @@ private:
     //if modified, ask the user whether to save changes
     bool saveCheck();
 
+    //wait for the save in progress and report how it went
+    bool finishSave();
+
+    //rebuild the frames after the performance was replaced
+    void reloadFrames();
+
     //update window title from the global filename
     void updateWindowTitle();
 
@@ -79,6 +91,16 @@ private:
     //TODO fully move this into main performance
     bool                 m_modified;
 
+    //the save being written in the background, if any
+    MidiFile            *m_save_file;
+    QString              m_save_name;
+
+    //changes since the last save, in case we crash
+    MidiJournal         *m_journal;
+
+    //songs to play back to back
+    MidiSetlist         *m_setlist;
+
 private slots:
     void startPlaying();
     void stopPlaying();
@@ -91,9 +113,11 @@ private slots:
     void updateBeatLength(int blIndex);
     void newFile();
     bool saveFile();
-    void saveFileAs();
+    bool saveFileAs();
     void quit();
     void showImportDialog(); //import MIDI data from current bank onwards
+    void showSetlistDialog();
+    void nextSong(); //swap in the next setlist song at the next bar
     void showOpenFileDialog();
     void showAboutDialog();
     void tabWidgetClicked(int newIndex);
@@ -108,7 +132,8 @@ private slots:
     void load_recent_9();
     void load_recent_10();
 
-    //redraw certain GUI elements
+    //pass the changes pushed by the performance
+    //on to the widgets showing them
     void refresh();
 
     //set the editor to a specific seq
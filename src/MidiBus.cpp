@@ -2,7 +2,9 @@
 
 #ifdef HAVE_LIBASOUND
 #    include <sys/poll.h>
+#    include <sys/eventfd.h>
 #    include <alsa/seqmid.h>
+#    include <unistd.h>
 #endif
 
 #ifdef LASH_SUPPORT
@@ -362,6 +364,70 @@ MidiBus::play( MidiEvent *a_e24, unsigned char a_channel )
 }
 
 
+bool
+MidiBus::thru( MidiEvent *a_e24, unsigned char a_channel )
+{
+    bool sent = false;
+
+#ifdef HAVE_LIBASOUND
+
+    snd_seq_event_t ev;
+
+    unsigned char channel = a_channel & 0x0F;
+    unsigned char data[2];
+    a_e24->get_data( &data[0], &data[1] );
+
+    /* build the event by hand, no parser to allocate */
+    snd_seq_ev_clear( &ev );
+
+    switch ( a_e24->get_status() ){
+
+        case EVENT_NOTE_OFF:
+            snd_seq_ev_set_noteoff( &ev, channel, data[0], data[1] );
+            break;
+
+        case EVENT_NOTE_ON:
+            snd_seq_ev_set_noteon( &ev, channel, data[0], data[1] );
+            break;
+
+        case EVENT_AFTERTOUCH:
+            snd_seq_ev_set_keypress( &ev, channel, data[0], data[1] );
+            break;
+
+        case EVENT_CONTROL_CHANGE:
+            snd_seq_ev_set_controller( &ev, channel, data[0], data[1] );
+            break;
+
+        case EVENT_PROGRAM_CHANGE:
+            snd_seq_ev_set_pgmchange( &ev, channel, data[0] );
+            break;
+
+        case EVENT_CHANNEL_PRESSURE:
+            snd_seq_ev_set_chanpress( &ev, channel, data[0] );
+            break;
+
+        case EVENT_PITCH_WHEEL:
+            snd_seq_ev_set_pitchbend( &ev, channel,
+                                      ((data[1] << 7) | data[0]) - 8192 );
+            break;
+
+        default:
+            return false;
+    }
+
+    snd_seq_ev_set_source( &ev, m_local_addr_port );
+    snd_seq_ev_set_subs( &ev );
+    snd_seq_ev_set_direct( &ev );
+
+    /* a fixed size event goes straight to the sequencer without
+       touching the output buffer play() fills, so no lock */
+    sent = snd_seq_event_output_direct( m_seq, &ev ) >= 0;
+#endif
+
+    return sent;
+}
+
+
 inline long
 min ( long a, long b ){
     if ( a < b )
@@ -850,6 +916,10 @@ MasterMidiBus::MasterMidiBus()
         m_init_input[i] = false;
     }
 
+    m_num_poll_descriptors = 0;
+    m_poll_descriptors = NULL;
+    m_wakeup_fd = -1;
+
 #ifdef HAVE_LIBASOUND
     /* open the sequencer client */
     ret = snd_seq_open(&m_alsa_seq, "default",  SND_SEQ_OPEN_DUPLEX, 0);
@@ -864,6 +934,15 @@ MasterMidiBus::MasterMidiBus()
 
     /* set up our clients queue */
     m_queue = snd_seq_alloc_queue( m_alsa_seq );
+
+    /* one parser for all input. every decoded event must carry its
+       own status byte, so running status is turned off */
+    snd_midi_event_new( c_midibus_sysex_chunk, &m_midi_parser );
+    snd_midi_event_no_status( m_midi_parser, 1 );
+
+    m_wakeup_fd = eventfd( 0, EFD_NONBLOCK );
+    if ( m_wakeup_fd < 0 )
+        printf( "eventfd() error, input wakeups fall back to polling\n" );
 #ifdef LASH_SUPPORT
 	/* notify lash of our client ID so it can restore connections */
 	lash_driver->set_alsa_client_id(snd_seq_client_id(m_alsa_seq));
@@ -991,19 +1070,7 @@ MasterMidiBus::init( )
     set_ppqn( c_ppqn );
 
     /* midi input */
-    /* poll descriptors */
-
-    /* get number of file descriptors */
-    m_num_poll_descriptors = snd_seq_poll_descriptors_count(m_alsa_seq, POLLIN);
-
-    /* allocate into */
-    m_poll_descriptors = new pollfd[m_num_poll_descriptors];
-
-    /* get descriptors */
-    snd_seq_poll_descriptors(m_alsa_seq,
-            m_poll_descriptors,
-            m_num_poll_descriptors,
-            POLLIN);
+    rebuild_poll_descriptors();
 
     set_sequence_input( false, NULL );
 
@@ -1087,6 +1154,12 @@ MasterMidiBus::~MasterMidiBus()
     snd_seq_stop_queue( m_alsa_seq, m_queue, &ev );
     snd_seq_free_queue( m_alsa_seq, m_queue );
 
+    snd_midi_event_free( m_midi_parser );
+
+    if ( m_wakeup_fd >= 0 )
+        close( m_wakeup_fd );
+    delete[] m_poll_descriptors;
+
     /* close client */
     snd_seq_close( m_alsa_seq );
 #endif
@@ -1119,6 +1192,16 @@ MasterMidiBus::play( unsigned char a_bus, MidiEvent *a_e24, unsigned char a_chan
 }
 
 
+bool
+MasterMidiBus::thru( unsigned char a_bus, MidiEvent *a_e24, unsigned char a_channel )
+{
+	if ( a_bus < m_num_out_buses && m_buses_out_active[a_bus] )
+		return m_buses_out[a_bus]->thru( a_e24, a_channel );
+
+	return false;
+}
+
+
 void
 MasterMidiBus::set_clock( unsigned char a_bus, clock_e a_clock_type )
 {
@@ -1254,29 +1337,85 @@ MasterMidiBus::get_num_in_buses()
     return m_num_in_buses;
 }
 
+void
+MasterMidiBus::rebuild_poll_descriptors( )
+{
+#ifdef HAVE_LIBASOUND
+    /* only called by the input thread, or before it runs,
+       so the old set can't be in use by poll() */
+    delete[] m_poll_descriptors;
+
+    /* get number of file descriptors */
+    int alsa_descriptors = snd_seq_poll_descriptors_count(m_alsa_seq, POLLIN);
+
+    /* allocate into, with room for the wakeup */
+    m_poll_descriptors = new pollfd[alsa_descriptors + 1];
+
+    /* get descriptors */
+    snd_seq_poll_descriptors(m_alsa_seq,
+            m_poll_descriptors,
+            alsa_descriptors,
+            POLLIN);
+
+    m_num_poll_descriptors = alsa_descriptors;
+
+    if ( m_wakeup_fd >= 0 ){
+        m_poll_descriptors[alsa_descriptors].fd = m_wakeup_fd;
+        m_poll_descriptors[alsa_descriptors].events = POLLIN;
+        m_poll_descriptors[alsa_descriptors].revents = 0;
+        m_num_poll_descriptors++;
+    }
+#endif
+}
+
 int
 MasterMidiBus::poll_for_midi( )
 {
     int ret = 0;
 #ifdef HAVE_LIBASOUND
+    /* without the eventfd we still have to look up now and then */
+    int timeout = ( m_wakeup_fd >= 0 ) ? -1 : 1000;
+
     ret = poll( m_poll_descriptors,
 		 m_num_poll_descriptors,
-		 1000);
+		 timeout);
+
+    if ( ret > 0 && m_wakeup_fd >= 0 ){
+
+        pollfd *wakeup = &m_poll_descriptors[m_num_poll_descriptors - 1];
+
+        if ( wakeup->revents & POLLIN ){
+
+            /* reset the counter, wakeups while we were busy
+               have all been served by this one */
+            eventfd_t value;
+            eventfd_read( m_wakeup_fd, &value );
+            ret--;
+        }
+    }
 #endif
     return ret;
 }
 
+void
+MasterMidiBus::wake_input( )
+{
+#ifdef HAVE_LIBASOUND
+    if ( m_wakeup_fd >= 0 )
+        eventfd_write( m_wakeup_fd, 1 );
+#endif
+}
+
 bool
 MasterMidiBus::is_more_input( ){
 
-    lock();
-
     int size=0;
 
+    /* only looks at the input buffer, which the output side
+       of the handle never touches, so no lock */
 #ifdef HAVE_LIBASOUND
     size = snd_seq_event_input_pending(m_alsa_seq, 0);
 #endif
-    unlock();
 
     return ( size > 0 );
 }
@@ -1389,21 +1528,7 @@ MasterMidiBus::port_start( int a_client, int a_port )
 
     /* end loop for clients */
 
-
-    /* midi input */
-    /* poll descriptors */
-
-    /* get number of file descriptors */
-    m_num_poll_descriptors = snd_seq_poll_descriptors_count(m_alsa_seq, POLLIN);
-
-    /* allocate into */
-    m_poll_descriptors = new pollfd[m_num_poll_descriptors];
-
-    /* get descriptors */
-    snd_seq_poll_descriptors(m_alsa_seq,
-			     m_poll_descriptors,
-			     m_num_poll_descriptors,
-			     POLLIN);
+    rebuild_poll_descriptors();
 #endif
     unlock();
 }
@@ -1430,123 +1555,84 @@ MasterMidiBus::port_exit( int a_client, int a_port )
 			m_buses_in_active[i] = false;
 		}
 	}
+
+	rebuild_poll_descriptors();
 #endif
 	unlock();
 }
 
 
-bool
-MasterMidiBus::get_midi_event( MidiEvent *a_in )
+int
+MasterMidiBus::get_midi_events( MidiEvent *a_events, int a_max )
 {
-    lock();
+    int count = 0;
+
 #ifdef HAVE_LIBASOUND
     snd_seq_event_t *ev;
 
-    bool sysex = false;
-    bool ret = false;
-
     /* temp for midi data */
-    unsigned char buffer[0x1000];
+    unsigned char buffer[c_midibus_sysex_chunk];
 
-    snd_seq_event_input(m_alsa_seq, &ev);
+    /* alsa buffers input and output of the handle separately, the
+       master lock guarding the output side is only taken below for
+       port changes, which rebuild the bus tables */
+    do {
 
-    if (! global_manual_alsa_ports )
-    {
-        switch(ev->type) {
+        if ( snd_seq_event_input(m_alsa_seq, &ev) < 0 )
+            break;
 
-            case SND_SEQ_EVENT_PORT_START:
-                {
-                    //printf("SND_SEQ_EVENT_PORT_START:    addr[%d:%d]\n",
-                    //	   ev->data.addr.client, ev->data.addr.port );
+        if (! global_manual_alsa_ports )
+        {
+            bool port_event = true;
+
+            switch(ev->type) {
+
+                case SND_SEQ_EVENT_PORT_START:
                     port_start( ev->data.addr.client, ev->data.addr.port );
-                    ret = true;
                     break;
-                }
 
-            case SND_SEQ_EVENT_PORT_EXIT:
-                {
-                    //printf("SND_SEQ_EVENT_PORT_EXIT:     addr[%d:%d]\n",
-                    //	   ev->data.addr.client, ev->data.addr.port );
+                case SND_SEQ_EVENT_PORT_EXIT:
                     port_exit( ev->data.addr.client, ev->data.addr.port );
-                    ret = true;
                     break;
-                }
 
-            case SND_SEQ_EVENT_PORT_CHANGE:
-                {
-                    //printf("SND_SEQ_EVENT_PORT_CHANGE:   addr[%d:%d]\n",
-                    //	   ev->data.addr.client,
-                    //	   ev->data.addr.port );
-                    ret = true;
+                case SND_SEQ_EVENT_PORT_CHANGE:
                     break;
-                }
 
-            default:
-                break;
+                default:
+                    port_event = false;
+                    break;
+            }
 
+            if ( port_event )
+                continue;
         }
-    }
 
-    if (ret) {
-        unlock();
-        return false;
-    }
+        snd_midi_event_reset_decode( m_midi_parser );
 
-    /* alsa midi parser */
-    snd_midi_event_t *midi_ev;
-    snd_midi_event_new(sizeof(buffer), &midi_ev);
+        long bytes = snd_midi_event_decode(m_midi_parser, buffer, sizeof(buffer), ev);
 
-    long bytes = snd_midi_event_decode(midi_ev, buffer, sizeof(buffer), ev);
+        if (bytes <= 0)
+            continue;
 
-    if (bytes <= 0) {
-        unlock();
-        return false;
-    }
-    a_in->set_timestamp( ev->time.tick );
-    a_in->set_status( buffer[0] );
-    a_in->set_size( bytes );
-
-    /* we will only get EVENT_SYSEX on the first
-       packet of midi data, the rest we have
-       to poll for */
-    //if ( buffer[0] == EVENT_SYSEX ){
-    if (0) {
-
-        /* set up for sysex if needed */
-        a_in->start_sysex( );
-        sysex = a_in->append_sysex( buffer, bytes );
-    }
-    else {
-        a_in->set_data( buffer[1], buffer[2] );
+        MidiEvent *in = &a_events[count++];
+
+        /* sysex stays unhandled here, as it always was */
+        in->set_timestamp( ev->time.tick );
+        in->set_status( buffer[0] );
+        in->set_size( bytes );
+        in->set_data( buffer[1], buffer[2] );
 
         // some keyboards send on's with vel 0 for off
-        if ( a_in->get_status() == EVENT_NOTE_ON &&
-             a_in->get_note_velocity() == 0x00 ){
-            a_in->set_status( EVENT_NOTE_OFF );
+        if ( in->get_status() == EVENT_NOTE_ON &&
+             in->get_note_velocity() == 0x00 ){
+            in->set_status( EVENT_NOTE_OFF );
         }
 
-        sysex = false;
-    }
-
-    /* sysex messages might be more than one message */
-    while (sysex) {
-
-        snd_seq_event_input(m_alsa_seq, &ev);
-
-        bytes = snd_midi_event_decode(midi_ev, buffer, sizeof(buffer), ev);
-
-        if (bytes > 0)
-            sysex = a_in->append_sysex( buffer, bytes );
-        else
-            sysex = false;
-    }
-
-    snd_midi_event_free( midi_ev );
-
+    } while ( count < a_max &&
+              snd_seq_event_input_pending(m_alsa_seq, 0) > 0 );
 #endif
 
-    unlock();
-    return true;
+    return count;
 }
 
 void
@@ -1554,6 +1640,11 @@ MasterMidiBus::set_sequence_input( bool a_state, MidiSequence *a_seq )
 {
     lock();
 
+    /* the input thread pushes into the ring, have it ready
+       before it can see the sequence */
+    if ( a_state && a_seq != NULL )
+        a_seq->prepare_input();
+
     m_seq = a_seq;
     m_dumping_input = a_state;
 
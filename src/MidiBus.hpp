@@ -27,6 +27,9 @@ const int c_midibus_output_size = 0x100000;
 const int c_midibus_input_size =  0x100000;
 const int c_midibus_sysex_chunk = 0x100;
 
+/* most input events converted per get_midi_events() call */
+const int c_midibus_input_batch = 64;
+
 enum clock_e
 {
     e_clock_off,
@@ -116,6 +119,10 @@ class MidiBus
 
     /* puts an event in the queue */
     void play( MidiEvent *a_e24, unsigned char a_channel );
+
+    /* sends a channel message out now, bypassing the output buffer
+       so nothing waits for a flush. false if it wasn't sent */
+    bool thru( MidiEvent *a_e24, unsigned char a_channel );
     void sysex( MidiEvent *a_e24 );
 
 
@@ -179,9 +186,20 @@ class MasterMidiBus
     int m_ppqn;
     int m_bpm;
 
+    /* the alsa descriptors followed by m_wakeup_fd */
     int  m_num_poll_descriptors;
     struct pollfd *m_poll_descriptors;
 
+    /* eventfd that interrupts poll_for_midi() */
+    int m_wakeup_fd;
+
+    void rebuild_poll_descriptors();
+
+#if HAVE_LIBASOUND
+    /* decodes input events, only touched by the input thread */
+    snd_midi_event_t *m_midi_parser;
+#endif
+
     /* for dumping midi input to sequence for recording */
     bool m_dumping_input;
     MidiSequence *m_seq;
@@ -230,9 +248,18 @@ class MasterMidiBus
     void continue_from( long a_tick );
     void init_clock( long a_tick );
 
+    /* blocks until input arrives or wake_input() is called,
+       returns the number of alsa descriptors ready */
     int poll_for_midi( );
+
+    /* any thread, makes the input thread return from its poll */
+    void wake_input( );
+
     bool is_more_input( );
-    bool get_midi_event( MidiEvent *a_in );
+
+    /* input thread only. converts up to a_max pending events into
+       a_events and returns how many, without the master lock */
+    int get_midi_events( MidiEvent *a_events, int a_max );
     void set_sequence_input( bool a_state, MidiSequence *a_seq );
 
     bool is_dumping( ) { return m_dumping_input; }
@@ -244,6 +271,10 @@ class MasterMidiBus
 
     void play( unsigned char a_bus, MidiEvent *a_e24, unsigned char a_channel );
 
+    /* input thread only, no lock: the input thread is the only one
+       changing the bus tables, from port_start() */
+    bool thru( unsigned char a_bus, MidiEvent *a_e24, unsigned char a_channel );
+
     void set_clock( unsigned char a_bus, clock_e a_clock_type );
     clock_e get_clock( unsigned char a_bus );
 
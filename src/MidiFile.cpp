@@ -1,19 +1,201 @@
 #include <iostream>
 #include "MidiFile.hpp"
+#include "MidiFileCache.hpp"
+
+#include <pthread.h>
+
+#ifndef __WIN32__
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <sys/uio.h>
+#   include <errno.h>
+#   include <limits.h>
+#   include <unistd.h>
+#endif
+
+#ifndef IOV_MAX
+#   define IOV_MAX 1024
+#endif
 
 MidiFile::MidiFile(const QString &a_name) :
-    m_pos(0),
-    m_name(a_name)
+    m_name(a_name),
+    m_data(NULL),
+    m_size(0),
+    m_map(NULL),
+    m_ppqn(c_ppqn),
+    m_next_track(0),
+    m_workers(0),
+    m_bus(NULL),
+    m_split_channels(false),
+    m_bpm(0),
+    m_prefetching(false),
+    m_prefetch_done(false),
+    m_header_size(0),
+    m_writing(false),
+    m_write_done(false),
+    m_write_ok(false)
 {
+    for (int i = 0; i < c_max_sequence; i++)
+        m_lazy[i] = -1;
 }
 
 MidiFile::~MidiFile ()
 {
+    if (m_writing)
+        wait_write();
+
+    /* nobody wants what is being prefetched any more */
+    if (m_prefetching)
+    {
+        pthread_join(m_prefetch_thread, NULL);
+
+        for (unsigned int d = 0; d < m_decode.size(); d++)
+            delete m_tracks[m_decode[d]].m_seq;
+    }
+
+    /* taken but never written */
+    for (unsigned int t = 0; t < m_tracks.size(); t++)
+        delete m_tracks[t].m_copy;
+
+    close_data();
+}
+
+bool
+MidiFile::open_data ()
+{
+#ifndef __WIN32__
+    int fd = open(m_name.toUtf8().constData(), O_RDONLY);
+
+    if (fd < 0) {
+        fprintf(stderr, "Error opening MIDI file\n");
+        return false;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        fprintf(stderr, "Error opening MIDI file\n");
+        close(fd);
+        return false;
+    }
+
+    m_size = info.st_size;
+
+    /* an empty file fails the header check below, nothing to map */
+    if (m_size > 0) {
+
+        void *map = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "Error mapping MIDI file\n");
+            close(fd);
+            return false;
+        }
+
+        /* all of it gets read, by several threads at once */
+        madvise(map, m_size, MADV_WILLNEED);
+
+        m_map = map;
+        m_data = (const unsigned char *) map;
+    }
+
+    close(fd);
+#else
+    /* open binary file */
+    ifstream file(m_name.toUtf8().constData(), ios::in | ios::binary | ios::ate);
+
+    if (!file.is_open ()) {
+        fprintf(stderr, "Error opening MIDI file\n");
+        return false;
+    }
+
+    m_size = file.tellg ();
+
+    /* run to start */
+    file.seekg (0, ios::beg);
+
+    /* alloc data */
+    try
+    {
+        m_d.resize(m_size);
+    }
+    catch(std::bad_alloc& ex)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return false;
+    }
+    if (m_size > 0) {
+        file.read ((char *) &m_d[0], m_size);
+        m_data = &m_d[0];
+    }
+    file.close ();
+#endif
+
+    m_cursor.set(m_data, m_size);
+
+    return true;
+}
+
+void
+MidiFile::close_data ()
+{
+#ifndef __WIN32__
+    if (m_map != NULL)
+        munmap(m_map, m_size);
+#endif
+    m_map = NULL;
+    m_data = NULL;
+    m_size = 0;
+    m_d.clear();
 }
 
 unsigned long
-MidiFile::read_long ()
+hash_bytes (const unsigned char *a_data, unsigned long a_size)
 {
+    unsigned long h = 2166136261UL;
+
+    for (unsigned long i = 0; i < a_size; i++)
+    {
+        h ^= a_data[i];
+        h = (h * 16777619UL) & 0xFFFFFFFFUL;
+    }
+
+    return h;
+}
+
+
+MidiFileCursor::MidiFileCursor () :
+    m_data(NULL),
+    m_size(0),
+    m_pos(0),
+    m_overrun(false)
+{
+}
+
+void
+MidiFileCursor::set (const unsigned char *a_data, unsigned long a_size)
+{
+    m_data = a_data;
+    m_size = a_size;
+    m_pos = 0;
+    m_overrun = false;
+}
+
+unsigned long
+MidiFileCursor::read_long ()
+{
+    /* fast path, the whole value is there */
+    if (remaining() >= 4) {
+
+        const unsigned char *p = m_data + m_pos;
+        m_pos += 4;
+
+        return ((unsigned long) p[0] << 24) |
+               ((unsigned long) p[1] << 16) |
+               ((unsigned long) p[2] << 8) |
+               (unsigned long) p[3];
+    }
+
     unsigned long ret = 0;
 
     ret += (read_byte() << 24);
@@ -25,7 +207,7 @@ MidiFile::read_long ()
 }
 
 unsigned short
-MidiFile::read_short ()
+MidiFileCursor::read_short ()
 {
     unsigned short ret = 0;
 
@@ -37,395 +219,1100 @@ MidiFile::read_short ()
 }
 
 unsigned char
-MidiFile::read_byte ()
+MidiFileCursor::read_byte ()
+{
+    if (m_pos >= m_size) {
+        m_overrun = true;
+        return 0;
+    }
+
+    return m_data[m_pos++];
+}
+
+unsigned char
+MidiFileCursor::peek_byte ()
+{
+    if (m_pos >= m_size) {
+        m_overrun = true;
+        return 0;
+    }
+
+    return m_data[m_pos];
+}
+
+unsigned long
+MidiFileCursor::read_var ()
 {
-    return m_d[m_pos++];
+    unsigned long ret = 0;
+    unsigned char c;
+
+    /* while bit #7 is set, a truncated file reads 0 and ends it */
+    while (((c = read_byte()) & 0x80) != 0x00)
+    {
+        /* shift ret 7 bits */
+        ret <<= 7;
+        /* add bits 0-6 */
+        ret += (c & 0x7F);
+    }
+
+    /* bit was clear */
+    ret <<= 7;
+    ret += (c & 0x7F);
+
+    return ret;
+}
+
+void
+MidiFileCursor::skip (unsigned long a_len)
+{
+    if (a_len > remaining()) {
+        m_pos = m_size;
+        m_overrun = true;
+        return;
+    }
+
+    m_pos += a_len;
 }
 
-unsigned long
-MidiFile::read_var ()
-{
-    unsigned long ret = 0;
-    unsigned char c;
 
-    /* while bit #7 is set */
-    while (((c = read_byte()) & 0x80) != 0x00)
+bool
+MidiFile::decode_track (MidiFileTrack *a_track)
+{
+    MidiFileCursor *cursor = &a_track->m_cursor;
+    MidiSequence *seq = a_track->m_seq;
+    MidiEvent e;
+
+    /* done for each track */
+    bool done = false;
+    a_track->m_perf = 0;
+
+    /* events */
+    unsigned char status = 0, type, data[2], laststatus;
+    long len;
+    unsigned long proprietary = 0;
+
+    /* time */
+    unsigned long Delta;
+    unsigned long RunningTime;
+    unsigned long CurrentTime;
+
+    /* track name from file */
+    char TrackName[256];
+
+    /* used in small loops */
+    int i;
+
+    /* reset time */
+    RunningTime = 0;
+
+    /* this gets each event in the Trk */
+    while (!done)
+    {
+        /* the chunk ended before the track did */
+        if (cursor->m_overrun)
+        {
+            fprintf(stderr, "Truncated MIDI track\n");
+            return false;
+        }
+
+        /* get time delta */
+        Delta = cursor->read_var ();
+
+        /* get status */
+        laststatus = status;
+        status = cursor->peek_byte();
+
+        /* is it a status bit ? */
+        if ((status & 0x80) == 0x00)
+        {
+            /* no, its a running status */
+            status = laststatus;
+        }
+        else
+        {
+            /* its a status, increment */
+            cursor->m_pos++;
+        }
+
+        /* set the members in event */
+        e.set_status (status);
+
+        RunningTime += Delta;
+        /* current time is ppqn according to the file,
+           we have to adjust it to our own ppqn.
+           PPQN / ppqn gives us the ratio */
+        CurrentTime = (RunningTime * c_ppqn) / m_ppqn;
+
+        //printf( "D[%6ld] [%6ld] %02X\n", Delta, CurrentTime, status);
+        e.set_timestamp (CurrentTime);
+
+        /* switch on the channelless status */
+        switch (status & 0xF0)
+        {
+        /* case for those with 2 data bytes */
+        case EVENT_NOTE_OFF:
+        case EVENT_NOTE_ON:
+        case EVENT_AFTERTOUCH:
+        case EVENT_CONTROL_CHANGE:
+        case EVENT_PITCH_WHEEL:
+
+            data[0] = cursor->read_byte();
+            data[1] = cursor->read_byte();
+
+            // some files have vel=0 as note off
+            if ((status & 0xF0) == EVENT_NOTE_ON && data[1] == 0)
+            {
+                e.set_status (EVENT_NOTE_OFF);
+            }
+
+            //printf( "%02X %02X\n", data[0], data[1] );
+
+            /* set data and add */
+            e.set_data (data[0], data[1]);
+            add_event (a_track, &e, status & 0x0F);
+            break;
+
+            /* one data item */
+        case EVENT_PROGRAM_CHANGE:
+        case EVENT_CHANNEL_PRESSURE:
+
+            data[0] = cursor->read_byte();
+            //printf( "%02X\n", data[0] );
+
+            /* set data and add */
+            e.set_data (data[0]);
+            add_event (a_track, &e, status & 0x0F);
+            break;
+
+            /* meta midi events ---  this should be FF !!!!!  */
+        case 0xF0:
+
+            if (status == 0xFF)
+            {
+                /* get meta type */
+                type = cursor->read_byte();
+                len = cursor->read_var ();
+
+                //printf( "%02X %08X ", type, (int) len );
+
+                switch (type)
+                {
+                /* proprietary */
+                case 0x7f:
+
+                    /* FF 7F len data  */
+                    if (len > 4)
+                    {
+                        proprietary = cursor->read_long ();
+                        len -= 4;
+                    }
+
+                    if (proprietary == c_midibus)
+                    {
+                        seq->set_midi_bus (cursor->read_byte());
+                        len--;
+                    }
+
+                    else if (proprietary == c_midich)
+                    {
+                        seq->set_midi_channel (cursor->read_byte());
+                        len--;
+                    }
+
+                    else if (proprietary == c_timesig)
+                    {
+                        seq->setBeatsPerMeasure (cursor->read_byte());
+                        seq->setBeatWidth (cursor->read_byte());
+                        len -= 2;
+                    }
+
+                    else if (proprietary == c_triggers)
+                    {
+                        int num_triggers = len / 4;
+
+                        for (int i = 0; i < num_triggers; i += 2)
+                        {
+                            unsigned long on = cursor->read_long ();
+                            unsigned long length = (cursor->read_long () - on);
+                            len -= 8;
+                            seq->add_trigger(on, length, 0, false);
+                        }
+                    }
+
+                    else if (proprietary == c_triggers_new)
+                    {
+                        int num_triggers = len / 12;
+
+                        //printf( "num_triggers[%d]\n", num_triggers );
+                        for (int i = 0; i < num_triggers; i++)
+                        {
+                            unsigned long on = cursor->read_long ();
+                            unsigned long off = cursor->read_long ();
+                            unsigned long length = off - on + 1;
+                            unsigned long offset = cursor->read_long ();
+
+                            //printf( "< start[%d] end[%d] offset[%d]\n",
+                            //        on, off, offset );
+
+                            len -= 12;
+                            seq->add_trigger (on, length, offset, false);
+                        }
+                    }
+
+                    /* eat the rest */
+                    cursor->skip (len);
+                    break;
+
+                    /* Trk Done */
+                case 0x2f:
+
+                    // If delta is 0, then another event happened at the same time
+                    // as the track end.  the sequence class will discard the last
+                    // note.  This is a fix for that.   Native Seq24 file will always
+                    // have a Delta >= 1
+                    if ( Delta == 0 ){
+                        CurrentTime += 1;
+                    }
+
+                    seq->sort_events ();
+                    seq->set_length (CurrentTime, false);
+                    seq->zero_markers ();
+                    done = true;
+
+                    /* the channels split out take after the track */
+                    for (unsigned int c = 0; c < a_track->m_channels.size(); c++)
+                    {
+                        MidiSequence *channel = a_track->m_channels[c];
+                        if (channel == NULL)
+                            continue;
+
+                        char name[sizeof TrackName + 8];
+                        snprintf(name, sizeof name, "%s %d", seq->get_name(), c + 1);
+
+                        channel->set_name (name);
+                        channel->set_midi_bus (seq->get_midi_bus());
+                        channel->setBeatsPerMeasure (seq->getBeatsPerMeasure());
+                        channel->setBeatWidth (seq->getBeatWidth());
+
+                        /* in order already, so sorted the once */
+                        channel->sort_events ();
+                        channel->set_length (CurrentTime, false);
+                        channel->zero_markers ();
+                    }
+                    break;
+
+                    /* Track name */
+                case 0x03:
+                    for (i = 0; i < len && i < (int) sizeof(TrackName) - 1; i++)
+                    {
+                        TrackName[i] = cursor->read_byte();
+                    }
+
+                    TrackName[i] = '\0';
+
+                    /* longer names are cut */
+                    cursor->skip (len - i);
+
+                    //printf("[%s]\n", TrackName );
+                    seq->set_name (TrackName);
+                    break;
+
+                    /* sequence number */
+                case 0x00:
+                    if (len == 0x00)
+                        a_track->m_perf = 0;
+                    else
+                        a_track->m_perf = cursor->read_short ();
+
+                    //printf ( "perf %d\n", perf );
+                    break;
+
+                default:
+                    cursor->skip (len);
+                    break;
+                }
+            }
+            else if(status == 0xF0)
+            {
+                /* sysex */
+                len = cursor->read_var ();
+
+                /* skip it */
+                cursor->skip (len);
+
+                fprintf(stderr, "Warning, no support for SYSEX messages, discarding.\n");
+            }
+            else
+            {
+                fprintf(stderr, "Unexpected system event : 0x%.2X", status);
+                return false;
+            }
+
+            break;
+
+        default:
+            fprintf(stderr, "Unsupported MIDI event: %hhu\n", status);
+            return false;
+            break;
+        }
+
+    }			/* while ( !done loading Trk chunk */
+
+    return true;
+}
+
+
+void
+MidiFile::add_event (MidiFileTrack *a_track, MidiEvent *a_e, int a_channel)
+{
+    MidiSequence *seq = a_track->m_seq;
+
+    /* one pass over the track, each event straight to its channel */
+    if (a_track->m_split)
+    {
+        if (a_track->m_channels.empty())
+            a_track->m_channels.resize(16, NULL);
+
+        if (a_track->m_channels[a_channel] == NULL)
+        {
+            a_track->m_channels[a_channel] = new MidiSequence ();
+            a_track->m_channels[a_channel]->set_master_midi_bus (m_bus);
+        }
+
+        seq = a_track->m_channels[a_channel];
+    }
+
+    seq->append_event (a_e);
+
+    /* set midi channel */
+    seq->set_midi_channel (a_channel);
+}
+
+
+void
+MidiFile::split_tracks ()
+{
+    unsigned int tracks = m_tracks.size();
+
+    /* the first channel takes the place of the track, the others go
+       in the slots after it, as far as they're free */
+    for (unsigned int t = 0; t < tracks; t++)
+    {
+        int n = 0;
+
+        for (unsigned int c = 0; c < m_tracks[t].m_channels.size(); c++)
+        {
+            MidiSequence *seq = m_tracks[t].m_channels[c];
+            if (seq == NULL)
+                continue;
+
+            if (n == 0)
+            {
+                delete m_tracks[t].m_seq;
+                m_tracks[t].m_seq = seq;
+            }
+            else
+            {
+                MidiFileTrack track;
+                track.m_seq = seq;
+                track.m_perf = m_tracks[t].m_perf + n;
+                track.m_ok = true;
+                m_tracks.push_back(track);
+            }
+
+            n++;
+        }
+
+        m_tracks[t].m_channels.clear();
+    }
+}
+
+
+void *
+decode_thread_func (void *a_file)
+{
+    ((MidiFile *) a_file)->decode_func();
+    return NULL;
+}
+
+
+void
+MidiFile::decode_func ()
+{
+    int next;
+
+    while ((next = __sync_fetch_and_add(&m_next_track, 1)) < (int) m_decode.size())
+    {
+        MidiFileTrack *track = &m_tracks[m_decode[next]];
+        track->m_ok = decode_track(track);
+
+        /* a broken track gives nothing, split or not */
+        if (!track->m_ok)
+        {
+            for (unsigned int c = 0; c < track->m_channels.size(); c++)
+                delete track->m_channels[c];
+
+            track->m_channels.clear();
+        }
+    }
+}
+
+
+void *
+encode_thread_func (void *a_file)
+{
+    ((MidiFile *) a_file)->encode_func();
+    return NULL;
+}
+
+
+void
+MidiFile::encode_func ()
+{
+    int track;
+
+    while ((track = __sync_fetch_and_add(&m_next_track, 1)) < (int) m_tracks.size())
+        encode_track(&m_tracks[track]);
+}
+
+
+void
+MidiFile::run_workers (void *(*a_func)(void *), int a_jobs)
+{
+    int workers = m_workers;
+
+    if (workers <= 0) {
+        workers = 1;
+#ifndef __WIN32__
+        workers = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    }
+
+    if (workers > a_jobs)
+        workers = a_jobs;
+
+    m_next_track = 0;
+
+    /* this thread is a worker too */
+    vector<pthread_t> threads;
+
+    for (int w = 1; w < workers; w++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, a_func, this) == 0)
+            threads.push_back(thread);
+    }
+
+    a_func(this);
+
+    for (unsigned int w = 0; w < threads.size(); w++)
+        pthread_join(threads[w], NULL);
+}
+
+
+void
+MidiFile::decode_tracks ()
+{
+    /* tracks share nothing but the read only file, so each worker
+       decodes whole tracks into their own sequences */
+    run_workers(decode_thread_func, m_decode.size());
+}
+
+
+bool
+MidiFile::decode_sequence (const unsigned char *a_data, unsigned long a_size,
+                           MidiSequence *a_seq)
+{
+    MidiFileTrack track;
+    track.m_cursor.set(a_data, a_size);
+    track.m_seq = a_seq;
+    track.m_perf = 0;
+    track.m_ok = false;
+    track.m_slot = -1;
+
+    return decode_track(&track);
+}
+
+
+void
+MidiFile::encode_track (MidiFileTrack *a_track)
+{
+    vector<unsigned char> &bytes = a_track->m_bytes;
+
+    /* magic number 'MTrk', the length is filled in below */
+    bytes.clear();
+    bytes.resize(8);
+    bytes[0] = 'M';
+    bytes[1] = 'T';
+    bytes[2] = 'r';
+    bytes[3] = 'k';
+
+    if (a_track->m_copy != NULL)
+        a_track->m_copy->fill_buffer(&bytes, a_track->m_perf);
+    else if (a_track->m_seq != NULL)
+        a_track->m_seq->fill_buffer(&bytes, a_track->m_perf);
+    else
+        /* loaded lazily and never decoded, so it's still as it came */
+        bytes.insert(bytes.end(), a_track->m_cursor.m_data,
+                     a_track->m_cursor.m_data + a_track->m_cursor.m_size);
+
+    unsigned long length = bytes.size() - 8;
+    bytes[4] = (length & 0xFF000000) >> 24;
+    bytes[5] = (length & 0x00FF0000) >> 16;
+    bytes[6] = (length & 0x0000FF00) >> 8;
+    bytes[7] = (length & 0x000000FF);
+}
+
+
+void
+MidiFile::encode_tracks ()
+{
+    /* each sequence takes its own lock while it is encoded, or has
+       been copied out already, so the workers only share the track
+       list */
+    run_workers(encode_thread_func, m_tracks.size());
+}
+
+
+bool
+MidiFile::find_tracks (unsigned short a_num_tracks)
+{
+    unsigned long ID;
+    unsigned long TrackLength;
+
+    /* We should be good to load now   */
+    /* first find each MTrk, they are length prefixed and
+       don't depend on each other */
+    m_tracks.clear();
+
+    for (int curTrack = 0; curTrack < a_num_tracks; curTrack++)
+    {
+        /* Get ID + Length */
+        ID = read_long ();
+        TrackLength = read_long ();
+        //printf( "[%8lX] len[%8lX]\n", ID,  TrackLength );
+
+        if (m_cursor.m_overrun || TrackLength > remaining())
+        {
+            fprintf(stderr, "Truncated MIDI track\n");
+            m_tracks.clear();
+            return false;
+        }
+
+        /* magic number 'MTrk' */
+        if (ID == 0x4D54726B)
+        {
+            MidiFileTrack track;
+            track.m_cursor.set(m_data + m_cursor.m_pos, TrackLength);
+            track.m_seq = NULL;
+            track.m_perf = 0;
+            track.m_ok = false;
+            track.m_slot = -1;
+            track.m_split = m_split_channels;
+            m_tracks.push_back(track);
+        }
+        else
+        {
+            /* its not a MTrk, we dont know how to deal with it,
+               so we just eat it */
+            fprintf(stderr, "Unsupported MIDI header detected: %8lX\n", ID);
+        }
+
+        skip (TrackLength);
+    }
+
+    return true;
+}
+
+
+void
+MidiFile::new_sequences (MasterMidiBus * a_bus)
+{
+    for (unsigned int d = 0; d < m_decode.size(); d++)
+    {
+        MidiFileTrack *track = &m_tracks[m_decode[d]];
+
+        track->m_seq = new MidiSequence ();
+        track->m_seq->set_master_midi_bus (a_bus);
+        track->m_ok = false;
+    }
+
+    m_bus = a_bus;
+}
+
+
+bool
+MidiFile::parse_tracks (MasterMidiBus * a_bus, unsigned short a_num_tracks)
+{
+    MidiFileCache cache(m_name);
+
+    if (!find_tracks (a_num_tracks))
+        return false;
+
+    /* we know we have good tracks, so we can create
+       new sequences to dump them to */
+    m_decode.clear();
+    for (unsigned int t = 0; t < m_tracks.size(); t++)
+        m_decode.push_back(t);
+
+    new_sequences (a_bus);
+    decode_tracks ();
+
+    bool ok = true;
+    for (unsigned int t = 0; t < m_tracks.size(); t++)
+        ok = ok && m_tracks[t].m_ok;
+
+    split_tracks ();
+
+    /* the sequences are as they'll be adopted next time */
+    if (ok && global_file_cache)
+        cache.write (m_data, m_size, m_cursor.m_pos, m_tracks);
+
+    /* none of them if any track was broken */
+    if (!ok)
+    {
+        for (unsigned int t = 0; t < m_tracks.size(); t++)
+            delete m_tracks[t].m_seq;
+
+        m_tracks.clear();
+    }
+
+    return ok;
+}
+
+
+bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
+{
+    if (!prepare (a_perf))
+        return false;
+
+    adopt_sequences (a_perf, a_screen_set);
+    adopt_settings (a_perf);
+
+    return true;
+}
+
+
+bool MidiFile::read_header (unsigned short *a_num_tracks)
+{
+    if (!open_data())
+        return false;
+
+    /* chunk info */
+    unsigned long ID;
+
+    unsigned short Format;			/* 0,1,2 */
+    unsigned short NumTracks;
+
+    /* read in header */
+    ID = read_long ();
+    read_long ();			/* header length */
+    Format = read_short ();
+    NumTracks = read_short ();
+    m_ppqn = read_short ();
+
+    //printf( "[%8lX] len[%ld] fmt[%d] num[%d] ppqn[%d]\n",
+    //      ID, TrackLength, Format, NumTracks, m_ppqn );
+
+    /* magic number 'MThd' */
+    if (m_cursor.m_overrun || ID != 0x4D546864) {
+        fprintf(stderr, "Invalid MIDI header detected: %8lX\n", ID);
+        return false;
+    }
+
+    /* format 1, or format 0 which is split into a sequence per
+       channel as it's decoded */
+    if (Format != 1 && Format != 0) {
+        fprintf(stderr, "Unsupported MIDI format detected: %d\n", Format);
+        return false;
+    }
+
+    /* ticks per quarter note, which the times are scaled by. bit 15
+       set means SMPTE frames instead, which we don't read */
+    if (m_ppqn == 0 || (m_ppqn & 0x8000)) {
+        fprintf(stderr, "Unsupported MIDI division detected: %04X\n", m_ppqn);
+        return false;
+    }
+
+    m_split_channels = Format == 0;
+
+    *a_num_tracks = NumTracks;
+    return true;
+}
+
+
+bool MidiFile::prepare (MidiPerformance * a_perf)
+{
+    if (!decode (&a_perf->m_master_bus))
+        return false;
+
+    find_bpm ();
+    return true;
+}
+
+
+/* skims the settings as adopt_settings() reads them, as far as the
+   bpm, leaving the cursor where it is */
+void MidiFile::find_bpm ()
+{
+    MidiFileCursor settings = m_cursor;
+    unsigned long ID;
+
+    m_bpm = 0;
+
+    if (settings.remaining() > sizeof (unsigned long))
+    {
+        ID = settings.read_long ();
+        if (ID == c_midictrl)
+        {
+            /* three controls of six bytes each, a count too big
+               for what's left just overruns */
+            unsigned long seqs = settings.read_long ();
+            if (seqs > settings.remaining())
+                settings.skip (settings.remaining() + 1);
+            else
+                settings.skip (seqs * 18);
+        }
+
+        ID = settings.read_long ();
+        if (ID == c_midiclocks)
+            settings.skip (settings.read_long ());
+    }
+
+    if (settings.remaining() > sizeof (unsigned long))
+    {
+        ID = settings.read_long ();
+        if (ID == c_notes)
+        {
+            unsigned int screen_sets = settings.read_short ();
+
+            for (unsigned int x = 0; x < screen_sets; x++)
+                settings.skip (settings.read_short ());
+        }
+    }
+
+    if (settings.remaining() > sizeof (unsigned int))
+    {
+        ID = settings.read_long ();
+        if (ID == c_bpmtag)
+            m_bpm = settings.read_long ();
+    }
+
+    if (settings.m_overrun)
+        m_bpm = 0;
+}
+
+
+bool MidiFile::decode (MasterMidiBus * a_bus)
+{
+    unsigned short num_tracks;
+
+    if (!read_header (&num_tracks))
+        return false;
+
+    /* a cache still matching the file saves decoding the tracks */
+    MidiFileCache cache(m_name);
+    unsigned long trailer;
+
+    if (global_file_cache &&
+        cache.load(a_bus, m_data, m_size, &trailer, &m_tracks))
+    {
+        m_cursor.set(m_data, m_size);
+        skip (trailer);
+        return true;
+    }
+
+    return parse_tracks (a_bus, num_tracks);
+}
+
+
+void MidiFile::trailer (const unsigned char **a_data, unsigned long *a_size)
+{
+    *a_data = m_data + m_cursor.m_pos;
+    *a_size = remaining();
+}
+
+
+bool MidiFile::parse_lazy (MidiPerformance * a_perf)
+{
+    unsigned short num_tracks;
+
+    if (!read_header (&num_tracks))
+        return false;
+
+    /* a cache has every sequence ready, there's nothing to put off */
+    MidiFileCache cache(m_name);
+    unsigned long trailer;
+
+    if (global_file_cache &&
+        cache.load(&a_perf->m_master_bus, m_data, m_size, &trailer, &m_tracks))
+    {
+        m_cursor.set(m_data, m_size);
+        skip (trailer);
+    }
+    else if (!find_tracks (num_tracks))
+        return false;
+
+    /* a native track starts with its sequence number, so the slot
+       it goes in is known without decoding it. the slots are the
+       ones parse() would pick, anything else is decoded now */
+    m_decode.clear();
+
+    for (unsigned int t = 0; t < m_tracks.size(); t++)
+    {
+        MidiFileTrack *track = &m_tracks[t];
+        const unsigned char *d = track->m_cursor.m_data;
+        int slot = -1;
+
+        if (track->m_seq == NULL && !track->m_split &&
+            track->m_cursor.m_size >= 6 &&
+            d[0] == 0x00 && d[1] == 0xFF && d[2] == 0x00 && d[3] == 0x02)
+            slot = (d[4] << 8) | d[5];
+
+        while (slot >= 0 && slot < c_max_sequence && m_lazy[slot] >= 0)
+            slot++;
+
+        if (slot >= 0 && slot < c_max_sequence)
+        {
+            track->m_slot = slot;
+            m_lazy[slot] = t;
+        }
+        else if (track->m_seq == NULL)
+            m_decode.push_back(t);
+    }
+
+    new_sequences (&a_perf->m_master_bus);
+    decode_tracks ();
+
+    bool ok = true;
+    for (unsigned int d = 0; d < m_decode.size(); d++)
+        ok = ok && m_tracks[m_decode[d]].m_ok;
+
+    split_tracks ();
+
+    if (!ok)
+    {
+        for (unsigned int t = 0; t < m_tracks.size(); t++)
+            delete m_tracks[t].m_seq;
+
+        m_tracks.clear();
+        return false;
+    }
+
+    /* from here on a_perf keeps its hands off the lazy slots */
+    a_perf->set_lazy_file (this);
+
+    for (unsigned int t = 0; t < m_tracks.size(); t++)
     {
-        /* shift ret 7 bits */
-        ret <<= 7;
-        /* add bits 0-6 */
-        ret += (c & 0x7F);
+        if (m_tracks[t].m_seq != NULL)
+            a_perf->add_sequence (m_tracks[t].m_seq, m_tracks[t].m_perf);
+
+        m_tracks[t].m_seq = NULL;
     }
 
-    /* bit was clear */
-    ret <<= 7;
-    ret += (c & 0x7F);
+    m_decode.clear();
 
-    return ret;
+    adopt_settings (a_perf);
+
+    load_bank (a_perf, a_perf->getBank());
+
+    return true;
 }
 
 
-bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
+bool MidiFile::is_lazy (int a_slot)
 {
-    /* open binary file */
-    ifstream file(m_name.toUtf8().constData(), ios::in | ios::binary | ios::ate);
+    return a_slot >= 0 && a_slot < c_max_sequence && m_lazy[a_slot] >= 0;
+}
 
-    if (!file.is_open ()) {
-        fprintf(stderr, "Error opening MIDI file\n");
-        return false;
-    }
 
-    int file_size = file.tellg ();
+const MidiFileCursor *MidiFile::lazy_track (int a_slot)
+{
+    if (!is_lazy (a_slot))
+        return NULL;
 
-    /* run to start */
-    file.seekg (0, ios::beg);
+    return &m_tracks[m_lazy[a_slot]].m_cursor;
+}
 
-    /* alloc data */
-    try
-    {
-        m_d.resize(file_size);
-    }
-    catch(std::bad_alloc& ex)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
-        return false;
-    }
-    file.read ((char *) &m_d[0], file_size);
-    file.close ();
 
-    /* set position to 0 */
-    m_pos = 0;
+bool MidiFile::has_lazy ()
+{
+    for (int b = 0; b < c_max_num_banks; b++)
+        if (has_lazy (b))
+            return true;
 
-    /* chunk info */
-    unsigned long ID;
-    unsigned long TrackLength;
+    return false;
+}
 
-    /* time */
-    unsigned long Delta;
-    unsigned long RunningTime;
-    unsigned long CurrentTime;
 
-    unsigned short Format;			/* 0,1,2 */
-    unsigned short NumTracks;
-    unsigned short ppqn;
-    unsigned short perf;
+bool MidiFile::has_lazy (int a_bank)
+{
+    if (a_bank < 0 || a_bank >= c_max_num_banks)
+        return false;
 
-    /* track name from file */
-    char TrackName[256];
+    for (int i = a_bank * cSeqsInBank; i < (a_bank + 1) * cSeqsInBank; i++)
+        if (m_lazy[i] >= 0)
+            return true;
 
-    /* used in small loops */
-    int i;
+    return false;
+}
 
-    /* sequence pointer */
-    MidiSequence * seq;
-    MidiEvent e;
 
-    /* read in header */
-    ID = read_long ();
-    TrackLength = read_long ();
-    Format = read_short ();
-    NumTracks = read_short ();
-    ppqn = read_short ();
+void MidiFile::adopt_decoded (MidiPerformance * a_perf)
+{
+    for (unsigned int d = 0; d < m_decode.size(); d++)
+    {
+        MidiFileTrack *track = &m_tracks[m_decode[d]];
 
-    //printf( "[%8lX] len[%ld] fmt[%d] num[%d] ppqn[%d]\n",
-    //      ID, TrackLength, Format, NumTracks, ppqn );
+        /* free the slot first, add_sequence() skips lazy ones */
+        m_lazy[track->m_slot] = -1;
 
-    /* magic number 'MThd' */
-    if (ID != 0x4D546864) {
-        fprintf(stderr, "Invalid MIDI header detected: %8lX\n", ID);
-        return false;
-    }
+        if (track->m_ok)
+            a_perf->add_sequence (track->m_seq, track->m_slot);
+        else
+        {
+            fprintf(stderr, "Error decoding MIDI track for slot %d\n",
+                    track->m_slot);
+            delete track->m_seq;
+        }
 
-    /* we are only supporting format 1 for now */
-    if (Format != 1) {
-        fprintf(stderr, "Unsupported MIDI format detected: %d\n", Format);
-        return false;
+        track->m_seq = NULL;
     }
 
-    /* We should be good to load now   */
-    /* for each Track in the midi file */
-    for (int curTrack = 0; curTrack < NumTracks; curTrack++)
-    {
-        /* done for each track */
-        bool done = false;
-        perf = 0;
+    m_decode.clear();
+}
 
-        /* events */
-        unsigned char status = 0, type, data[2], laststatus;
-        long len;
-        unsigned long proprietary = 0;
 
-        /* Get ID + Length */
-        ID = read_long ();
-        TrackLength = read_long ();
-        //printf( "[%8lX] len[%8lX]\n", ID,  TrackLength );
+void MidiFile::load_bank (MidiPerformance * a_perf, int a_bank)
+{
+    if (!has_lazy (a_bank))
+        return;
 
+    /* it may be the bank being prefetched */
+    finish_prefetch (a_perf, true);
 
-        /* magic number 'MTrk' */
-        if (ID == 0x4D54726B)
-        {
-            /* we know we have a good track, so we can create
-               a new sequence to dump it to */
-            seq = new MidiSequence ();
-            if (seq == NULL) {
-                fprintf(stderr, "Memory allocation failed\n");
-                return false;
-            }
-            seq->set_master_midi_bus (&a_perf->m_master_bus);
+    m_decode.clear();
+    for (int i = a_bank * cSeqsInBank; i < (a_bank + 1) * cSeqsInBank; i++)
+        if (m_lazy[i] >= 0)
+            m_decode.push_back(m_lazy[i]);
 
-            /* reset time */
-            RunningTime = 0;
+    new_sequences (&a_perf->m_master_bus);
+    decode_tracks ();
+    adopt_decoded (a_perf);
+}
 
-            /* this gets each event in the Trk */
-            while (!done)
-            {
-                /* get time delta */
-                Delta = read_var ();
 
-                /* get status */
-                laststatus = status;
-                status = m_d[m_pos];
+void *
+prefetch_thread_func (void *a_file)
+{
+    ((MidiFile *) a_file)->prefetch_func();
+    return NULL;
+}
 
-                /* is it a status bit ? */
-                if ((status & 0x80) == 0x00)
-                {
-                    /* no, its a running status */
-                    status = laststatus;
-                }
-                else
-                {
-                    /* its a status, increment */
-                    m_pos++;
-                }
 
-                /* set the members in event */
-                e.set_status (status);
+void MidiFile::prefetch_func ()
+{
+    /* one bank, one worker, it isn't in a hurry */
+    m_next_track = 0;
+    decode_func ();
 
-                RunningTime += Delta;
-                /* current time is ppqn according to the file,
-                   we have to adjust it to our own ppqn.
-                   PPQN / ppqn gives us the ratio */
-                CurrentTime = (RunningTime * c_ppqn) / ppqn;
+    /* the sequences have to be there before the flag */
+    __sync_synchronize ();
+    m_prefetch_done = true;
+}
 
-                //printf( "D[%6ld] [%6ld] %02X\n", Delta, CurrentTime, status);
-                e.set_timestamp (CurrentTime);
 
-                /* switch on the channelless status */
-                switch (status & 0xF0)
-                {
-                /* case for those with 2 data bytes */
-                case EVENT_NOTE_OFF:
-                case EVENT_NOTE_ON:
-                case EVENT_AFTERTOUCH:
-                case EVENT_CONTROL_CHANGE:
-                case EVENT_PITCH_WHEEL:
-
-                    data[0] = read_byte();
-                    data[1] = read_byte();
-
-                    // some files have vel=0 as note off
-                    if ((status & 0xF0) == EVENT_NOTE_ON && data[1] == 0)
-                    {
-                        e.set_status (EVENT_NOTE_OFF);
-                    }
+bool MidiFile::prefetch (MidiPerformance * a_perf, int a_bank)
+{
+    if (m_prefetching)
+        return false;
 
-                    //printf( "%02X %02X\n", data[0], data[1] );
+    if (!has_lazy (a_bank))
+        return true;
 
-                    /* set data and add */
-                    e.set_data (data[0], data[1]);
-                    seq->add_event (&e);
+    m_decode.clear();
+    for (int i = a_bank * cSeqsInBank; i < (a_bank + 1) * cSeqsInBank; i++)
+        if (m_lazy[i] >= 0)
+            m_decode.push_back(m_lazy[i]);
 
-                    /* set midi channel */
-                    seq->set_midi_channel (status & 0x0F);
-                    break;
+    new_sequences (&a_perf->m_master_bus);
+    m_prefetch_done = false;
 
-                    /* one data item */
-                case EVENT_PROGRAM_CHANGE:
-                case EVENT_CHANNEL_PRESSURE:
+    if (pthread_create(&m_prefetch_thread, NULL, prefetch_thread_func, this) != 0)
+    {
+        /* no thread, it's decoded when it's selected instead */
+        for (unsigned int d = 0; d < m_decode.size(); d++)
+        {
+            delete m_tracks[m_decode[d]].m_seq;
+            m_tracks[m_decode[d]].m_seq = NULL;
+        }
 
-                    data[0] = read_byte();
-                    //printf( "%02X\n", data[0] );
+        m_decode.clear();
+        return true;
+    }
 
-                    /* set data and add */
-                    e.set_data (data[0]);
-                    seq->add_event (&e);
+    m_prefetching = true;
+    return true;
+}
 
-                    /* set midi channel */
-                    seq->set_midi_channel (status & 0x0F);
-                    break;
 
-                    /* meta midi events ---  this should be FF !!!!!  */
-                case 0xF0:
+void MidiFile::finish_prefetch (MidiPerformance * a_perf, bool a_wait)
+{
+    if (!m_prefetching || (!a_wait && !m_prefetch_done))
+        return;
 
-                    if (status == 0xFF)
-                    {
-                        /* get meta type */
-                        type = read_byte();
-                        len = read_var ();
+    pthread_join(m_prefetch_thread, NULL);
+    m_prefetching = false;
 
-                        //printf( "%02X %08X ", type, (int) len );
+    adopt_decoded (a_perf);
+}
 
-                        switch (type)
-                        {
-                        /* proprietary */
-                        case 0x7f:
-
-                            /* FF 7F len data  */
-                            if (len > 4)
-                            {
-                                proprietary = read_long ();
-                                len -= 4;
-                            }
-
-                            if (proprietary == c_midibus)
-                            {
-                                seq->set_midi_bus (read_byte());
-                                len--;
-                            }
-
-                            else if (proprietary == c_midich)
-                            {
-                                seq->set_midi_channel (read_byte());
-                                len--;
-                            }
-
-                            else if (proprietary == c_timesig)
-                            {
-                                seq->setBeatsPerMeasure (read_byte());
-                                seq->setBeatWidth (read_byte());
-                                len -= 2;
-                            }
-
-                            else if (proprietary == c_triggers)
-                            {
-                                int num_triggers = len / 4;
-
-                                for (int i = 0; i < num_triggers; i += 2)
-                                {
-                                    unsigned long on = read_long ();
-                                    unsigned long length = (read_long () - on);
-                                    len -= 8;
-                                    seq->add_trigger(on, length, 0, false);
-                                }
-                            }
-
-                            else if (proprietary == c_triggers_new)
-                            {
-                                int num_triggers = len / 12;
-
-                                //printf( "num_triggers[%d]\n", num_triggers );
-                                for (int i = 0; i < num_triggers; i++)
-                                {
-                                    unsigned long on = read_long ();
-                                    unsigned long off = read_long ();
-                                    unsigned long length = off - on + 1;
-                                    unsigned long offset = read_long ();
-
-                                    //printf( "< start[%d] end[%d] offset[%d]\n",
-                                    //        on, off, offset );
-
-                                    len -= 12;
-                                    seq->add_trigger (on, length, offset, false);
-                                }
-                            }
-
-                            /* eat the rest */
-                            m_pos += len;
-                            break;
-
-                            /* Trk Done */
-                        case 0x2f:
-
-                            // If delta is 0, then another event happened at the same time
-                            // as the track end.  the sequence class will discard the last
-                            // note.  This is a fix for that.   Native Seq24 file will always
-                            // have a Delta >= 1
-                            if ( Delta == 0 ){
-                                CurrentTime += 1;
-                            }
-
-                            seq->set_length (CurrentTime, false);
-                            seq->zero_markers ();
-                            done = true;
-                            break;
-
-                            /* Track name */
-                        case 0x03:
-                            for (i = 0; i < len; i++)
-                            {
-                                TrackName[i] = read_byte();
-                            }
-
-                            TrackName[i] = '\0';
-
-                            //printf("[%s]\n", TrackName );
-                            seq->set_name (TrackName);
-                            break;
-
-                            /* sequence number */
-                        case 0x00:
-                            if (len == 0x00)
-                                perf = 0;
-                            else
-                                perf = read_short ();
-
-                            //printf ( "perf %d\n", perf );
-                            break;
-
-                        default:
-                            for (i = 0; i < len; i++)
-                            {
-                                read_byte();
-                            }
-                            break;
-                        }
-                    }
-                    else if(status == 0xF0)
-                    {
-                        /* sysex */
-                        len = read_var ();
 
-                        /* skip it */
-                        m_pos += len;
+void MidiFile::adopt_sequences (MidiPerformance * a_perf, int a_screen_set)
+{
+    /* the sequences have been filled, add them in file order */
+    for (unsigned int t = 0; t < m_tracks.size(); t++)
+    {
+        //printf ( "add_sequence( %d )\n", perf + (a_screen_set * c_seqs_in_set));
+        a_perf->add_sequence (m_tracks[t].m_seq,
+                              m_tracks[t].m_perf + (a_screen_set * cSeqsInBank));
+    }
 
-                        fprintf(stderr, "Warning, no support for SYSEX messages, discarding.\n");
-                    }
-                    else
-                    {
-                        fprintf(stderr, "Unexpected system event : 0x%.2X", status);
-                        return false;
-                    }
+    m_tracks.clear();
+}
 
-                    break;
 
-                default:
-                    fprintf(stderr, "Unsupported MIDI event: %hhu\n", status);
-                    return false;
-                    break;
-                }
+void MidiFile::place_sequences (MidiSequence **a_seqs)
+{
+    for (int i = 0; i < c_max_sequence; i++)
+        a_seqs[i] = NULL;
 
-            }			/* while ( !done loading Trk chunk */
+    /* the slots add_sequence() would pick in an empty performance */
+    for (unsigned int t = 0; t < m_tracks.size(); t++)
+    {
+        int slot = m_tracks[t].m_perf;
 
-            /* the sequence has been filled, add it  */
-            //printf ( "add_sequence( %d )\n", perf + (a_screen_set * c_seqs_in_set));
-            a_perf->add_sequence (seq, perf + (a_screen_set * cSeqsInBank));
-        }
+        while (slot < c_max_sequence && a_seqs[slot] != NULL)
+            slot++;
 
-        /* dont know what kind of chunk */
+        if (slot < c_max_sequence)
+            a_seqs[slot] = m_tracks[t].m_seq;
         else
-        {
-            /* its not a MTrk, we dont know how to deal with it,
-               so we just eat it */
-            fprintf(stderr, "Unsupported MIDI header detected: %8lX\n", ID);
-            m_pos += TrackLength;
-            done = true;
-        }
+            delete m_tracks[t].m_seq;
+    }
+
+    m_tracks.clear();
+}
+
 
-    }				/* for(eachtrack) */
+void MidiFile::adopt_settings (MidiPerformance * a_perf, bool a_bpm)
+{
+    unsigned long ID;
+    unsigned long TrackLength;
 
-    //printf ( "file_size[%d] m_pos[%d]\n", file_size, m_pos );
+    //printf ( "m_size[%lu] m_pos[%lu]\n", m_size, m_cursor.m_pos );
 
-    if ((file_size - m_pos) > (int) sizeof (unsigned long))
+    if (remaining() > sizeof (unsigned long))
     {
         ID = read_long ();
         if (ID == c_midictrl)
@@ -459,6 +1346,7 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
                 a_perf->get_midi_control_off (i)->m_min_value = read_byte();
                 a_perf->get_midi_control_off (i)->m_max_value = read_byte();
             }
+            a_perf->rebuild_midi_control_table();
         }
 
         /* Get ID + Length */
@@ -475,7 +1363,7 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
         }
     }
 
-    if ((file_size - m_pos) > (int) sizeof (unsigned long))
+    if (remaining() > sizeof (unsigned long))
     {
         /* Get ID + Length */
         ID = read_long ();
@@ -497,19 +1385,20 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
         }
     }
 
-    if ((file_size - m_pos) > (int) sizeof (unsigned int))
+    if (remaining() > sizeof (unsigned int))
     {
         /* Get ID + Length */
         ID = read_long ();
         if (ID == c_bpmtag)
         {
             long bpm = read_long ();
-            a_perf->set_bpm (bpm);
+            if (a_bpm)
+                a_perf->set_bpm (bpm);
         }
     }
 
     // read in the mute group info.
-    if ((file_size - m_pos) > (int) sizeof (unsigned long))
+    if (remaining() > sizeof (unsigned long))
     {
         ID = read_long ();
         if (ID == c_mutegroups)
@@ -530,7 +1419,7 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
     }
 
     //read in sequence colour settings
-    if ((file_size - m_pos) > (int) sizeof (unsigned long))
+    if (remaining() > sizeof (unsigned long))
     {
         ID = read_long ();
         if (ID == c_seq_colours)
@@ -539,7 +1428,7 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
                  curTrack < c_max_sequence;
                  curTrack++)
             {
-                if (a_perf->is_active (curTrack))
+                if (a_perf->is_active (curTrack) || a_perf->is_lazy (curTrack))
                 {
                     a_perf->setSequenceColour(curTrack, (thumb_colours_e) read_long());
                 }
@@ -548,7 +1437,7 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
     }
 
     //read in sequence editing modes
-    if ((file_size - m_pos) > (int) sizeof (unsigned long))
+    if (remaining() > sizeof (unsigned long))
     {
         ID = read_long ();
         if (ID == c_seq_edit_mode)
@@ -557,7 +1446,7 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
                  curTrack < c_max_sequence;
                  curTrack++)
             {
-                if (a_perf->is_active (curTrack))
+                if (a_perf->is_active (curTrack) || a_perf->is_lazy (curTrack))
                 {
                     a_perf->setEditMode(curTrack, (edit_mode_e) read_long());
                 }
@@ -568,7 +1457,8 @@ bool MidiFile::parse (MidiPerformance * a_perf, int a_screen_set)
 
     // *** ADD NEW TAGS AT END **************/
 
-    return true;
+    if (m_cursor.m_overrun)
+        fprintf(stderr, "Truncated MIDI file, some settings were not read\n");
 }
 
 
@@ -592,24 +1482,26 @@ MidiFile::write_short (unsigned short a_x)
 void
 MidiFile::write_byte (unsigned char a_x)
 {
-    m_l.push_back (a_x);
+    m_buffer.push_back (a_x);
 }
 
 bool MidiFile::write (MidiPerformance * a_perf)
 {
-    int numtracks = 0;
+    snapshot (a_perf);
+    return write_snapshot ();
+}
 
-    /* get number of tracks */
-    for (int i = 0; i < c_max_sequence; i++)
-    {
-        if (a_perf->is_active (i))
-            numtracks++;
-    }
+
+void
+MidiFile::write_header ()
+{
+    int numtracks = m_tracks.size ();
 
     //printf ("numtracks[%d]\n", numtracks );
 
     /* write header */
     /* 'MThd' and length of 6 */
+    m_buffer.clear ();
     write_long (0x4D546864);
     write_long (0x00000006);
 
@@ -618,33 +1510,70 @@ bool MidiFile::write (MidiPerformance * a_perf)
     write_short (numtracks);
     write_short (c_ppqn);
 
-    /* We should be good to load now   */
-    /* for each Track in the midi file */
-    for (int curTrack = 0; curTrack < c_max_sequence; curTrack++)
+    m_header_size = m_buffer.size ();
+}
+
+
+void
+MidiFile::snapshot (MidiSequence **a_seqs,
+                    const unsigned char *a_trailer, unsigned long a_trailer_size)
+{
+    m_tracks.clear();
+
+    for (int i = 0; i < c_max_sequence; i++)
     {
-        if (a_perf->is_active (curTrack))
+        if (a_seqs[i] != NULL)
         {
-            /* sequence pointer */
-            MidiSequence * seq = a_perf->get_sequence (curTrack);
+            MidiFileTrack track;
+            track.m_seq = a_seqs[i];
+            track.m_perf = i;
+            track.m_ok = true;
+            track.m_slot = -1;
+            m_tracks.push_back (track);
+        }
+    }
+
+    write_header ();
 
-            //printf ("track[%d]\n", curTrack );
-            std::list<char> l;
-            seq->fill_list (&l, curTrack);
+    m_buffer.insert (m_buffer.end(), a_trailer, a_trailer + a_trailer_size);
+}
 
-            /* magic number 'MTrk' */
-            write_long (0x4D54726B);
-            write_long (l.size ());
 
-            //printf("MTrk len[%d]\n", l.size());
+void
+MidiFile::snapshot (MidiPerformance * a_perf)
+{
+    /* get the tracks */
+    m_tracks.clear();
 
-            while (l.size () > 0)
-            {
-                write_byte (l.back ());
-                l.pop_back ();
-            }
+    for (int i = 0; i < c_max_sequence; i++)
+    {
+        if (a_perf->is_active (i))
+        {
+            /* copied now and encoded by write_snapshot(), so the
+               sequence is only held for the copy */
+            MidiFileTrack track;
+            track.m_seq = a_perf->get_sequence (i);
+            track.m_copy = new MidiSequenceCopy;
+            track.m_seq->copy_for_write (track.m_copy);
+            track.m_perf = i;
+            track.m_ok = true;
+            track.m_slot = -1;
+            m_tracks.push_back (track);
+        }
+        else if (a_perf->is_lazy (i))
+        {
+            /* never decoded, the chunk it came in is written back */
+            MidiFileTrack track;
+            track.m_cursor = *a_perf->m_lazy_file->lazy_track (i);
+            track.m_seq = NULL;
+            track.m_perf = i;
+            track.m_ok = true;
+            track.m_slot = i;
+            m_tracks.push_back (track);
         }
     }
 
+    write_header ();
 
     /* midi control */
     write_long (c_midictrl);
@@ -691,7 +1620,7 @@ bool MidiFile::write (MidiPerformance * a_perf)
     write_long (c_seq_colours);
     for (int curTrack = 0; curTrack < c_max_sequence; curTrack++)
     {
-        if (a_perf->is_active (curTrack))
+        if (a_perf->is_active (curTrack) || a_perf->is_lazy (curTrack))
         {
             write_long(a_perf->getSequenceColour(curTrack));
         }
@@ -701,32 +1630,208 @@ bool MidiFile::write (MidiPerformance * a_perf)
     write_long (c_seq_edit_mode);
     for (int curTrack = 0; curTrack < c_max_sequence; curTrack++)
     {
-        if (a_perf->is_active (curTrack))
+        if (a_perf->is_active (curTrack) || a_perf->is_lazy (curTrack))
         {
             write_long(a_perf->getEditMode(curTrack));
         }
     }
 
 
-    /* open binary file */
-    ofstream file (m_name.toUtf8().constData(), ios::out | ios::binary | ios::trunc);
+}
 
-    if (!file.is_open ())
+
+bool
+MidiFile::write_snapshot ()
+{
+    /* each track into its own chunk */
+    encode_tracks ();
+
+    bool ok = write_data ();
+
+    for (unsigned int t = 0; t < m_tracks.size (); t++)
+        delete m_tracks[t].m_copy;
+
+    m_buffer.clear ();
+    m_tracks.clear ();
+
+    return ok;
+}
+
+
+void *
+write_thread_func (void *a_file)
+{
+    ((MidiFile *) a_file)->write_func();
+    return NULL;
+}
+
+
+void
+MidiFile::write_func ()
+{
+    m_write_ok = write_snapshot ();
+
+    /* the result has to be there before the flag */
+    __sync_synchronize ();
+    m_write_done = true;
+}
+
+
+bool
+MidiFile::write_async (MidiPerformance * a_perf)
+{
+    if (m_writing)
+        wait_write ();
+
+    /* the sequences are copied here, so the caller can carry on
+       editing them as soon as we return. encoding them, the file
+       and the fsync are left to the thread */
+    snapshot (a_perf);
+
+    m_write_done = false;
+
+    if (pthread_create(&m_write_thread, NULL, write_thread_func, this) != 0)
+    {
+        /* no thread, so write it here */
+        m_write_ok = write_snapshot ();
+        m_write_done = true;
+        return m_write_ok;
+    }
+
+    m_writing = true;
+    return true;
+}
+
+
+bool
+MidiFile::write_done ()
+{
+    return m_write_done;
+}
+
+
+bool
+MidiFile::wait_write ()
+{
+    if (m_writing)
+    {
+        pthread_join(m_write_thread, NULL);
+        m_writing = false;
+    }
+
+    return m_write_ok;
+}
+
+
+bool
+MidiFile::write_data ()
+{
+    /* the header, the track chunks, then the sections after them.
+       empty ones are left out, indexing their first byte is out of
+       range (a plain SMF has nothing after its tracks) */
+#ifndef __WIN32__
+    vector<struct iovec> iov;
+    struct iovec piece;
+
+    piece.iov_base = &m_buffer[0];
+    piece.iov_len = m_header_size;
+    iov.push_back (piece);
+
+    for (unsigned int t = 0; t < m_tracks.size (); t++)
+    {
+        if (m_tracks[t].m_bytes.empty ())
+            continue;
+
+        piece.iov_base = &m_tracks[t].m_bytes[0];
+        piece.iov_len = m_tracks[t].m_bytes.size ();
+        iov.push_back (piece);
+    }
+
+    if (m_buffer.size () > m_header_size)
+    {
+        piece.iov_base = &m_buffer[m_header_size];
+        piece.iov_len = m_buffer.size () - m_header_size;
+        iov.push_back (piece);
+    }
+
+    /* written beside the old file and renamed over it once it is all
+       on disk, so a failed or interrupted save leaves the old one */
+    string name = m_name.toUtf8 ().constData ();
+    string temp = name + ".tmp";
+
+    int fd = open (temp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd < 0) {
+        fprintf(stderr, "Error writing MIDI file\n");
         return false;
+    }
 
-    /* enable bufferization */
-    char file_buffer[1024];
-    file.rdbuf()->pubsetbuf(file_buffer, sizeof file_buffer);
+    bool ok = true;
+    unsigned int first = 0;
 
-    for (list < unsigned char >::iterator i = m_l.begin ();
-         i != m_l.end (); i++)
+    while (first < iov.size ())
     {
-        char c = *i;
-        file.write(&c, 1);
+        int count = iov.size () - first;
+        if (count > IOV_MAX)
+            count = IOV_MAX;
+
+        ssize_t written = writev (fd, &iov[first], count);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            ok = false;
+            break;
+        }
+
+        /* step over what went out, a short write ends part way
+           through a piece */
+        while (first < iov.size () && (size_t) written >= iov[first].iov_len) {
+            written -= iov[first].iov_len;
+            first++;
+        }
+
+        if (written > 0) {
+            iov[first].iov_base = (char *) iov[first].iov_base + written;
+            iov[first].iov_len -= written;
+        }
     }
 
-    m_l.clear ();
+    if (ok && fsync (fd) < 0)
+        ok = false;
+
+    if (close (fd) < 0)
+        ok = false;
+
+    if (ok && rename (temp.c_str (), name.c_str ()) < 0)
+        ok = false;
+
+    if (!ok) {
+        fprintf(stderr, "Error writing MIDI file\n");
+        unlink (temp.c_str ());
+        return false;
+    }
 
     return true;
+#else
+    /* open binary file */
+    ofstream file (m_name.toUtf8().constData(), ios::out | ios::binary | ios::trunc);
+
+    if (!file.is_open ())
+        return false;
+
+    file.write ((const char *) &m_buffer[0], m_header_size);
+
+    for (unsigned int t = 0; t < m_tracks.size (); t++)
+        if (!m_tracks[t].m_bytes.empty ())
+            file.write ((const char *) &m_tracks[t].m_bytes[0],
+                        m_tracks[t].m_bytes.size ());
+
+    if (m_buffer.size () > m_header_size)
+        file.write ((const char *) &m_buffer[m_header_size],
+                    m_buffer.size () - m_header_size);
+
+    return file.good ();
+#endif
 }
 
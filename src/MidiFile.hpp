@@ -7,23 +7,163 @@
 #include <vector>
 #include <QString>
 
+#include <pthread.h>
+
+/* FNV-1a of a_data, for checking saved data against what it was
+   built from */
+unsigned long hash_bytes( const unsigned char *a_data, unsigned long a_size );
+
+///
+/// \brief The MidiFileCursor class
+///
+/// Bounds checked reads over a range of a MIDI file. Reading past
+/// the end flags an overrun and returns 0 rather than touching
+/// memory outside the range
+
+class MidiFileCursor
+{
+ public:
+
+    const unsigned char *m_data;
+    unsigned long m_size;
+    unsigned long m_pos;
+
+    /* set once a read runs past the end, reads then return 0 */
+    bool m_overrun;
+
+    MidiFileCursor();
+
+    void set( const unsigned char *a_data, unsigned long a_size );
+
+    unsigned long remaining() const { return m_size - m_pos; }
+
+    unsigned long read_long();
+    unsigned short read_short();
+    unsigned char read_byte();
+    unsigned char peek_byte();
+    unsigned long read_var();
+    void skip( unsigned long a_len );
+};
+
+/* an MTrk chunk and the sequence it decodes into, or when writing
+   the sequence and the chunk it encodes into */
+struct MidiFileTrack
+{
+    MidiFileCursor m_cursor;
+    std::vector<unsigned char> m_bytes;
+    MidiSequence *m_seq;
+    unsigned short m_perf;
+    bool m_ok;
+
+    /* the slot it goes in when loaded lazily */
+    int m_slot;
+
+    /* split by channel while decoding, each channel that has events
+       gets a sequence of its own and m_seq keeps the rest */
+    bool m_split;
+    std::vector<MidiSequence *> m_channels;
+
+    /* when saving from a performance, what m_seq held when it was
+       taken, so it can be encoded away from the sequence */
+    MidiSequenceCopy *m_copy;
+
+    MidiFileTrack() :
+        m_seq(NULL), m_perf(0), m_ok(false), m_slot(-1), m_split(false),
+        m_copy(NULL) {}
+};
+
 class MidiFile
 {
 
  private:
     
-    int m_pos;
     const QString m_name;
 
-    /* holds our data */
+    /* the file being parsed, mapped where we can, else read into m_d */
+    const unsigned char *m_data;
+    unsigned long m_size;
+    void *m_map;
 	std::vector<unsigned char> m_d;
+
+    /* reads the header and the sections after the tracks */
+    MidiFileCursor m_cursor;
+
+    /* the tracks of the file and the ppqn they are timed in, the
+       workers in decode_tracks() and encode_tracks() take them by
+       m_next_track */
+    std::vector<MidiFileTrack> m_tracks;
+    unsigned short m_ppqn;
+    volatile int m_next_track;
+
+    /* most threads run_workers() uses, 0 for one per core */
+    int m_workers;
+
+    /* the tracks a decode works through, by index into m_tracks, and
+       the bus their sequences play to */
+    std::vector<int> m_decode;
+    MasterMidiBus *m_bus;
+
+    /* format 0, all the channels in one track, which is split */
+    bool m_split_channels;
+
+    /* the bpm in the settings of a kepler34 file, once prepare()
+       has found it, else 0 */
+    int m_bpm;
+
+    /* loaded lazily, the track each slot's sequence is still waiting
+       in, or -1 */
+    int m_lazy[c_max_sequence];
+
+    /* the thread prefetch() decodes m_decode on, what it decoded is
+       adopted once m_prefetch_done is set */
+    pthread_t m_prefetch_thread;
+    bool m_prefetching;
+    volatile bool m_prefetch_done;
     
-    list<unsigned char> m_l;
+    /* the header and the sections after the tracks being written,
+       split at m_header_size with the track chunks between */
+    std::vector<unsigned char> m_buffer;
+    unsigned long m_header_size;
 
-    unsigned long read_long();
-    unsigned short read_short();
-    unsigned char read_byte();
-    unsigned long read_var();
+    /* the thread write_async() writes on, m_write_done is set once
+       m_write_ok holds its result */
+    pthread_t m_write_thread;
+    bool m_writing;
+    volatile bool m_write_done;
+    bool m_write_ok;
+
+    bool open_data();
+    void close_data();
+
+    unsigned long remaining() const { return m_cursor.remaining(); }
+
+    unsigned long read_long() { return m_cursor.read_long(); }
+    unsigned short read_short() { return m_cursor.read_short(); }
+    unsigned char read_byte() { return m_cursor.read_byte(); }
+    unsigned long read_var() { return m_cursor.read_var(); }
+    void skip( unsigned long a_len ) { m_cursor.skip( a_len ); }
+
+    void run_workers( void *(*a_func)( void * ), int a_jobs );
+
+    bool read_header( unsigned short *a_num_tracks );
+    bool find_tracks( unsigned short a_num_tracks );
+
+    bool decode_track( MidiFileTrack *a_track );
+    void add_event( MidiFileTrack *a_track, MidiEvent *a_e, int a_channel );
+    void split_tracks();
+    void decode_tracks();
+    bool parse_tracks( MasterMidiBus *a_bus, unsigned short a_num_tracks );
+
+    void new_sequences( MasterMidiBus *a_bus );
+    void adopt_decoded( MidiPerformance *a_perf );
+
+    void encode_track( MidiFileTrack *a_track );
+    void encode_tracks();
+    void write_header();
+
+    bool write_data();
+
+    void find_bpm();
 
     void write_long( unsigned long );
     void write_short( unsigned short );
@@ -36,8 +176,83 @@ class MidiFile
     ~MidiFile();
 
     bool parse( MidiPerformance *a_perf, int a_screen_set );
+
+    /* how many threads decode or encode the tracks at most, 0 (the
+       default) for one per core. callers already running a thread
+       per core of their own want 1 */
+    void set_workers( int a_workers ) { m_workers = a_workers; }
+
+    /* parse() in steps. prepare() decodes the tracks into sequences
+       of their own, touching nothing of a_perf but its bus, so it
+       can run on any thread. adopt_sequences() adds them to a_perf,
+       or place_sequences() hands them over by slot instead. then
+       adopt_settings() reads the rest of the file into a_perf, all
+       but the bpm if the caller sets that itself from bpm() */
+    bool prepare( MidiPerformance *a_perf );
+    void adopt_sequences( MidiPerformance *a_perf, int a_screen_set );
+    void place_sequences( MidiSequence **a_seqs );
+    void adopt_settings( MidiPerformance *a_perf, bool a_bpm = true );
+    int bpm() const { return m_bpm; }
     bool write( MidiPerformance *a_perf );
 
-};
+    /* parse() decoding only the tracks of the first bank. on
+       success a_perf owns this file and decodes the rest of it as
+       the banks are needed, else the caller still does */
+    bool parse_lazy( MidiPerformance *a_perf );
+
+    /* the slot is still waiting in this file to be decoded, and
+       the track chunk it is in */
+    bool is_lazy( int a_slot );
+    const MidiFileCursor *lazy_track( int a_slot );
+
+    /* decodes a bank and adds it to a_perf, then and until it's all
+       loaded, on the GUI thread. prefetch() decodes one in the
+       background, false while another still is */
+    bool has_lazy();
+    bool has_lazy( int a_bank );
+    void load_bank( MidiPerformance *a_perf, int a_bank );
+    bool prefetch( MidiPerformance *a_perf, int a_bank );
+
+    /* adopts what prefetch() decoded once it's done, or a_wait */
+    void finish_prefetch( MidiPerformance *a_perf, bool a_wait );
+
+    /* prepare() for tools without a performance, the sequences
+       play to a_bus, which may be NULL if they never play. trailer()
+       is what followed the tracks, the settings of a kepler34 file */
+    bool decode( MasterMidiBus *a_bus );
+    void trailer( const unsigned char **a_data, unsigned long *a_size );
+
+    /* write() in two halves, snapshot() takes everything from a_perf
+       and write_snapshot() encodes and writes it out from any thread */
+    void snapshot( MidiPerformance *a_perf );
 
+    /* or the sequences by slot, with a_trailer after them as it is */
+    void snapshot( MidiSequence **a_seqs,
+                   const unsigned char *a_trailer, unsigned long a_trailer_size );
+    bool write_snapshot();
 
+    /* decodes one MTrk body, as MidiSequence::fill_buffer() writes
+       them, into a_seq */
+    bool decode_sequence( const unsigned char *a_data, unsigned long a_size,
+                          MidiSequence *a_seq );
+
+    /* takes what write() would write from a_perf, then encodes and
+       writes it on a thread of its own. write_done() polls for it to finish and
+       wait_write() waits for it and returns whether it worked */
+    bool write_async( MidiPerformance *a_perf );
+    bool write_done();
+    bool wait_write();
+
+    /* a decoding worker, takes tracks until none are left */
+    void decode_func();
+
+    /* the body of the prefetch() thread */
+    void prefetch_func();
+
+    /* an encoding worker, the same for writing */
+    void encode_func();
+
+    /* the body of the write_async() thread */
+    void write_func();
+
+};
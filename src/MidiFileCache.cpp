@@ -0,0 +1,307 @@
+#include "MidiFileCache.hpp"
+#include "MidiFile.hpp"
+#include "MidiPerformance.hpp"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef __WIN32__
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+/* byte order and the size of long, reads the same only on a build
+   like the one that wrote it */
+const unsigned int c_file_cache_abi = 0x01020300 | sizeof (long);
+
+
+MidiFileCache::MidiFileCache (const QString &a_file) :
+    m_path(std::string(a_file.toUtf8().constData()) + ".cache")
+{
+}
+
+
+/* true if a_count structs of a_size at a_offset lie inside the cache */
+static bool
+in_cache (unsigned long a_cache_size, unsigned int a_offset,
+          unsigned int a_count, unsigned long a_size)
+{
+    if (a_offset > a_cache_size || a_offset % 4 != 0)
+        return false;
+
+    return a_count <= (a_cache_size - a_offset) / a_size;
+}
+
+
+bool
+MidiFileCache::load (MasterMidiBus *a_bus,
+                     const unsigned char *a_data, unsigned long a_size,
+                     unsigned long *a_trailer,
+                     vector<MidiFileTrack> *a_tracks)
+{
+#ifndef __WIN32__
+    int fd = open(m_path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) < 0 ||
+        (unsigned long) info.st_size < sizeof (MidiFileCacheHeader))
+    {
+        close(fd);
+        return false;
+    }
+
+    unsigned long size = info.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+        return false;
+
+    const unsigned char *cache = (const unsigned char *) map;
+    const MidiFileCacheHeader *header = (const MidiFileCacheHeader *) cache;
+
+    bool ok = header->m_magic == c_file_cache_magic &&
+              header->m_version == c_file_cache_version &&
+              header->m_abi == c_file_cache_abi &&
+              header->m_file_size == a_size &&
+              header->m_trailer <= a_size &&
+              in_cache(size, sizeof (MidiFileCacheHeader), header->m_num_seqs,
+                       sizeof (MidiFileCacheSequence));
+
+    /* last, it's the one that reads the whole file */
+    ok = ok && header->m_file_hash == hash_bytes(a_data, a_size);
+
+    const MidiFileCacheSequence *records =
+            (const MidiFileCacheSequence *) (cache + sizeof (MidiFileCacheHeader));
+
+    vector<MidiSequence *> seqs;
+    vector<unsigned int> perfs;
+    vector<MidiEvent *> nodes;
+
+    for (unsigned int s = 0; ok && s < header->m_num_seqs; s++)
+    {
+        const MidiFileCacheSequence *record = &records[s];
+
+        if (!in_cache(size, record->m_events, record->m_num_events,
+                      sizeof (MidiFileCacheEvent)) ||
+            !in_cache(size, record->m_triggers, record->m_num_triggers,
+                      sizeof (MidiFileCacheTrigger)))
+        {
+            ok = false;
+            break;
+        }
+
+        const MidiFileCacheEvent *events =
+                (const MidiFileCacheEvent *) (cache + record->m_events);
+        const MidiFileCacheTrigger *triggers =
+                (const MidiFileCacheTrigger *) (cache + record->m_triggers);
+
+        MidiSequence *seq = new MidiSequence();
+        seq->set_master_midi_bus(a_bus);
+        seqs.push_back(seq);
+        perfs.push_back(record->m_perf);
+
+        char name[c_file_cache_name];
+        memcpy(name, record->m_name, sizeof name);
+        name[sizeof name - 1] = '\0';
+
+        seq->m_name = name;
+        seq->m_length = record->m_length;
+        seq->m_time_beats_per_measure = record->m_beats_per_measure;
+        seq->m_time_beat_width = record->m_beat_width;
+        seq->m_midi_channel = record->m_channel;
+        seq->m_bus = record->m_bus;
+
+        /* already in order, and the links are indices into it */
+        nodes.resize(record->m_num_events);
+
+        for (unsigned int e = 0; e < record->m_num_events; e++)
+        {
+            seq->m_list_event.push_back(MidiEvent());
+
+            MidiEvent *ev = &seq->m_list_event.back();
+            ev->set_timestamp(events[e].m_timestamp);
+            ev->set_status(events[e].m_status);
+            ev->set_data(events[e].m_data[0], events[e].m_data[1]);
+            nodes[e] = ev;
+        }
+
+        for (unsigned int e = 0; ok && e < record->m_num_events; e++)
+        {
+            int linked = events[e].m_linked;
+
+            if (linked < 0)
+                continue;
+
+            if ((unsigned int) linked >= record->m_num_events)
+                ok = false;
+            else
+                nodes[e]->link(nodes[linked]);
+        }
+
+        for (unsigned int t = 0; t < record->m_num_triggers; t++)
+        {
+            MidiTrigger trigger;
+            trigger.m_tick_start = triggers[t].m_tick_start;
+            trigger.m_tick_end = triggers[t].m_tick_end;
+            trigger.m_offset = triggers[t].m_offset;
+            seq->m_list_trigger.push_back(trigger);
+        }
+    }
+
+    /* all of them or none */
+    for (unsigned int s = 0; s < seqs.size(); s++)
+    {
+        if (ok)
+        {
+            MidiFileTrack track;
+            track.m_seq = seqs[s];
+            track.m_perf = perfs[s];
+            track.m_ok = true;
+            track.m_slot = -1;
+            a_tracks->push_back(track);
+        }
+        else
+            delete seqs[s];
+    }
+
+    if (ok)
+        *a_trailer = header->m_trailer;
+
+    munmap(map, size);
+
+    return ok;
+#else
+    return false;
+#endif
+}
+
+
+bool
+MidiFileCache::write (const unsigned char *a_data, unsigned long a_size,
+                      unsigned long a_trailer,
+                      const vector<MidiFileTrack> &a_tracks)
+{
+#ifndef __WIN32__
+    MidiFileCacheHeader header;
+    memset(&header, 0, sizeof header);
+
+    header.m_magic = c_file_cache_magic;
+    header.m_version = c_file_cache_version;
+    header.m_abi = c_file_cache_abi;
+    header.m_file_size = a_size;
+    header.m_file_hash = hash_bytes(a_data, a_size);
+    header.m_trailer = a_trailer;
+    header.m_num_seqs = a_tracks.size();
+
+    /* the sequence records follow the header, the event and
+       trigger arrays follow them */
+    vector<MidiFileCacheSequence> records(a_tracks.size());
+    vector<MidiFileCacheEvent> events;
+    vector<MidiFileCacheTrigger> triggers;
+
+    unsigned long offset = sizeof header +
+            records.size() * sizeof (MidiFileCacheSequence);
+
+    for (unsigned int s = 0; s < a_tracks.size(); s++)
+    {
+        MidiSequence *seq = a_tracks[s].m_seq;
+        MidiFileCacheSequence *record = &records[s];
+
+        memset(record, 0, sizeof *record);
+        strncpy(record->m_name, seq->m_name.c_str(), c_file_cache_name - 1);
+
+        record->m_perf = a_tracks[s].m_perf;
+        record->m_length = seq->m_length;
+        record->m_beats_per_measure = seq->m_time_beats_per_measure;
+        record->m_beat_width = seq->m_time_beat_width;
+        record->m_channel = seq->m_midi_channel;
+        record->m_bus = seq->m_bus;
+
+        /* number the events so links can be stored as indices */
+        std::map<MidiEvent *, int> index;
+        list<MidiEvent>::iterator i;
+        int n = 0;
+
+        for (i = seq->m_list_event.begin(); i != seq->m_list_event.end(); i++)
+            index[&(*i)] = n++;
+
+        record->m_events = offset + events.size() * sizeof (MidiFileCacheEvent);
+        record->m_num_events = n;
+
+        for (i = seq->m_list_event.begin(); i != seq->m_list_event.end(); i++)
+        {
+            MidiFileCacheEvent event;
+            memset(&event, 0, sizeof event);
+
+            event.m_timestamp = (*i).get_timestamp();
+            event.m_status = (*i).get_status();
+            (*i).get_data(&event.m_data[0], &event.m_data[1]);
+            event.m_linked = (*i).is_linked() ? index[(*i).get_linked()] : -1;
+
+            events.push_back(event);
+        }
+    }
+
+    offset += events.size() * sizeof (MidiFileCacheEvent);
+
+    for (unsigned int s = 0; s < a_tracks.size(); s++)
+    {
+        MidiSequence *seq = a_tracks[s].m_seq;
+        MidiFileCacheSequence *record = &records[s];
+
+        record->m_triggers = offset + triggers.size() * sizeof (MidiFileCacheTrigger);
+        record->m_num_triggers = seq->m_list_trigger.size();
+
+        list<MidiTrigger>::iterator t;
+        for (t = seq->m_list_trigger.begin(); t != seq->m_list_trigger.end(); t++)
+        {
+            MidiFileCacheTrigger trigger;
+            trigger.m_tick_start = (*t).m_tick_start;
+            trigger.m_tick_end = (*t).m_tick_end;
+            trigger.m_offset = (*t).m_offset;
+            triggers.push_back(trigger);
+        }
+    }
+
+    /* it can always be rebuilt, so it's only renamed into place to
+       keep a reader from seeing half of it */
+    std::string temp = m_path + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+
+    if (file == NULL)
+        return false;
+
+    bool ok = fwrite(&header, sizeof header, 1, file) == 1;
+
+    if (ok && !records.empty())
+        ok = fwrite(&records[0], sizeof (MidiFileCacheSequence),
+                    records.size(), file) == records.size();
+    if (ok && !events.empty())
+        ok = fwrite(&events[0], sizeof (MidiFileCacheEvent),
+                    events.size(), file) == events.size();
+    if (ok && !triggers.empty())
+        ok = fwrite(&triggers[0], sizeof (MidiFileCacheTrigger),
+                    triggers.size(), file) == triggers.size();
+
+    if (fclose(file) != 0)
+        ok = false;
+
+    if (ok && rename(temp.c_str(), m_path.c_str()) < 0)
+        ok = false;
+
+    if (!ok) {
+        fprintf(stderr, "Error writing MIDI file cache %s\n", m_path.c_str());
+        unlink(temp.c_str());
+    }
+
+    return ok;
+#else
+    return false;
+#endif
+}
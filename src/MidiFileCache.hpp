@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Globals.hpp"
+
+#include <string>
+#include <vector>
+#include <QString>
+
+class MasterMidiBus;
+struct MidiFileTrack;
+
+/* 'K34C' */
+const unsigned int c_file_cache_magic = 0x4B333443;
+
+/* bump whenever any of the structs below change */
+const unsigned int c_file_cache_version = 1;
+
+const int c_file_cache_name = 256;
+
+/* the cache is these structs laid out as they are in memory, every
+   one a multiple of 4 bytes so the arrays stay aligned. it is only
+   ever read by the build that wrote it, m_abi catches the rest */
+struct MidiFileCacheHeader
+{
+    unsigned int m_magic;
+    unsigned int m_version;
+    unsigned int m_abi;
+
+    /* the SMF this was built from */
+    unsigned int m_file_size;
+    unsigned int m_file_hash;
+
+    /* where the sections after the tracks start in the SMF */
+    unsigned int m_trailer;
+
+    unsigned int m_num_seqs;
+};
+
+struct MidiFileCacheSequence
+{
+    unsigned int m_perf;
+    unsigned int m_length;
+    unsigned int m_beats_per_measure;
+    unsigned int m_beat_width;
+    unsigned int m_channel;
+    unsigned int m_bus;
+
+    /* offsets from the start of the cache */
+    unsigned int m_events;
+    unsigned int m_num_events;
+    unsigned int m_triggers;
+    unsigned int m_num_triggers;
+
+    char m_name[c_file_cache_name];
+};
+
+/* sorted as the sequence holds them, m_linked is the index of the
+   note on or off this one is linked to, or -1 */
+struct MidiFileCacheEvent
+{
+    unsigned int m_timestamp;
+    int m_linked;
+    unsigned char m_status;
+    unsigned char m_data[2];
+    unsigned char m_pad;
+};
+
+struct MidiFileCacheTrigger
+{
+    int m_tick_start;
+    int m_tick_end;
+    int m_offset;
+};
+
+///
+/// \brief The MidiFileCache class
+///
+/// Sidecar of a MIDI file holding its sequences as they are once
+/// loaded, sorted with their notes linked, so a large set can be
+/// adopted without decoding, sorting and linking every track
+/// again. It is checked against the size and hash of the file it
+/// was built from and rebuilt whenever it doesn't match
+
+class MidiFileCache
+{
+
+ private:
+
+    std::string m_path;
+
+ public:
+
+    MidiFileCache( const QString &a_file );
+
+    /* fills a_tracks with the cached sequences of a_data and sets
+       a_trailer to where the rest of the file starts. false, with
+       a_tracks untouched, if there is no cache or it's stale */
+    bool load( MasterMidiBus *a_bus,
+               const unsigned char *a_data, unsigned long a_size,
+               unsigned long *a_trailer,
+               std::vector<MidiFileTrack> *a_tracks );
+
+    /* builds the cache from freshly decoded tracks of a_data */
+    bool write( const unsigned char *a_data, unsigned long a_size,
+                unsigned long a_trailer,
+                const std::vector<MidiFileTrack> &a_tracks );
+
+};
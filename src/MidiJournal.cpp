@@ -0,0 +1,534 @@
+#include "MidiJournal.hpp"
+#include "MidiFile.hpp"
+#include "MidiPerformance.hpp"
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#ifdef __WIN32__
+#   include <io.h>
+#   define fsync _commit
+#endif
+
+/* type, id and length in front of every record, a checksum behind */
+const unsigned long c_journal_record_head = 7;
+const unsigned long c_journal_record_tail = 4;
+
+
+static void
+put_long (vector<unsigned char> *a_bytes, unsigned long a_x)
+{
+    a_bytes->push_back((a_x & 0xFF000000) >> 24);
+    a_bytes->push_back((a_x & 0x00FF0000) >> 16);
+    a_bytes->push_back((a_x & 0x0000FF00) >> 8);
+    a_bytes->push_back((a_x & 0x000000FF));
+}
+
+
+static unsigned long
+get_long (const unsigned char *a_data)
+{
+    return ((unsigned long) a_data[0] << 24) |
+           ((unsigned long) a_data[1] << 16) |
+           ((unsigned long) a_data[2] << 8) |
+           ((unsigned long) a_data[3]);
+}
+
+
+static void
+add_record (vector<unsigned char> *a_bytes, int a_type, int a_id,
+            const unsigned char *a_data, unsigned long a_size)
+{
+    unsigned long start = a_bytes->size();
+
+    a_bytes->push_back(a_type);
+    a_bytes->push_back((a_id & 0xFF00) >> 8);
+    a_bytes->push_back((a_id & 0x00FF));
+    put_long(a_bytes, a_size);
+    a_bytes->insert(a_bytes->end(), a_data, a_data + a_size);
+
+    put_long(a_bytes, hash_bytes(&(*a_bytes)[start], a_bytes->size() - start));
+}
+
+
+/* steps a_pos over the next record in a_data, false at the end or
+   at a record torn by a crash */
+static bool
+next_record (const vector<unsigned char> &a_data, unsigned long *a_pos,
+             int *a_type, int *a_id,
+             unsigned long *a_start, unsigned long *a_size)
+{
+    unsigned long pos = *a_pos;
+
+    if (a_data.size() - pos < c_journal_record_head + c_journal_record_tail)
+        return false;
+
+    const unsigned char *head = &a_data[pos];
+    unsigned long size = get_long(head + 3);
+
+    if (size > a_data.size() - pos - c_journal_record_head - c_journal_record_tail)
+        return false;
+
+    unsigned long end = pos + c_journal_record_head + size;
+
+    if (get_long(&a_data[end]) != hash_bytes(head, end - pos))
+        return false;
+
+    *a_type = head[0];
+    *a_id = (head[1] << 8) | head[2];
+    *a_start = pos + c_journal_record_head;
+    *a_size = size;
+    *a_pos = end + c_journal_record_tail;
+
+    return true;
+}
+
+
+MidiJournal::MidiJournal (const QString &a_path) :
+    m_path(a_path.toUtf8().constData()),
+    m_generation(0),
+    m_running(false),
+    m_exit(false),
+    m_fd(-1),
+    m_bpm(0),
+    m_size(0),
+    m_countdown(c_journal_interval)
+{
+    for (int i = 0; i < c_max_sequence; i++)
+    {
+        m_dirty[i] = false;
+        m_hash[i] = 0;
+        m_length[i] = 0;
+    }
+
+    /* carry on from the generation a journal left behind, so our
+       first base doesn't overwrite the one it replays onto */
+    QString name;
+    can_recover(&name);
+}
+
+
+MidiJournal::~MidiJournal ()
+{
+    if (m_running)
+    {
+        m_condition.lock();
+        m_exit = true;
+        m_condition.signal();
+        m_condition.unlock();
+
+        pthread_join(m_thread, NULL);
+    }
+
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+
+std::string
+MidiJournal::base_path (unsigned long a_generation)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof suffix, ".%lu.midi", a_generation);
+
+    return m_path + suffix;
+}
+
+
+bool
+MidiJournal::read_journal (vector<unsigned char> *a_data)
+{
+    int fd = open(m_path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    unsigned char buffer[4096];
+    ssize_t got;
+
+    while ((got = read(fd, buffer, sizeof buffer)) != 0)
+    {
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        a_data->insert(a_data->end(), buffer, buffer + got);
+    }
+
+    close(fd);
+    return true;
+}
+
+
+bool
+MidiJournal::can_recover (QString *a_name)
+{
+    vector<unsigned char> data;
+    unsigned long pos = 0;
+    int type, id;
+    unsigned long start, size;
+
+    if (!read_journal(&data))
+        return false;
+
+    /* it starts with the base it applies to */
+    if (!next_record(data, &pos, &type, &id, &start, &size) ||
+        type != e_journal_start || size < 4)
+        return false;
+
+    m_generation = get_long(&data[start]);
+    *a_name = QString::fromUtf8((const char *) &data[start] + 4, size - 4);
+
+    /* and is worth recovering if anything came after that */
+    return next_record(data, &pos, &type, &id, &start, &size);
+}
+
+
+bool
+MidiJournal::recover (MidiPerformance *a_perf)
+{
+    vector<unsigned char> data;
+    unsigned long pos = 0;
+    int type, id;
+    unsigned long start, size;
+
+    if (!read_journal(&data))
+        return false;
+
+    if (!next_record(data, &pos, &type, &id, &start, &size) ||
+        type != e_journal_start || size < 4)
+        return false;
+
+    unsigned long generation = get_long(&data[start]);
+
+    a_perf->clear_all();
+
+    MidiFile base(QString::fromUtf8(base_path(generation).c_str()));
+
+    if (!base.parse(a_perf, 0)) {
+        fprintf(stderr, "Error reading journal base %s\n",
+                base_path(generation).c_str());
+        return false;
+    }
+
+    /* each record is the whole of a sequence, so the last one for
+       a sequence is how it was left */
+    while (next_record(data, &pos, &type, &id, &start, &size))
+    {
+        switch (type) {
+
+        case e_journal_sequence:
+
+            if (id >= c_max_sequence)
+                break;
+
+            if (a_perf->is_active(id))
+                a_perf->delete_sequence(id);
+
+            if (size > 0)
+            {
+                MidiSequence *seq = new MidiSequence();
+                seq->set_master_midi_bus(&a_perf->m_master_bus);
+
+                if (base.decode_sequence(&data[start], size, seq))
+                    a_perf->add_sequence(seq, id);
+                else
+                    delete seq;
+            }
+            break;
+
+        case e_journal_bpm:
+
+            if (size == 4)
+                a_perf->set_bpm(get_long(&data[start]));
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+
+void *
+journal_thread_func (void *a_journal)
+{
+    ((MidiJournal *) a_journal)->write_func();
+    return NULL;
+}
+
+
+bool
+MidiJournal::start (MidiPerformance *a_perf, const QString &a_name)
+{
+    if (pthread_create(&m_thread, NULL, journal_thread_func, this) != 0) {
+        fprintf(stderr, "Error starting the journal\n");
+        return false;
+    }
+
+    m_running = true;
+    reset(a_perf, a_name);
+
+    return true;
+}
+
+
+void
+MidiJournal::encode_sequence (MidiPerformance *a_perf, int a_seq)
+{
+    m_scratch.clear();
+
+    if (a_perf->is_active(a_seq))
+        a_perf->get_sequence(a_seq)->fill_buffer(&m_scratch, a_seq);
+}
+
+
+void
+MidiJournal::queue (MidiJournalJob *a_job)
+{
+    m_condition.lock();
+
+    m_jobs.push_back(MidiJournalJob());
+    m_jobs.back().m_bytes.swap(a_job->m_bytes);
+    m_jobs.back().m_file = a_job->m_file;
+    m_jobs.back().m_old_base = a_job->m_old_base;
+
+    m_condition.signal();
+    m_condition.unlock();
+}
+
+
+void
+MidiJournal::reset (MidiPerformance *a_perf, const QString &a_name)
+{
+    if (!m_running)
+        return;
+
+    MidiJournalJob job;
+    job.m_old_base = base_path(m_generation);
+
+    m_generation++;
+    m_name = a_name;
+
+    /* the whole performance as it is now becomes the new base */
+    job.m_file = new MidiFile(QString::fromUtf8(base_path(m_generation).c_str()));
+    job.m_file->snapshot(a_perf);
+
+    /* and anything marked so far is in it */
+    for (int i = 0; i < c_max_sequence; i++)
+    {
+        encode_sequence(a_perf, i);
+
+        m_dirty[i] = false;
+        m_hash[i] = hash_bytes(m_scratch.empty() ? NULL : &m_scratch[0], m_scratch.size());
+        m_length[i] = m_scratch.size();
+    }
+
+    m_bpm = a_perf->get_bpm();
+    m_size = 0;
+
+    vector<unsigned char> start;
+    put_long(&start, m_generation);
+    QByteArray name = m_name.toUtf8();
+    start.insert(start.end(), name.constData(), name.constData() + name.size());
+
+    add_record(&job.m_bytes, e_journal_start, 0, &start[0], start.size());
+
+    queue(&job);
+}
+
+
+void
+MidiJournal::mark (int a_seq)
+{
+    if (a_seq >= 0 && a_seq < c_max_sequence)
+        m_dirty[a_seq] = true;
+}
+
+
+void
+MidiJournal::flush (MidiPerformance *a_perf)
+{
+    if (!m_running || --m_countdown > 0)
+        return;
+
+    m_countdown = c_journal_interval;
+
+    MidiJournalJob job;
+    job.m_file = NULL;
+
+    for (int i = 0; i < c_max_sequence; i++)
+    {
+        if (!m_dirty[i])
+            continue;
+
+        m_dirty[i] = false;
+        encode_sequence(a_perf, i);
+
+        /* marks come from playing and muting too, only journal
+           the ones whose contents moved */
+        const unsigned char *data = m_scratch.empty() ? NULL : &m_scratch[0];
+        unsigned long h = hash_bytes(data, m_scratch.size());
+
+        if (h == m_hash[i] && m_scratch.size() == m_length[i])
+            continue;
+
+        m_hash[i] = h;
+        m_length[i] = m_scratch.size();
+        add_record(&job.m_bytes, e_journal_sequence, i, data, m_scratch.size());
+    }
+
+    int bpm = a_perf->get_bpm();
+
+    if (bpm != m_bpm)
+    {
+        vector<unsigned char> value;
+        put_long(&value, bpm);
+        add_record(&job.m_bytes, e_journal_bpm, 0, &value[0], value.size());
+        m_bpm = bpm;
+    }
+
+    if (job.m_bytes.empty())
+        return;
+
+    m_size += job.m_bytes.size();
+    queue(&job);
+
+    if (m_size > c_journal_compact_size)
+        reset(a_perf, m_name);
+}
+
+
+void
+MidiJournal::discard ()
+{
+    if (m_running)
+    {
+        m_condition.lock();
+        m_exit = true;
+        m_condition.signal();
+        m_condition.unlock();
+
+        pthread_join(m_thread, NULL);
+        m_running = false;
+    }
+
+    if (m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+
+    unlink(m_path.c_str());
+    unlink(base_path(m_generation).c_str());
+}
+
+
+bool
+MidiJournal::write_all (int a_fd, const vector<unsigned char> &a_bytes)
+{
+    unsigned long done = 0;
+
+    while (done < a_bytes.size())
+    {
+        ssize_t written = write(a_fd, &a_bytes[done], a_bytes.size() - done);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        done += written;
+    }
+
+    return fsync(a_fd) == 0;
+}
+
+
+void
+MidiJournal::append (const vector<unsigned char> &a_bytes)
+{
+    if (m_fd < 0)
+        return;
+
+    if (!write_all(m_fd, a_bytes))
+        fprintf(stderr, "Error writing journal %s\n", m_path.c_str());
+}
+
+
+void
+MidiJournal::compact (MidiJournalJob *a_job)
+{
+    /* the new base has to be on disk before a journal points at it,
+       and the new journal before the old base goes. a crash at any
+       point leaves a journal and the base it replays onto */
+    bool ok = a_job->m_file->write_snapshot();
+    delete a_job->m_file;
+
+    if (!ok) {
+        /* keep appending to the old journal, it still replays onto
+           the old base */
+        fprintf(stderr, "Error writing journal base\n");
+        return;
+    }
+
+    std::string temp = m_path + ".tmp";
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+    if (fd < 0 || !write_all(fd, a_job->m_bytes) ||
+        rename(temp.c_str(), m_path.c_str()) < 0)
+    {
+        fprintf(stderr, "Error writing journal %s\n", m_path.c_str());
+        if (fd >= 0)
+            close(fd);
+        unlink(temp.c_str());
+        return;
+    }
+
+    if (m_fd >= 0)
+        close(m_fd);
+
+    /* the renamed file is opened for appending from here on */
+    m_fd = fd;
+    lseek(m_fd, 0, SEEK_END);
+
+    unlink(a_job->m_old_base.c_str());
+}
+
+
+void
+MidiJournal::write_func ()
+{
+    m_condition.lock();
+
+    while (true)
+    {
+        while (m_jobs.empty() && !m_exit)
+            m_condition.wait();
+
+        /* whatever was queued is written before we go */
+        if (m_jobs.empty())
+            break;
+
+        MidiJournalJob job;
+        job.m_bytes.swap(m_jobs.front().m_bytes);
+        job.m_file = m_jobs.front().m_file;
+        job.m_old_base = m_jobs.front().m_old_base;
+        m_jobs.pop_front();
+
+        m_condition.unlock();
+
+        if (job.m_file != NULL)
+            compact(&job);
+        else
+            append(job.m_bytes);
+
+        m_condition.lock();
+    }
+
+    m_condition.unlock();
+}
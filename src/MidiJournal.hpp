@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Globals.hpp"
+#include "Mutex.hpp"
+
+#include <list>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <QString>
+
+class MidiPerformance;
+class MidiFile;
+
+/* GUI timer ticks between appends, about a second */
+const int c_journal_interval = 50;
+
+/* bytes appended before the journal is folded into a new base */
+const unsigned long c_journal_compact_size = 1024 * 1024;
+
+/* what a journal record holds */
+enum journal_record_e
+{
+    e_journal_start    = 1, //generation of the base and the file name
+    e_journal_sequence = 2, //a whole MTrk body, empty when deleted
+    e_journal_bpm      = 3
+};
+
+/* a batch of records for the writer thread, or with m_file set
+   a compaction: write m_file as the new base, then start a new
+   journal holding m_bytes and remove m_old_base */
+struct MidiJournalJob
+{
+    std::vector<unsigned char> m_bytes;
+    MidiFile *m_file;
+    std::string m_old_base;
+};
+
+///
+/// \brief The MidiJournal class
+///
+/// Append only record of the edits made since the performance was
+/// last written out, so a crash loses at most a second of work.
+/// The GUI marks the sequences that changed, every so often the
+/// changed ones are encoded as whole MTrk bodies and a thread of
+/// our own appends them. Once the journal grows past
+/// c_journal_compact_size the performance is written as a new base
+/// file and the journal starts over. Recovery loads the base and
+/// replays the journal onto it
+
+class MidiJournal
+{
+
+private:
+
+    /* the journal, the base it replays onto is
+       m_path.<generation>.midi */
+    std::string m_path;
+    unsigned long m_generation;
+
+    /* writer thread */
+    pthread_t m_thread;
+    bool m_running;
+    bool m_exit;
+    int m_fd;
+
+    /* guards m_jobs and m_exit, signalled when either changes */
+    condition_var m_condition;
+    std::list<MidiJournalJob> m_jobs;
+
+    /* GUI thread: what was last journaled for each sequence */
+    bool m_dirty[c_max_sequence];
+    unsigned long m_hash[c_max_sequence];
+    unsigned long m_length[c_max_sequence];
+    int m_bpm;
+
+    QString m_name;
+    unsigned long m_size;
+    int m_countdown;
+    std::vector<unsigned char> m_scratch;
+
+    std::string base_path( unsigned long a_generation );
+
+    bool read_journal( std::vector<unsigned char> *a_data );
+    void encode_sequence( MidiPerformance *a_perf, int a_seq );
+    void queue( MidiJournalJob *a_job );
+
+    bool write_all( int a_fd, const std::vector<unsigned char> &a_bytes );
+    void append( const std::vector<unsigned char> &a_bytes );
+    void compact( MidiJournalJob *a_job );
+
+public:
+
+    MidiJournal( const QString &a_path );
+    ~MidiJournal();
+
+    /* true when the journal holds changes from a session that
+       didn't shut down, a_name is the file they were made to */
+    bool can_recover( QString *a_name );
+
+    /* loads the base into a_perf and replays the journal onto it */
+    bool recover( MidiPerformance *a_perf );
+
+    /* starts the writer thread and a journal of a_perf as it is */
+    bool start( MidiPerformance *a_perf, const QString &a_name );
+
+    /* a_perf was just loaded or saved as a_name, folds everything
+       so far into a new base */
+    void reset( MidiPerformance *a_perf, const QString &a_name );
+
+    /* GUI thread, a_seq changed since the last append */
+    void mark( int a_seq );
+
+    /* GUI thread, called from its timer. every c_journal_interval
+       calls the marked sequences that really changed are appended */
+    void flush( MidiPerformance *a_perf );
+
+    /* clean shutdown, stops the thread and removes the journal so
+       there's nothing to recover next time */
+    void discard();
+
+    /* the body of the writer thread */
+    void write_func();
+
+};
@@ -1,5 +1,6 @@
 #include "MidiPerformance.hpp"
 #include "MidiBus.hpp"
+#include "MidiFile.hpp"
 #include "MidiEvent.hpp"
 #include <stdio.h>
 #ifndef __WIN32__
@@ -7,16 +8,97 @@
 #endif
 #include <sched.h>
 
+MidiControlTable::MidiControlTable()
+{
+    for ( int k = 0; k <= c_control_keys; k++ )
+        m_first[k] = 0;
+}
+
+
+void MidiControlTable::build( const MidiControl *a_toggle,
+                              const MidiControl *a_on,
+                              const MidiControl *a_off )
+{
+    const MidiControl *tables[3] = { a_toggle, a_on, a_off };
+
+    m_bindings.clear();
+
+    for ( int k = 0; k <= c_control_keys; k++ )
+        m_first[k] = 0;
+
+    /* count the bindings per key, offset by one so the
+       running sum below leaves each key's start in place */
+    for ( int i = 0; i < c_midi_controls; i++ ){
+        for ( int t = 0; t < 3; t++ ){
+
+            const MidiControl &control = tables[t][i];
+
+            if ( !control.m_active ||
+                 control.m_status < 0 || control.m_status > 255 ||
+                 control.m_data < 0 || control.m_data > 127 )
+                continue;
+
+            m_first[control.m_status * 128 + control.m_data + 1]++;
+        }
+    }
+
+    for ( int k = 0; k < c_control_keys; k++ )
+        m_first[k + 1] += m_first[k];
+
+    m_bindings.resize( m_first[c_control_keys] );
+
+    /* fill in control order so each key keeps the order
+       the old linear scan dispatched in */
+    vector<unsigned short> next( m_first, m_first + c_control_keys );
+
+    for ( int i = 0; i < c_midi_controls; i++ ){
+        for ( int t = 0; t < 3; t++ ){
+
+            const MidiControl &control = tables[t][i];
+
+            if ( !control.m_active ||
+                 control.m_status < 0 || control.m_status > 255 ||
+                 control.m_data < 0 || control.m_data > 127 )
+                continue;
+
+            MidiControlBinding &binding =
+                m_bindings[next[control.m_status * 128 + control.m_data]++];
+
+            binding.m_control = i;
+            binding.m_type = t;
+            binding.m_midi_control = control;
+        }
+    }
+}
+
+
+const MidiControlBinding *MidiControlTable::lookup( unsigned char a_status,
+                                                    unsigned char a_data,
+                                                    int *a_count ) const
+{
+    *a_count = 0;
+
+    if ( a_data > 127 )
+        return NULL;
+
+    int key = a_status * 128 + a_data;
+
+    *a_count = m_first[key + 1] - m_first[key];
+    if ( *a_count == 0 )
+        return NULL;
+
+    return &m_bindings[m_first[key]];
+}
+
+
 MidiPerformance::MidiPerformance()
 {
     for (int i = 0; i < c_max_sequence; i++)
     {
         m_seqs[i]             = NULL;
         m_seqs_active[i]      = false;
-        m_was_active_main[i]  = false;
-        m_was_active_edit[i]  = false;
-        m_was_active_perf[i]  = false;
-        m_was_active_names[i] = false;
+        m_standby[i]          = NULL;
+        m_retired[i]          = NULL;
         mSequenceColours[i]   = White;
         mEditModes[i]         = NOTE;
     }
@@ -29,6 +111,18 @@ MidiPerformance::MidiPerformance()
     m_inputing = true;
     m_outputing = true;
     m_tick = 0;
+    m_anchor_tick = 0.0;
+    m_anchor_us = 0;
+    m_state_version = 0;
+    m_standby_ready = false;
+    m_standby_bpm = 0;
+    m_retired_ready = false;
+    m_swapping = false;
+    m_swap_queued = false;
+    m_swap_bar = c_ppqn * 4;
+    m_reposition_tick = -1;
+    m_next_song_requested = false;
+    m_lazy_file = NULL;
     m_midiclockrunning = false;
     m_usemidiclock = false;
     m_midiclocktick = 0;
@@ -49,6 +143,9 @@ MidiPerformance::MidiPerformance()
         m_midi_cc_off[i] = zero;
     }
 
+    m_control_table = &m_control_tables[0];
+    m_control_reader = NULL;
+
     //map default keyboard mappings
     //(falls back to these if preferences file is missing)
     set_key_event( Qt::Key_1, 0 );
@@ -259,6 +356,11 @@ void MidiPerformance::deinit_jack()
 
 void MidiPerformance::clear_all()
 {
+    set_lazy_file( NULL );
+
+    /* a song still waiting to swap in belongs to what is cleared */
+    drop_standby();
+
     reset_sequences();
 
     for (int i=0; i< c_max_sequence; i++ ){
@@ -405,6 +507,7 @@ MidiPerformance::~MidiPerformance()
     m_running = false;
 
     m_condition_var.signal();
+    m_master_bus.wake_input();
 
     if (m_out_thread_launched )
         pthread_join( m_out_thread, NULL );
@@ -416,7 +519,11 @@ MidiPerformance::~MidiPerformance()
         if ( is_active(i) ){
             delete m_seqs[i];
         }
+        delete m_standby[i];
+        delete m_retired[i];
     }
+
+    delete m_lazy_file;
 }
 
 
@@ -428,6 +535,8 @@ void MidiPerformance::set_left_tick( long a_tick )
     if ( m_left_tick >= m_right_tick )
         m_right_tick = m_left_tick + c_ppqn * 4;
 
+    m_changes.push( c_change_perf, e_change_markers );
+
 }
 
 
@@ -459,6 +568,8 @@ void MidiPerformance::set_right_tick( long a_tick )
             m_left_tick = m_right_tick - c_ppqn * 4;
             m_starting_tick = m_left_tick;
         }
+
+        m_changes.push( c_change_perf, e_change_markers );
     }
 }
 
@@ -471,9 +582,10 @@ long MidiPerformance::get_right_tick()
 
 void MidiPerformance::add_sequence(MidiSequence *a_seq, int a_perf )
 {
-    /* check for perferred */
+    /* check for perferred, slots still to be loaded are taken */
     if ( a_perf < c_max_sequence &&
          is_active(a_perf) == false &&
+         is_lazy(a_perf) == false &&
          a_perf >= 0 ){
 
         m_seqs[a_perf] = a_seq;
@@ -484,7 +596,7 @@ void MidiPerformance::add_sequence(MidiSequence *a_seq, int a_perf )
 
         for (int i=a_perf; i< c_max_sequence; i++ ){
 
-            if ( is_active(i) == false ){
+            if ( is_active(i) == false && is_lazy(i) == false ){
 
                 m_seqs[i] = a_seq;
                 set_active(i,true);
@@ -504,28 +616,21 @@ void MidiPerformance::set_active( int a_sequence, bool a_active )
 
     printf ("set_active %d\n", a_active );
 
-    if ( m_seqs_active[ a_sequence ] == true && a_active == false )
+    if ( m_seqs[ a_sequence ] != NULL )
     {
-        set_was_active(a_sequence);
+        if ( a_active )
+            m_seqs[ a_sequence ]->set_change_queue( &m_changes, a_sequence );
+        else
+            m_seqs[ a_sequence ]->set_change_queue( NULL, -1 );
     }
 
+    if ( m_seqs_active[ a_sequence ] != a_active )
+        m_changes.push( a_sequence, e_change_active );
+
     m_seqs_active[ a_sequence ] = a_active;
 }
 
 
-void MidiPerformance::set_was_active( int a_sequence )
-{
-    if ( a_sequence < 0 || a_sequence >= c_max_sequence )
-        return;
-
-    printf( "was_active true\n" );
-
-    m_was_active_main[ a_sequence ] = true;
-    m_was_active_edit[ a_sequence ] = true;
-    m_was_active_perf[ a_sequence ] = true;
-    m_was_active_names[ a_sequence ] = true;
-}
-
 bool MidiPerformance::is_active( int a_sequence )
 {
     if ( a_sequence < 0 || a_sequence >= c_max_sequence )
@@ -534,68 +639,194 @@ bool MidiPerformance::is_active( int a_sequence )
     return m_seqs_active[ a_sequence ];
 }
 
-bool MidiPerformance::is_dirty_main (int a_sequence)
+ChangeQueue *MidiPerformance::get_change_queue()
 {
-    if ( a_sequence < 0 || a_sequence >= c_max_sequence )
-        return false;
+    return &m_changes;
+}
+
+void MidiPerformance::publish_state()
+{
+    TransportState state;
+
+    state.m_tick = m_tick;
+    state.m_bpm = m_master_bus.get_bpm();
+    state.m_running = m_running;
 
-    if (is_active(a_sequence))
+    if ( m_running ){
+        state.m_tick_exact = m_anchor_tick;
+        state.m_anchor_us = m_anchor_us;
+    }
+    else {
+        state.m_tick_exact = m_tick;
+        state.m_anchor_us = 0;
+    }
+
+    for (int i = 0; i < c_max_sequence; i++)
     {
-        return m_seqs[a_sequence]->is_dirty_main();
+        if (is_active(i))
+        {
+            TransportState::set(state.m_playing, i, m_seqs[i]->get_playing());
+            TransportState::set(state.m_queued, i, m_seqs[i]->get_queued());
+            TransportState::set(state.m_oneshot, i, m_seqs[i]->getOneshot());
+            TransportState::set(state.m_off_from_snap, i, m_seqs[i]->getOffFromSnap());
+        }
     }
 
-    bool was_active = m_was_active_main[ a_sequence ];
-    m_was_active_main[ a_sequence ] = false;
+    m_state_version++;
+    __sync_synchronize();
+
+    m_state = state;
 
-    return was_active;
+    __sync_synchronize();
+    m_state_version++;
 }
 
-bool MidiPerformance::is_dirty_edit (int a_sequence)
+void MidiPerformance::get_transport_state(TransportState *a_state)
 {
-    if ( a_sequence < 0 || a_sequence >= c_max_sequence )
-        return false;
+    unsigned int version;
 
-    if ( is_active(a_sequence) )
+    /* retry if a write was in progress or finished while copying */
+    do
     {
-        return m_seqs[a_sequence]->is_dirty_edit();
-    }
+        version = m_state_version;
+        __sync_synchronize();
 
-    bool was_active = m_was_active_edit[ a_sequence ];
-    m_was_active_edit[ a_sequence ] = false;
+        *a_state = m_state;
 
-    return was_active;
+        __sync_synchronize();
+    }
+    while ((version & 1) || version != m_state_version);
 }
 
-bool MidiPerformance::is_dirty_perf (int a_sequence)
+void MidiPerformance::post_command( int a_command, int a_arg, int a_value )
 {
-    if ( a_sequence < 0 || a_sequence >= c_max_sequence )
-        return false;
+    if ( !m_commands.push( a_command, a_arg, a_value )){
+        printf( "command queue full, dropping command %d\n", a_command );
+        return;
+    }
 
-    if ( is_active(a_sequence) )
-    {
-        return m_seqs[a_sequence]->is_dirty_perf();
+    /* the output thread sleeps on the condition while stopped. it
+       drains the queue before each wait, so holding the lock here
+       means it either sees our command or gets our signal */
+    if ( !m_running ){
+        m_condition_var.lock();
+        m_condition_var.signal();
+        m_condition_var.unlock();
     }
+}
+
+void MidiPerformance::apply_commands()
+{
+    PerfCommand command;
+    bool applied = false;
+
+    while ( m_commands.pop( &command )){
+
+        switch ( command.m_command ){
+
+        case e_command_toggle:
+            sequence_playing_toggle( command.m_arg );
+            break;
+
+        case e_command_playing_on:
+            sequence_playing_on( command.m_arg );
+            break;
+
+        case e_command_playing_off:
+            sequence_playing_off( command.m_arg );
+            break;
+
+        case e_command_bpm:
+            set_bpm( command.m_arg );
+            break;
+
+        case e_command_status_on:
+            set_sequence_control_status( command.m_arg );
+            break;
+
+        case e_command_status_off:
+            unset_sequence_control_status( command.m_arg );
+            break;
+
+        case e_command_control:
+            handle_midi_control( command.m_arg, command.m_value );
+            break;
+
+        case e_command_merge_input:
+            for ( int i = 0; i < c_max_sequence; i++ )
+                if ( is_active(i) )
+                    m_seqs[i]->merge_input();
+            break;
+
+        case e_command_swap_standby:
+            if ( !m_standby_ready )
+                break;
+
+            /* stopped, there's no bar to wait for */
+            if ( m_running ){
+                m_swap_queued = true;
+                m_swap_bar = command.m_arg > 0 ? command.m_arg : c_ppqn * 4;
+            }
+            else
+                swap_standby( m_tick );
+            break;
+
+        case e_command_set_playing:
+            if ( is_active( command.m_arg ))
+                m_seqs[command.m_arg]->set_playing( command.m_value );
+            break;
+
+        case e_command_screen_set:
+            setBank( command.m_arg );
+            break;
+
+        case e_command_offset:
+            set_offset( command.m_arg );
+            break;
+
+        case e_command_start:
+            inner_start();
+            break;
+
+        case e_command_stop:
+            inner_stop();
+            break;
+
+        case e_command_midi_clock_start:
+            midi_clock_start( command.m_value );
+            break;
+
+        case e_command_publish:
+            break;
+        }
 
-    bool was_active = m_was_active_perf[ a_sequence ];
-    m_was_active_perf[ a_sequence ] = false;
+        applied = true;
+    }
 
-    return was_active;
+    /* while running play() publishes at the end of the cycle */
+    if ( applied && !m_running )
+        publish_state();
 }
 
-bool MidiPerformance::is_dirty_names (int a_sequence)
+long MidiPerformance::get_input_tick( long a_time_us )
 {
-    if ( a_sequence < 0 || a_sequence >= c_max_sequence )
-        return false;
+    TransportState state;
+    get_transport_state( &state );
 
-    if ( is_active(a_sequence) )
-    {
-        return m_seqs[a_sequence]->is_dirty_names();
-    }
+    /* stopped, or following an external clock we can't extrapolate */
+    if ( state.m_anchor_us == 0 || m_usemidiclock )
+        return state.m_tick;
 
-    bool was_active = m_was_active_names[ a_sequence ];
-    m_was_active_names[ a_sequence ] = false;
+    double ticks_per_us =
+        (double) state.m_bpm * m_master_bus.get_ppqn() / 60000000.0;
 
-    return was_active;
+    double tick = state.m_tick_exact +
+        (double) (a_time_us - state.m_anchor_us) * ticks_per_us;
+
+    if ( tick < 0.0 )
+        tick = 0.0;
+
+    return (long) (tick + 0.5);
 }
 
 MidiSequence *MidiPerformance::get_sequence(int MidiSequence )
@@ -641,6 +872,7 @@ void MidiPerformance::setResumeNoteOns(bool value)
 void MidiPerformance::set_running( bool a_running )
 {
     m_running = a_running;
+    m_changes.push( c_change_perf, e_change_state );
 }
 
 int MidiPerformance::getEditorKeyboardHeight() const
@@ -671,6 +903,7 @@ void MidiPerformance::set_bpm(int a_bpm)
 
     if ( ! (m_jack_running && m_running )){
         m_master_bus.set_bpm( a_bpm );
+        m_changes.push( c_change_perf, e_change_state );
     }
 }
 
@@ -700,6 +933,191 @@ bool MidiPerformance::is_sequence_in_edit( int a_num )
 
 }
 
+bool MidiPerformance::swap_standby( long a_tick )
+{
+    m_swap_queued = false;
+
+    /* drop_standby() may have taken the sequences back */
+    m_swapping = true;
+    if ( !__sync_bool_compare_and_swap( &m_standby_ready, true, false )){
+        m_swapping = false;
+        return false;
+    }
+
+    /* in song mode the triggers of the new song are laid out from
+       its own start, not from where the old one got to */
+    long start = m_playback_mode ? 0 : a_tick;
+
+    for ( int i = 0; i < c_max_sequence; i++ ){
+
+        if ( is_active(i) ){
+
+            /* play out what's left before the bar, then the note
+               offs for whatever is still sounding */
+            if ( m_running )
+                m_seqs[i]->play( a_tick - 1, m_playback_mode, mResumeNoteOns );
+
+            m_seqs[i]->set_playing( false );
+            set_active( i, false );
+
+            /* freeing is for the GUI, not this thread */
+            m_retired[i] = m_seqs[i];
+        }
+
+        m_seqs[i] = m_standby[i];
+        m_standby[i] = NULL;
+
+        if ( m_seqs[i] != NULL ){
+            m_seqs[i]->set_orig_tick( start );
+            set_active( i, true );
+        }
+    }
+
+    /* the tempo changes with the first tick of the new song, not a
+       GUI timer later */
+    if ( m_standby_bpm > 0 )
+        set_bpm( m_standby_bpm );
+
+    m_master_bus.flush();
+
+    __sync_synchronize();
+    m_retired_ready = true;
+    m_swapping = false;
+
+    m_changes.push( c_change_perf, e_change_active | e_change_state );
+
+    return true;
+}
+
+
+bool MidiPerformance::set_standby( MidiSequence **a_seqs, int a_bpm )
+{
+    if ( m_standby_ready || m_retired_ready || m_swapping )
+        return false;
+
+    for ( int i = 0; i < c_max_sequence; i++ )
+        m_standby[i] = a_seqs[i];
+
+    m_standby_bpm = a_bpm;
+
+    /* the slots have to be there before the flag */
+    __sync_synchronize();
+    m_standby_ready = true;
+
+    return true;
+}
+
+
+bool MidiPerformance::retired_ready()
+{
+    return m_retired_ready;
+}
+
+
+void MidiPerformance::free_retired()
+{
+    for ( int i = 0; i < c_max_sequence; i++ ){
+
+        /* like delete_sequence(), one open in the editor stays */
+        if ( m_retired[i] != NULL && !m_retired[i]->get_editing() )
+            delete m_retired[i];
+
+        m_retired[i] = NULL;
+    }
+
+    __sync_synchronize();
+    m_retired_ready = false;
+}
+
+
+void MidiPerformance::drop_standby()
+{
+    if ( __sync_bool_compare_and_swap( &m_standby_ready, true, false )){
+
+        /* the output thread won't swap them in now, so they are ours */
+        for ( int i = 0; i < c_max_sequence; i++ ){
+            delete m_standby[i];
+            m_standby[i] = NULL;
+        }
+    }
+
+    /* the swap took them, it only has a few sequences to play out */
+    while ( m_swapping )
+        sched_yield();
+
+    if ( m_retired_ready )
+        free_retired();
+}
+
+
+bool MidiPerformance::take_next_song_request()
+{
+    if ( !m_next_song_requested )
+        return false;
+
+    m_next_song_requested = false;
+    return true;
+}
+
+
+void MidiPerformance::set_lazy_file( MidiFile *a_file )
+{
+    if ( m_lazy_file == a_file )
+        return;
+
+    delete m_lazy_file;
+    m_lazy_file = a_file;
+}
+
+
+bool MidiPerformance::is_lazy( int a_sequence )
+{
+    return m_lazy_file != NULL && m_lazy_file->is_lazy( a_sequence );
+}
+
+
+void MidiPerformance::load_bank( int a_bank )
+{
+    if ( m_lazy_file != NULL )
+        m_lazy_file->load_bank( this, a_bank );
+}
+
+
+void MidiPerformance::load_banks()
+{
+    if ( m_lazy_file == NULL )
+        return;
+
+    m_lazy_file->finish_prefetch( this, false );
+
+    m_lazy_file->load_bank( this, m_screen_set );
+    m_lazy_file->load_bank( this, m_playing_screen );
+
+    /* the banks either side are the likeliest next, one at a time */
+    int up = (m_screen_set + 1) % c_max_num_banks;
+    int down = (m_screen_set + c_max_num_banks - 1) % c_max_num_banks;
+
+    if ( m_lazy_file->prefetch( this, up ))
+        m_lazy_file->prefetch( this, down );
+
+    /* the file is no use once it's all loaded */
+    if ( !m_lazy_file->has_lazy() )
+        set_lazy_file( NULL );
+}
+
+
+void MidiPerformance::load_all_banks()
+{
+    if ( m_lazy_file == NULL )
+        return;
+
+    for ( int i = 0; i < c_max_num_banks; i++ )
+        m_lazy_file->load_bank( this, i );
+
+    set_lazy_file( NULL );
+}
+
+
 void MidiPerformance::new_sequence( int a_sequence )
 {
     m_seqs[ a_sequence ] = new MidiSequence();
@@ -733,6 +1151,26 @@ MidiControl* MidiPerformance::get_midi_control_off( unsigned int a_seq )
 }
 
 
+void MidiPerformance::rebuild_midi_control_table()
+{
+    MidiControlTable *table = &m_control_tables[0];
+    if ( m_control_table == table )
+        table = &m_control_tables[1];
+
+    /* the last rebuild may have been moments ago, with the input
+       thread still going through the table it swapped out */
+    __sync_synchronize();
+    while ( m_control_reader == table )
+        sched_yield();
+
+    table->build( m_midi_cc_toggle, m_midi_cc_on, m_midi_cc_off );
+
+    /* the table must be complete before the input thread sees it */
+    __sync_synchronize();
+    m_control_table = table;
+}
+
+
 void MidiPerformance::print()
 {
     //   for( int i=0; i<m_numSeq; i++ ){
@@ -805,6 +1243,25 @@ void MidiPerformance::set_offset( int a_offset )
 void MidiPerformance::play( long a_tick )
 {
 
+    /* the next song starts on the first bar line we cross */
+    if ( m_swap_queued && a_tick / m_swap_bar != m_tick / m_swap_bar ){
+
+        long over = a_tick % m_swap_bar;
+
+        /* in song mode it starts over from the top, so what we got
+           past the bar line is played from there instead, and the
+           output loop carries on from it next cycle */
+        if ( swap_standby( a_tick - over ) && m_playback_mode ){
+
+            a_tick = over;
+
+            if ( m_jack_running )
+                position_jack( over );
+            else
+                m_reposition_tick = over;
+        }
+    }
+
     /* just run down the list of sequences and have them dump */
 
     m_tick = a_tick;
@@ -816,6 +1273,9 @@ void MidiPerformance::play( long a_tick )
 
             assert(m_seqs[i]);
 
+            //recorded input lands before we play the sequence
+            m_seqs[i]->merge_input();
+
             //check for queue
             if (m_seqs[i]->get_queued() &&
                     m_seqs[i]->get_queued_tick() <= a_tick){
@@ -846,6 +1306,9 @@ void MidiPerformance::play( long a_tick )
 
     /* flush the bus */
     m_master_bus.flush();
+
+    publish_state();
+    m_changes.push( c_change_perf, e_change_tick );
 }
 
 
@@ -1037,7 +1500,7 @@ void MidiPerformance::start()
         return;
     }
 
-    inner_start();
+    post_command(e_command_start, 0);
 }
 
 
@@ -1047,7 +1510,7 @@ void MidiPerformance::stop()
         return;
     }
 
-    inner_stop();
+    post_command(e_command_stop, 0);
 }
 
 
@@ -1077,6 +1540,29 @@ void MidiPerformance::inner_stop()
 }
 
 
+/* an external MIDI start or continue, output thread only. the clock
+   flags go last so the restart can't clear them again */
+void MidiPerformance::midi_clock_start( bool a_continue )
+{
+    if ( !a_continue && !m_jack_running )
+        inner_stop();
+
+    set_playback_mode(false);
+
+    if ( !m_jack_running )
+        inner_start();
+
+    m_midiclockrunning = true;
+
+    /* continue picks up where it stopped */
+    if ( !a_continue ){
+        m_usemidiclock = true;
+        m_midiclocktick = 0;
+        m_midiclockpos = 0;
+    }
+}
+
+
 void MidiPerformance::off_sequences()
 {
     for (int i = 0; i < c_max_sequence; i++) {
@@ -1342,6 +1828,13 @@ void MidiPerformance::output_func()
 
         while (!m_running) {
 
+            /* commands posted while stopped signal us */
+            apply_commands();
+
+            /* one of them may have been a start */
+            if (m_running)
+                break;
+
             m_condition_var.wait();
 
             /* if stopping, then kill thread */
@@ -1441,6 +1934,14 @@ void MidiPerformance::output_func()
 
         while( m_running ){
 
+            /* state changes posted since the last cycle land here,
+               before anything is played */
+            apply_commands();
+
+            /* a stop among them, nothing more is played */
+            if (!m_running)
+                break;
+
             /************************************
 
               Get delta time ( current - last )
@@ -1497,6 +1998,14 @@ void MidiPerformance::output_func()
                 //init_clock = true;
             }
 
+            /* a swap in song mode started the next song over */
+            if (0 <= m_reposition_tick) {
+                clock_tick     = m_reposition_tick;
+                current_tick   = m_reposition_tick;
+                total_tick     = m_reposition_tick;
+                m_reposition_tick = -1;
+            }
+
             //printf ( "    delta_tick[%lf]\n", delta_tick  );
 #ifdef JACK_SUPPORT
 
@@ -1675,6 +2184,15 @@ void MidiPerformance::output_func()
                     }
                 }
 
+                /* anchor for stamping input, see get_input_tick() */
+#ifndef __WIN32__
+                m_anchor_us = (current.tv_sec * 1000000) + (current.tv_nsec / 1000);
+#else
+                m_anchor_us = current * 1000;
+#endif
+                m_anchor_tick = current_tick +
+                    (double) delta_tick_frac / delta_tick_denom;
+
                 /* play */
                 play( (long) current_tick );
                 //                printf( "play[%d]\n", current_tick );
@@ -1846,6 +2364,8 @@ void MidiPerformance::output_func()
         }
 
         m_tick = 0;
+        publish_state();
+        m_changes.push( c_change_perf, e_change_tick );
         m_master_bus.flush();
         m_master_bus.stop();
     }
@@ -1966,6 +2486,11 @@ void MidiPerformance::handle_midi_control( int a_control, bool a_state )
         setPlayingBank();
         break;
 
+    case c_midi_control_next_song:
+        //the setlist lives in the GUI
+        m_next_song_requested = true;
+        break;
+
     default:
         if ((a_control >= cSeqsInBank) && (a_control < c_midi_track_ctrl)) {
             //printf ( "group mute\n" );
@@ -1978,7 +2503,11 @@ void MidiPerformance::handle_midi_control( int a_control, bool a_state )
 
 void MidiPerformance::input_func()
 {
-    MidiEvent ev;
+    /* thru latency, arrival to hand off to alsa */
+    long stats_thru_count = 0;
+    long stats_thru_min = 0x7FFFFFFF;
+    long stats_thru_max = 0;
+    long stats_thru_total = 0;
 
     while (m_inputing) {
 
@@ -1986,26 +2515,35 @@ void MidiPerformance::input_func()
 
             do {
 
-                if (m_master_bus.get_midi_event(&ev) ){
+                /* drain whatever alsa has buffered in one go,
+                   then act on the whole batch */
+                int count = m_master_bus.get_midi_events( m_input_events,
+                                                          c_midibus_input_batch );
+                bool recorded = false;
+
+                /* stamp the batch with its arrival time now,
+                   not with the last cycle's tick */
+#ifndef __WIN32__
+                struct timespec arrival;
+                clock_gettime(CLOCK_REALTIME, &arrival);
+                long arrival_us = (arrival.tv_sec * 1000000) + (arrival.tv_nsec / 1000);
+#else
+                long arrival_us = timeGetTime() * 1000;
+#endif
+
+                for ( int e = 0; e < count; e++ ){
+
+                    MidiEvent &ev = m_input_events[e];
 
                     // Obey MidiTimeClock:
                     if (ev.get_status() == EVENT_MIDI_START)
                     {
-                        stop();
-                        set_playback_mode(false);
-                        start();
-                        m_midiclockrunning = true;
-                        m_usemidiclock = true;
-                        m_midiclocktick = 0;
-                        m_midiclockpos = 0;
+                        post_command(e_command_midi_clock_start, 0, false);
                     }
                     // midi continue: start from current pos.
                     else if (ev.get_status() == EVENT_MIDI_CONTINUE)
                     {
-                        m_midiclockrunning = true;
-                        set_playback_mode(false);
-                        start();
-                        //m_usemidiclock = true;
+                        post_command(e_command_midi_clock_start, 0, true);
                     }
                     else if (ev.get_status() == EVENT_MIDI_STOP)
                     {
@@ -2038,82 +2576,129 @@ void MidiPerformance::input_func()
                         /* is there a sequence set ? */
                         if (m_master_bus.is_dumping()) {
 
-                            ev.set_timestamp(m_tick);
+                            MidiSequence *seq = m_master_bus.get_sequence();
+
+                            /* thru first, straight to the sequence's bus
+                               and channel without touching its state */
+                            if (seq->get_thru() &&
+                                m_master_bus.thru(seq->get_midi_bus(), &ev,
+                                                  seq->get_midi_channel()) &&
+                                global_stats) {
+
+#ifndef __WIN32__
+                                struct timespec sent;
+                                clock_gettime(CLOCK_REALTIME, &sent);
+                                long sent_us = (sent.tv_sec * 1000000) + (sent.tv_nsec / 1000);
+#else
+                                long sent_us = timeGetTime() * 1000;
+#endif
+                                long latency_us = sent_us - arrival_us;
+
+                                if ( latency_us < stats_thru_min )
+                                    stats_thru_min = latency_us;
+                                if ( latency_us > stats_thru_max )
+                                    stats_thru_max = latency_us;
+                                stats_thru_total += latency_us;
+
+                                if ( ++stats_thru_count >= 200 ){
+
+                                    printf("thru_avg[%ld]us thru_min[%ld]us"
+                                           " thru_max[%ld]us\n",
+                                           stats_thru_total / stats_thru_count,
+                                           stats_thru_min, stats_thru_max);
 
+                                    stats_thru_count = 0;
+                                    stats_thru_min = 0x7FFFFFFF;
+                                    stats_thru_max = 0;
+                                    stats_thru_total = 0;
+                                }
+                            }
+
+                            ev.set_timestamp(get_input_tick(arrival_us));
 
-                            /* dump to it */
-                            (m_master_bus.get_sequence())->stream_event(&ev);
+                            /* dump to it, the output thread merges it */
+                            if (!seq->push_input(&ev))
+                                printf("input ring full, dropped recorded event\n");
+
+                            recorded = true;
 
                         }
 
                         /* use it to control our sequencer */
                         else {
 
-                            for (int i = 0; i < c_midi_controls; i++) {
+                            unsigned char data[2] = {0,0};
+                            unsigned char status = ev.get_status();
 
-                                unsigned char data[2] = {0,0};
-                                unsigned char status = ev.get_status();
+                            ev.get_data( &data[0], &data[1] );
 
-                                ev.get_data( &data[0], &data[1] );
+                            /* claim the table, then check it's still
+                               current so a rebuild can't have missed
+                               the claim */
+                            MidiControlTable *table;
+                            do {
+                                table = m_control_table;
+                                m_control_reader = table;
+                                __sync_synchronize();
+                            } while ( table != m_control_table );
 
-                                if (get_midi_control_toggle(i)->m_active &&
-                                        status  == get_midi_control_toggle(i)->m_status &&
-                                        data[0] == get_midi_control_toggle(i)->m_data ){
+                            int count;
+                            const MidiControlBinding *binding =
+                                table->lookup( status, data[0], &count );
 
-                                    if (data[1] >= get_midi_control_toggle(i)->m_min_value &&
-                                            data[1] <= get_midi_control_toggle(i)->m_max_value ){
+                            for ( ; count > 0; count--, binding++ ) {
 
-                                        if ( i <  cSeqsInBank )
-                                            sequence_playing_toggle( i + m_offset );
-                                    }
-                                }
+                                int i = binding->m_control;
+                                const MidiControl &control = binding->m_midi_control;
+
+                                bool in_range = data[1] >= control.m_min_value &&
+                                                data[1] <= control.m_max_value;
+
+                                switch (binding->m_type) {
 
-                                if ( get_midi_control_on(i)->m_active &&
-                                     status  == get_midi_control_on(i)->m_status &&
-                                     data[0] == get_midi_control_on(i)->m_data ){
+                                case e_control_toggle:
+                                    if ( in_range && i < cSeqsInBank )
+                                        post_command( e_command_toggle, i + m_offset );
+                                    break;
 
-                                    if ( data[1] >= get_midi_control_on(i)->m_min_value &&
-                                         data[1] <= get_midi_control_on(i)->m_max_value ){
+                                case e_control_on:
+                                    if ( in_range ){
 
                                         if ( i <  cSeqsInBank )
-                                            sequence_playing_on( i  + m_offset);
+                                            post_command( e_command_playing_on, i + m_offset );
                                         else
-                                            handle_midi_control( i, true );
+                                            post_command( e_command_control, i, true );
 
-                                    } else if (  get_midi_control_on(i)->m_inverse_active ){
+                                    } else if ( control.m_inverse_active ){
 
                                         if ( i <  cSeqsInBank )
-                                            sequence_playing_off(  i + m_offset );
+                                            post_command( e_command_playing_off, i + m_offset );
                                         else
-                                            handle_midi_control( i, false );
+                                            post_command( e_command_control, i, false );
                                     }
+                                    break;
 
-                                }
-
-                                if ( get_midi_control_off(i)->m_active &&
-                                     status  == get_midi_control_off(i)->m_status &&
-                                     data[0] == get_midi_control_off(i)->m_data ){
-
-                                    if ( data[1] >= get_midi_control_off(i)->m_min_value &&
-                                         data[1] <= get_midi_control_off(i)->m_max_value ){
+                                case e_control_off:
+                                    if ( in_range ){
 
                                         if ( i <  cSeqsInBank )
-                                            sequence_playing_off(  i + m_offset );
+                                            post_command( e_command_playing_off, i + m_offset );
                                         else
-                                            handle_midi_control( i, false );
+                                            post_command( e_command_control, i, false );
 
-                                    } else if ( get_midi_control_off(i)->m_inverse_active ){
+                                    } else if ( control.m_inverse_active ){
 
                                         if ( i <  cSeqsInBank )
-                                            sequence_playing_on(  i + m_offset );
+                                            post_command( e_command_playing_on, i + m_offset );
                                         else
-                                            handle_midi_control( i, true );
-
+                                            post_command( e_command_control, i, true );
                                     }
-
+                                    break;
                                 }
-
                             }
+
+                            __sync_synchronize();
+                            m_control_reader = NULL;
                         }
 
                     }
@@ -2128,6 +2713,11 @@ void MidiPerformance::input_func()
                     }
                 }
 
+                /* a running output thread merges every cycle,
+                   a stopped one has to be woken for step recording */
+                if ( recorded && !m_running )
+                    post_command( e_command_merge_input, 0 );
+
             } while (m_master_bus.is_more_input());
         }
     }
@@ -2357,6 +2947,7 @@ void MidiPerformance::setSequenceColour(int seqId,
                                         thumb_colours_e newColour)
 {
     mSequenceColours[seqId] = newColour;
+    m_changes.push(seqId, e_change_state);
 }
 
 thumb_colours_e MidiPerformance::getSequenceColour(int seqId)
@@ -1,12 +1,15 @@
 #pragma once
 
 class MidiPerformance;
+class MidiFile;
 
 #include "Globals.hpp"
 #include "MidiEvent.hpp"
 #include "MidiBus.hpp"
 #include "MidiFile.hpp"
 #include "MidiSequence.hpp"
+#include "ChangeQueue.hpp"
+#include "CommandQueue.hpp"
 
 #ifndef __WIN32__
 #   include <unistd.h>
@@ -38,6 +41,55 @@ public:
     long m_max_value;
 };
 
+/* which of the three control tables a binding came from */
+enum midi_control_type_e
+{
+    e_control_toggle,
+    e_control_on,
+    e_control_off
+};
+
+struct MidiControlBinding
+{
+    int m_control; //index into the control tables
+    int m_type;    //midi_control_type_e
+    MidiControl m_midi_control;
+};
+
+/* one entry per status byte and first data byte */
+const int c_control_keys = 256 * 128;
+
+///
+/// \brief The MidiControlTable class
+///
+/// The active MIDI control bindings grouped by the status and
+/// first data byte they respond to, so an incoming event finds
+/// its bindings with one lookup instead of scanning every control
+
+class MidiControlTable
+{
+private:
+
+    /* bindings ordered by key, then control, then type */
+    vector<MidiControlBinding> m_bindings;
+
+    /* the bindings of key k are m_first[k] up to m_first[k + 1] */
+    unsigned short m_first[c_control_keys + 1];
+
+public:
+
+    MidiControlTable();
+
+    void build( const MidiControl *a_toggle,
+                const MidiControl *a_on,
+                const MidiControl *a_off );
+
+    /* returns the first binding, sets a_count to how many follow */
+    const MidiControlBinding *lookup( unsigned char a_status,
+                                      unsigned char a_data,
+                                      int *a_count ) const;
+};
+
 
 const int c_status_replace  = 0x01;
 const int c_status_snapshot = 0x02;
@@ -58,8 +110,71 @@ const int c_midi_control_mod_gmute    = c_midi_track_ctrl + 7;
 const int c_midi_control_mod_glearn   = c_midi_track_ctrl + 8;
 //andy play only this screen set
 const int c_midi_control_play_ss      = c_midi_track_ctrl + 9;
-const int c_midi_controls             = c_midi_track_ctrl + 10;//7
+const int c_midi_control_next_song    = c_midi_track_ctrl + 10;
+const int c_midi_controls             = c_midi_track_ctrl + 11;//7
+
+
+const int c_state_words = (c_max_sequence + 31) / 32;
+
+///
+/// \brief The TransportState class
+///
+/// A copy of the transport position and of which sequences are
+/// playing, published by the performance so the GUI can read it
+/// without locking anything the output thread needs
+
+class TransportState
+{
+public:
+
+    long m_tick;
+    int m_bpm;
+    bool m_running;
+
+    /* the output thread's exact position at the start of its last
+       cycle and the realtime clock (us) when it was there. the
+       clock is 0 while stopped */
+    double m_tick_exact;
+    long m_anchor_us;
+
+    /* one bit per sequence */
+    unsigned int m_playing [ c_state_words ];
+    unsigned int m_queued [ c_state_words ];
+    unsigned int m_oneshot [ c_state_words ];
+    unsigned int m_off_from_snap [ c_state_words ];
+
+    TransportState()
+    {
+        m_tick = 0;
+        m_bpm = c_bpm;
+        m_running = false;
+        m_tick_exact = 0.0;
+        m_anchor_us = 0;
+
+        for ( int i = 0; i < c_state_words; i++ )
+            m_playing[i] = m_queued[i] = m_oneshot[i] = m_off_from_snap[i] = 0;
+    }
+
+    bool is_playing( int a_seq ) const { return test( m_playing, a_seq ); }
+    bool is_queued( int a_seq ) const { return test( m_queued, a_seq ); }
+    bool is_oneshot( int a_seq ) const { return test( m_oneshot, a_seq ); }
+    bool is_off_from_snap( int a_seq ) const { return test( m_off_from_snap, a_seq ); }
+
+    static void set( unsigned int *a_bits, int a_seq, bool a_state )
+    {
+        if ( a_state )
+            a_bits[a_seq / 32] |= 1u << (a_seq % 32);
+        else
+            a_bits[a_seq / 32] &= ~(1u << (a_seq % 32));
+    }
+
+private:
 
+    static bool test( const unsigned int *a_bits, int a_seq )
+    {
+        return (a_bits[a_seq / 32] >> (a_seq % 32)) & 1u;
+    }
+};
 
 struct performcallback
 {
@@ -99,15 +214,51 @@ private:
     /* holds whether each sequence is active */
     bool m_seqs_active      [ c_max_sequence ];
 
-    bool m_was_active_main  [ c_max_sequence ];
-    bool m_was_active_edit  [ c_max_sequence ];
-    bool m_was_active_perf  [ c_max_sequence ];
-    bool m_was_active_names [ c_max_sequence ];
+    /* the next song's sequences by slot, handed over by the GUI
+       and swapped in by the output thread at a bar. what they
+       replaced waits in m_retired for the GUI to free */
+    MidiSequence *m_standby [ c_max_sequence ];
+    MidiSequence *m_retired [ c_max_sequence ];
+
+    /* the tempo the next song starts at, set with the bar it
+       swaps in at, 0 to keep playing at this one */
+    int m_standby_bpm;
+    volatile bool m_standby_ready;
+    volatile bool m_retired_ready;
+
+    /* set by the output thread before it claims m_standby_ready for
+       a swap, cleared once the swap is done */
+    volatile bool m_swapping;
+
+    /* output thread only, the swap is waiting for a bar of this
+       many ticks to start */
+    bool m_swap_queued;
+    long m_swap_bar;
+
+    /* output thread only, where the output loop carries on from
+       after a swap in song mode started the new song over, or -1 */
+    long m_reposition_tick;
+
+    /* the next song control came in, for the GUI to act on */
+    volatile bool m_next_song_requested;
+
+    /* the file the banks not decoded yet are still in, GUI thread */
+    MidiFile *m_lazy_file;
+
     bool m_sequence_state   [ c_max_sequence ];
 
     /* our midibus */
     MasterMidiBus m_master_bus;
 
+    /* changes for the GUI, from any of our threads */
+    ChangeQueue m_changes;
+
+    /* commands for the output thread, from the GUI and input threads */
+    CommandQueue m_commands;
+
+    /* filled by the input thread from each batch of alsa input */
+    MidiEvent m_input_events[c_midibus_input_batch];
+
     /* pthread info */
     pthread_t m_out_thread;
     pthread_t m_in_thread;
@@ -138,6 +289,12 @@ private:
     long m_starting_tick;
 
     long m_tick;
+
+    /* where the output thread was at the start of its current cycle,
+       in fractional ticks, and the realtime clock (us) at that point */
+    double m_anchor_tick;
+    long m_anchor_us;
+
     bool m_usemidiclock;
     bool m_midiclockrunning; // stopped or started
     int  m_midiclocktick;
@@ -151,6 +308,15 @@ private:
     MidiControl m_midi_cc_on[ c_midi_controls];
     MidiControl m_midi_cc_off[ c_midi_controls];
 
+    /* the input thread reads m_control_table while a rebuild fills
+       the other table, then the pointer is swapped. m_control_reader
+       is the table the input thread is dispatching from, if any, and
+       a rebuild waits for it to be off the table about to be filled.
+       only the GUI thread rebuilds */
+    MidiControlTable m_control_tables[2];
+    MidiControlTable * volatile m_control_table;
+    MidiControlTable * volatile m_control_reader;
+
     int m_offset;
     int m_control_status; //TODO replace with enum
     int m_screen_set;
@@ -159,6 +325,12 @@ private:
 
     condition_var m_condition_var;
 
+    /* the published transport state, written under a seqlock: the
+       version is odd while a write is in progress. only the output
+       thread writes it, readers never lock */
+    TransportState m_state;
+    volatile unsigned int m_state_version;
+
     // do not access these directly, use set/lookup below
     std::map<int,long> key_events;
     std::map<int,long> key_groups;
@@ -193,6 +365,16 @@ private:
     void inner_start();
     void inner_stop();
 
+    /* restarts, or continues, following an external MIDI clock */
+    void midi_clock_start( bool a_continue );
+
+    /* output thread, runs everything posted since the last cycle */
+    void apply_commands();
+
+    /* output thread, the old song ends at a_tick. false if
+       drop_standby() took the new one back first */
+    bool swap_standby( long a_tick );
+
 public:
     bool is_running();
     bool is_learn_mode() const { return m_mode_group_learn; }
@@ -261,6 +443,18 @@ public:
 
     long get_tick( ) { return m_tick; }
 
+    /* output thread. snapshot the transport and sequence states for
+       the GUI, every cycle while running and after applying commands
+       while stopped. anyone else posts e_command_publish */
+    void publish_state();
+
+    /* lock free copy of the last published state */
+    void get_transport_state( TransportState *a_state );
+
+    /* the tick playing at realtime clock a_time_us, extrapolated
+       from the last cycle with the current tempo */
+    long get_input_tick( long a_time_us );
+
     void set_left_tick( long a_tick );
     long get_left_tick();
 
@@ -290,6 +484,9 @@ public:
 
     void handle_midi_control( int a_control, bool a_state );
 
+    /* call after changing anything behind get_midi_control_*() */
+    void rebuild_midi_control_table();
+
     void setBankName( int bankNum, string *a_note );
     string *getBankName( int bank_num );
 
@@ -320,18 +517,47 @@ public:
     void all_notes_off();
 
     void set_active(int a_sequence, bool a_active);
-    void set_was_active( int a_sequence );
 
     //returns if this a valid sequence ID
     bool is_active(int a_sequence);
 
-    bool is_dirty_main (int a_sequence);
-    bool is_dirty_edit (int a_sequence);
-    bool is_dirty_perf (int a_sequence);
-    bool is_dirty_names (int a_sequence);
+    //changes waiting to be shown by the GUI
+    ChangeQueue *get_change_queue();
+
+    /* queue a command_e for the output thread to apply at the start
+       of its next cycle, waking it if the transport is stopped */
+    void post_command( int a_command, int a_arg, int a_value = 0 );
 
     void new_sequence( int a_sequence );
 
+    /* GUI thread. hands over the sequences of the next song by
+       slot, and its bpm or 0 to keep the tempo, false while an
+       earlier one hasn't been swapped in and freed yet. posting
+       e_command_swap_standby swaps them in */
+    bool set_standby( MidiSequence **a_seqs, int a_bpm = 0 );
+
+    /* GUI thread. true once a swap has left the old sequences in
+       m_retired, free_retired() deletes them */
+    bool retired_ready();
+    void free_retired();
+
+    /* GUI thread. takes back sequences handed to set_standby() so
+       they are never swapped in, or if a swap got there first waits
+       for it and frees what it replaced */
+    void drop_standby();
+
+    /* GUI thread. true once for each press of the next song control */
+    bool take_next_song_request();
+
+    /* GUI thread. takes a_file, which MidiFile::parse_lazy() left
+       some banks in. they are decoded as the selected or playing
+       bank, with the ones either side prefetched, by load_banks() */
+    void set_lazy_file( MidiFile *a_file );
+    bool is_lazy( int a_sequence );
+    void load_bank( int a_bank );
+    void load_banks();
+    void load_all_banks();
+
     /* plays all notes to current tick */
     void play( long a_tick );
 
@@ -429,6 +655,7 @@ public:
     }
 
     friend class MidiFile;
+    friend class MidiJournal;
     friend class PreferencesFile;
     friend class PreferencesDialog;
 
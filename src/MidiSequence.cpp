@@ -1,12 +1,42 @@
 /* contains sequence and trigger classes */
 
 #include "MidiSequence.hpp"
-#include "EditFrame.hpp"
 #include <stdlib.h>
+#include <algorithm>
 
 list < MidiEvent > MidiSequence::m_list_clipboard;
 
+/* used to binary search the indexes by time */
+static bool
+event_before_tick( MidiEvent *a_e, long a_tick )
+{
+    return a_e->get_timestamp() < a_tick;
+}
+
+/* puts found notes back into event list order */
+static bool
+note_event_before( MidiEvent *a_lhs, MidiEvent *a_rhs )
+{
+    return *a_lhs < *a_rhs;
+}
+
+/* controllers get a lane each, everything else one per status */
+static int
+lane_key( unsigned char a_status, unsigned char a_cc )
+{
+    if ( a_status == EVENT_CONTROL_CHANGE )
+        return (a_status << 8) | a_cc;
+
+    return a_status << 8;
+}
+
+/* removals beyond this rebuild the lane index instead */
+static const int c_lane_index_removals = 64;
+
 MidiSequence::MidiSequence( ) :
+    m_note_index_dirty(true),
+    m_lane_index_dirty(true),
+
     m_midi_channel(0),
     m_bus(0),
 
@@ -24,10 +54,11 @@ MidiSequence::MidiSequence( ) :
 
     m_trigger_copied(false),
 
-    m_dirty_main(true),
-    m_dirty_edit(true),
-    m_dirty_perf(true),
-    m_dirty_names(true),
+    m_input_ring(NULL),
+
+    m_changes(NULL),
+    m_change_id(-1),
+    m_edit_generation(0),
 
     m_song_playback_block(false),
     m_song_recording(false),
@@ -52,8 +83,10 @@ MidiSequence::MidiSequence( ) :
     mSongRecordingSnap(0)
 {
     /* no notes are playing */
-    for (int i = 0; i < c_midi_notes; i++ )
+    for (int i = 0; i < c_midi_notes; i++ ){
         m_playing_notes[i] = 0;
+        m_note_index_span[i] = 0;
+    }
 }
 
 void
@@ -74,6 +107,7 @@ MidiSequence::pop_undo()
         m_list_redo.push( m_list_event );
         m_list_event = m_list_undo.top();
         m_list_undo.pop();
+        invalidate_indexes();
         verify_and_link();
         unselect();
     }
@@ -90,6 +124,7 @@ MidiSequence::pop_redo()
         m_list_undo.push( m_list_event );
         m_list_event = m_list_redo.top();
         m_list_redo.pop();
+        invalidate_indexes();
         verify_and_link();
         unselect();
     }
@@ -128,6 +163,7 @@ MidiSequence::pop_trigger_undo()
         m_list_trigger_undo.pop();
     }
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -144,6 +180,7 @@ MidiSequence::pop_trigger_redo()
         m_list_trigger_redo.pop();
     }
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -161,6 +198,7 @@ void
 MidiSequence::set_song_mute( bool a_mute )
 {
     m_song_mute = a_mute;
+    set_dirty_mp();
 }
 
 bool
@@ -247,7 +285,34 @@ void MidiSequence::song_recording_stop(long currentTick)
 
 MidiSequence::~MidiSequence()
 {
+    delete m_input_ring;
+}
+
+void
+MidiSequence::append_event( const MidiEvent *a_e )
+{
+    lock();
+
+    /* front, like add_event, so equal events keep its order */
+    m_list_event.push_front( *a_e );
+    invalidate_indexes();
+
+    unlock();
+}
+
+void
+MidiSequence::sort_events( )
+{
+    lock();
+
+    m_list_event.sort( );
+    invalidate_indexes();
+
+    reset_draw_marker();
+
+    set_dirty();
 
+    unlock();
 }
 
 void
@@ -256,7 +321,12 @@ MidiSequence::add_event( const MidiEvent *a_e )
     lock();
 
     m_list_event.push_front( *a_e );
+
+    /* sorting moves no nodes, so the new one is still where it
+       was pushed */
+    MidiEvent *added = &m_list_event.front();
     m_list_event.sort( );
+    index_add( added );
 
     reset_draw_marker();
 
@@ -524,6 +594,12 @@ MidiSequence::verify_and_link()
 
     lock();
 
+    /* every edit ends up here, so this is also where the
+       views get told the contents changed. the notes are all
+       paired up again, the lanes keep up on their own */
+    m_note_index_dirty = true;
+    set_dirty();
+
     for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
         (*i).clear_link();
         (*i).unmark();
@@ -618,6 +694,8 @@ MidiSequence::link_new( )
 
     lock();
 
+    m_note_index_dirty = true;
+
     on = m_list_event.begin();
 
     /* pair ons and offs */
@@ -689,7 +767,9 @@ MidiSequence::remove(list<MidiEvent>::iterator i)
         m_masterbus->play( m_bus, &(*i), m_midi_channel );
         m_playing_notes[(*i).get_note()]--;
     }
+    index_remove( &(*i) );
     m_list_event.erase(i);
+    set_dirty();
 }
 
 // helper function, does not lock/unlock, unsafe to call without them
@@ -718,6 +798,16 @@ MidiSequence::remove_marked()
 
     lock();
 
+    /* past a few, starting the lanes over beats taking each
+       event out of them one at a time */
+    int marked = 0;
+    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
+        if ((*i).is_marked())
+            marked++;
+    }
+    if ( marked > c_lane_index_removals )
+        m_lane_index_dirty = true;
+
     i = m_list_event.begin();
     while( i != m_list_event.end() ){
 
@@ -927,23 +1017,16 @@ MidiSequence::get_num_selected_events( unsigned char a_status,
                                        unsigned char a_cc )
 {
     int ret = 0;
-    list<MidiEvent>::iterator i;
 
     lock();
 
-    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
-
-        if( (*i).get_status()    == a_status ){
+    vector<MidiEvent*> *lane = get_lane( a_status, a_cc );
+    if ( lane != NULL ){
 
-            unsigned char d0,d1;
-            (*i).get_data( &d0, &d1 );
-
-            if ( (a_status == EVENT_CONTROL_CHANGE && d0 == a_cc )
-                 || (a_status != EVENT_CONTROL_CHANGE) ){
+        for ( unsigned n = 0; n < lane->size(); n++ ){
 
-                if ( (*i).is_selected( ))
-                    ret++;
-            }
+            if ( (*lane)[n]->is_selected( ))
+                ret++;
         }
     }
 
@@ -961,175 +1044,139 @@ MidiSequence::select_note_events( long a_tick_s, int a_note_h,
 {
     int ret = 0;
 
-    long tick_s = 0;
-    long tick_f = 0;
+    vector<MidiEvent*> found;
 
-    list<MidiEvent>::iterator i;
+    bool onsets = (a_action == e_select_onset ||
+                   a_action == e_select_onset_single ||
+                   a_action == e_is_selected_onset);
 
     lock();
 
-    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ) {
+    /* only the notes under the window come back from the index */
+    find_notes( a_tick_s, a_tick_f, a_note_l, a_note_h, onsets, &found );
+
+    for ( unsigned n = 0; n < found.size(); n++ ) {
+
+        MidiEvent *e = found[n];
 
-        //if the note is between the highest & lowest
-        if( (*i).get_note()      <= a_note_h &&
-                (*i).get_note()      >= a_note_l )
+        if ( e->is_linked() )
         {
-            if ( (*i).is_linked() )
+            MidiEvent *ev = e->get_linked();
+
+            if (a_action == e_select ||
+                    a_action == e_select_single ||
+                    a_action == e_select_onset ||
+                    a_action == e_select_onset_single)
             {
-                //expand notes out to their on/offsets,
-                //but not if we're only doing onset detection
-                MidiEvent *ev = (*i).get_linked();
+                e->select();
+                ev->select();
+                ret++;
 
-                if (a_action == e_select_onset ||
-                        a_action == e_select_onset_single ||
-                        a_action == e_is_selected_onset)
+                //selecting just one? we're done here
+                if (a_action == e_select_single ||
+                        a_action == e_select_onset_single)
+                    break;
+            }
+            if (a_action == e_is_selected ||
+                    a_action == e_is_selected_onset)
+            {
+                if ( e->is_selected())
+                {
+                    ret = 1;
+                    break;
+                }
+            }
+            if ( a_action == e_would_select )
+            {
+                ret = 1;
+                break;
+            }
+            if ( a_action == e_deselect )
+            {
+                ret = 0;
+                e->unselect( );
+                ev->unselect();
+            }
+            if ( a_action == e_toggle_selection )
+            {
+                if (e->is_selected())
                 {
-                    tick_s = tick_f = (*i).get_timestamp();
+                    e->unselect( );
+                    ev->unselect();
+                    ret ++;
                 }
                 else
                 {
-
-                    if ( (*i).is_note_off() )
-                    {
-                        tick_s = ev->get_timestamp();
-                        tick_f = (*i).get_timestamp();
-                    }
-
-                    if ( (*i).is_note_on() )
-                    {
-                        tick_f = ev->get_timestamp();
-                        tick_s = (*i).get_timestamp();
-                    }
+                    e->select();
+                    ev->select();
+                    ret ++;
                 }
-
-                if (((tick_s <= tick_f) && ((tick_s <= a_tick_f)
-                                            && (tick_f >= a_tick_s))) ||
-                        ((tick_s > tick_f) && ((tick_s <= a_tick_f)
-                                               || (tick_f >= a_tick_s))))
+            }
+            if ( a_action == e_remove_one )
+            {
+                remove( e );
+                remove( ev );
+                reset_draw_marker();
+                ret++;
+                break;
+            }
+        }
+        else
+        {
+            if ( a_action == e_select || a_action == e_select_single )
+            {
+                e->select( );
+                ret++;
+                if ( a_action == e_select_single )
+                    break;
+            }
+            if ( a_action == e_is_selected )
+            {
+                if ( e->is_selected())
                 {
-                    if (a_action == e_select ||
-                            a_action == e_select_single ||
-                            a_action == e_select_onset ||
-                            a_action == e_select_onset_single)
-                    {
-                        //if we're selecting onsets, this event
-                        //must be a note_on
-                        if ((a_action != e_select_onset &&
-                             a_action != e_select_onset_single) ||
-                                (*i).is_note_on())
-                        {
-                            (*i).select();
-                            ev->select();
-                            ret++;
-
-                            //selecting just one? we're done here
-                            if (a_action == e_select_single ||
-                                    a_action == e_select_onset_single)
-                                break;
-                        }
-                    }
-                    if (a_action == e_is_selected ||
-                            a_action == e_is_selected_onset)
-                    {
-                        if ( (*i).is_selected())
-                        {
-                            ret = 1;
-                            break;
-                        }
-                    }
-                    if ( a_action == e_would_select )
-                    {
-                        ret = 1;
-                        break;
-                    }
-                    if ( a_action == e_deselect )
-                    {
-                        ret = 0;
-                        (*i).unselect( );
-                        ev->unselect();
-                        //break;
-                    }
-                    if ( a_action == e_toggle_selection &&
-                         (*i).is_note_on()) // don't toggle twice
-                    {
-                        if ((*i).is_selected())
-                        {
-                            (*i).unselect( );
-                            ev->unselect();
-                            ret ++;
-                        }
-                        else
-                        {
-                            (*i).select();
-                            ev->select();
-                            ret ++;
-                        }
-                    }
-                    if ( a_action == e_remove_one )
-                    {
-                        remove( &(*i) );
-                        remove( ev );
-                        reset_draw_marker();
-                        ret++;
-                        break;
-                    }
+                    ret = 1;
+                    break;
                 }
             }
-            else
+            if ( a_action == e_would_select )
+            {
+                ret = 1;
+                break;
+            }
+            if ( a_action == e_deselect )
+            {
+                ret = 0;
+                e->unselect();
+            }
+            if ( a_action == e_toggle_selection )
             {
-                tick_s = tick_f = (*i).get_timestamp();
-                if ( tick_s  >= a_tick_s - 16 && tick_f <= a_tick_f)
+                if (e->is_selected())
                 {
-                    if ( a_action == e_select || a_action == e_select_single )
-                    {
-                        (*i).select( );
-                        ret++;
-                        if ( a_action == e_select_single )
-                            break;
-                    }
-                    if ( a_action == e_is_selected )
-                    {
-                        if ( (*i).is_selected())
-                        {
-                            ret = 1;
-                            break;
-                        }
-                    }
-                    if ( a_action == e_would_select )
-                    {
-                        ret = 1;
-                        break;
-                    }
-                    if ( a_action == e_deselect )
-                    {
-                        ret = 0;
-                        (*i).unselect();
-                    }
-                    if ( a_action == e_toggle_selection )
-                    {
-                        if ((*i).is_selected())
-                        {
-                            (*i).unselect();
-                            ret ++;
-                        }
-                        else
-                        {
-                            (*i).select();
-                            ret ++;
-                        }
-                    }
-                    if ( a_action == e_remove_one )
-                    {
-                        remove( &(*i) );
-                        reset_draw_marker();
-                        ret++;
-                        break;
-                    }
+                    e->unselect();
+                    ret ++;
+                }
+                else
+                {
+                    e->select();
+                    ret ++;
                 }
             }
+            if ( a_action == e_remove_one )
+            {
+                remove( e );
+                reset_draw_marker();
+                ret++;
+                break;
+            }
         }
     }
 
+    /* queries don't change anything the views draw */
+    if ( a_action != e_would_select &&
+         a_action != e_is_selected &&
+         a_action != e_is_selected_onset )
+        set_dirty();
+
     unlock();
 
     return ret;
@@ -1143,70 +1190,73 @@ MidiSequence::select_events( long a_tick_s, long a_tick_f,
                              unsigned char a_cc, select_action_e a_action)
 {
     int ret=0;
-    list<MidiEvent>::iterator i;
 
     lock();
 
-    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
-
-        if( (*i).get_status()    == a_status &&
-                (*i).get_timestamp() >= a_tick_s &&
-                (*i).get_timestamp() <= a_tick_f ){
-
-            unsigned char d0,d1;
-            (*i).get_data( &d0, &d1 );
+    vector<MidiEvent*> *lane = get_lane( a_status, a_cc );
+    if ( lane == NULL ){
+        unlock();
+        return 0;
+    }
 
-            if ( (a_status == EVENT_CONTROL_CHANGE &&
-                  d0 == a_cc )
-                 || (a_status != EVENT_CONTROL_CHANGE) ){
+    vector<MidiEvent*>::iterator i =
+            lower_bound( lane->begin(), lane->end(),
+                         a_tick_s, event_before_tick );
 
+    for ( ; i != lane->end() &&
+          (*i)->get_timestamp() <= a_tick_f; i++ ){
 
-                if ( a_action == e_select ||
-                     a_action == e_select_single )
-                {
-                    (*i).select( );
-                    ret++;
-                    if ( a_action == e_select_single )
-                        break;
-                }
-                if ( a_action == e_is_selected )
-                {
-                    if ( (*i).is_selected())
-                    {
-                        ret = 1;
-                        break;
-                    }
-                }
-                if ( a_action == e_would_select )
-                {
-                    ret = 1;
-                    break;
-                }
-                if ( a_action == e_toggle_selection )
-                {
-                    if ( (*i).is_selected())
-                    {
-                        (*i).unselect( );
-                    }
-                    else
-                    {
-                        (*i).select( );
-                    }
-                }
-                if ( a_action == e_deselect )
-                {
-                    (*i).unselect( );
-                }
-                if ( a_action == e_remove_one )
-                {
-                    remove( &(*i) );
-                    reset_draw_marker();
-                    ret++;
-                    break;
-                }
+        if ( a_action == e_select ||
+             a_action == e_select_single )
+        {
+            (*i)->select( );
+            ret++;
+            if ( a_action == e_select_single )
+                break;
+        }
+        if ( a_action == e_is_selected )
+        {
+            if ( (*i)->is_selected())
+            {
+                ret = 1;
+                break;
             }
         }
+        if ( a_action == e_would_select )
+        {
+            ret = 1;
+            break;
+        }
+        if ( a_action == e_toggle_selection )
+        {
+            if ( (*i)->is_selected())
+            {
+                (*i)->unselect( );
+            }
+            else
+            {
+                (*i)->select( );
+            }
+        }
+        if ( a_action == e_deselect )
+        {
+            (*i)->unselect( );
+        }
+        if ( a_action == e_remove_one )
+        {
+            remove( *i );
+            reset_draw_marker();
+            ret++;
+            break;
+        }
     }
+
+    /* queries don't change anything the views draw */
+    if ( a_action != e_would_select &&
+         a_action != e_is_selected &&
+         a_action != e_is_selected_onset )
+        set_dirty();
+
     unlock();
 
     return ret;
@@ -1224,6 +1274,8 @@ MidiSequence::select_all()
     for ( i = m_list_event.begin(); i != m_list_event.end(); i++ )
         (*i).select( );
 
+    set_dirty();
+
     unlock();
 }
 
@@ -1238,6 +1290,8 @@ MidiSequence::unselect()
     for ( i = m_list_event.begin(); i != m_list_event.end(); i++ )
         (*i).unselect();
 
+    set_dirty();
+
     unlock();
 }
 
@@ -1511,6 +1565,8 @@ MidiSequence::increment_selected( unsigned char a_status, unsigned char a_contro
         }
     }
 
+    set_dirty();
+
     unlock();
 }
 
@@ -1545,6 +1601,8 @@ MidiSequence::decrement_selected(unsigned char a_status, unsigned char a_control
         }
     }
 
+    set_dirty();
+
     unlock();
 }
 
@@ -1606,6 +1664,7 @@ MidiSequence::paste_selected( long a_tick, int a_note )
 
     m_list_event.merge( clipboard );
     m_list_event.sort();
+    invalidate_indexes();
 
     verify_and_link();
 
@@ -1624,47 +1683,39 @@ void MidiSequence::change_event_data_range( long a_tick_s, long a_tick_f,
     lock();
 
     unsigned char d0, d1;
-    list<MidiEvent>::iterator i;
 
     /* change only selected events, if any */
     bool have_selection = false;
     if( get_num_selected_events(a_status, a_cc) )
         have_selection = true;
 
-    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
+    vector<MidiEvent*> *lane = get_lane( a_status, a_cc );
+    if ( lane == NULL ){
+        unlock();
+        return;
+    }
 
-        /* initially false */
-        bool set = false;
-        (*i).get_data( &d0, &d1 );
+    /* only walk the lane between the two ticks */
+    long tick_end = a_tick_f;
 
-        /* correct status and not CC */
-        if ( a_status != EVENT_CONTROL_CHANGE &&
-             (*i).get_status() == a_status )
-            set = true;
+    /* no divide by 0 */
+    if( a_tick_f == a_tick_s )
+        a_tick_f = a_tick_s + 1;
 
-        /* correct status and correct cc */
-        if ( a_status == EVENT_CONTROL_CHANGE &&
-             (*i).get_status() == a_status &&
-             d0 == a_cc )
-            set = true;
+    vector<MidiEvent*>::iterator i =
+            lower_bound( lane->begin(), lane->end(),
+                         a_tick_s, event_before_tick );
 
-        /* in range? */
-        if ( !((*i).get_timestamp() >= a_tick_s &&
-               (*i).get_timestamp() <= a_tick_f ))
-            set = false;
+    for ( ; i != lane->end() &&
+          (*i)->get_timestamp() <= tick_end; i++ ){
 
-        /* in selection? */
-        if ( have_selection && (!(*i).is_selected()) )
-            set = false;
+        (*i)->get_data( &d0, &d1 );
 
-        if ( set ){
+        /* in selection? */
+        if ( !have_selection || (*i)->is_selected() ){
 
             //float weight;
 
-            /* no divide by 0 */
-            if( a_tick_f == a_tick_s )
-                a_tick_f = a_tick_s + 1;
-
             /* ratio of v1 to v2 */
             /*
                                                weight =
@@ -1676,7 +1727,7 @@ void MidiSequence::change_event_data_range( long a_tick_s, long a_tick_f,
                                                ((1.0f - weight) * (float) a_data_s ));
                                                */
 
-            int tick = (*i).get_timestamp();
+            int tick = (*i)->get_timestamp();
 
             //printf("ticks: %d %d %d\n", a_tick_s, tick, a_tick_f);
             //printf("datas: %d %d\n", a_data_s, a_data_f);
@@ -1708,10 +1759,12 @@ void MidiSequence::change_event_data_range( long a_tick_s, long a_tick_f,
             if ( a_status == EVENT_PITCH_WHEEL )
                 d1 = newdata;
 
-            (*i).set_data( d0, d1 );
+            (*i)->set_data( d0, d1 );
         }
     }
 
+    set_dirty();
+
     unlock();
 }
 
@@ -1722,52 +1775,43 @@ void MidiSequence::change_event_data_relative(long a_tick_s, long a_tick_f,
     lock();
 
     unsigned char d0, d1;
-    list<MidiEvent>::iterator i;
 
     /* change only selected events, if any */
     bool have_selection = false;
     if( get_num_selected_events(a_status, a_cc) )
         have_selection = true;
 
-    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
+    vector<MidiEvent*> *lane = get_lane( a_status, a_cc );
+    if ( lane == NULL ){
+        unlock();
+        return;
+    }
 
-        /* initially false */
-        bool set = false;
-        (*i).get_data( &d0, &d1 );
+    vector<MidiEvent*>::iterator i = lane->begin();
 
-        /* correct status and not CC */
-        if ( a_status != EVENT_CONTROL_CHANGE &&
-             (*i).get_status() == a_status )
-            set = true;
+    /* without a selection only the events between the
+       ticks are touched */
+    if ( !have_selection )
+        i = lower_bound( lane->begin(), lane->end(),
+                         a_tick_s, event_before_tick );
 
-        /* correct status and correct cc */
-        if ( a_status == EVENT_CONTROL_CHANGE &&
-             (*i).get_status() == a_status &&
-             d0 == a_cc )
-            set = true;
+    for ( ; i != lane->end(); i++ ){
 
-        /* in range? */
-        if ( !((*i).get_timestamp() >= a_tick_s &&
-               (*i).get_timestamp() <= a_tick_f ))
-            set = false;
+        bool set = true;
+        (*i)->get_data( &d0, &d1 );
 
-        /* in selection? */
-        if (have_selection)
-        {
-            if (!(*i).is_selected())
+        if ( have_selection ){
+
+            //always operate on selected events
+            if (!(*i)->is_selected())
                 set = false;
-            else //always operate on selected events
-                set = true;
+        }
+        else if ( (*i)->get_timestamp() > a_tick_f ){
+            break;
         }
 
         if ( set )
         {
-            //prevent divide by zero
-            if( a_tick_f == a_tick_s )
-                a_tick_f = a_tick_s + 1;
-
-            int tick = (*i).get_timestamp();
-
             //scale data by our parameter
             int newdata = d1 + newVal;
 
@@ -1797,10 +1841,12 @@ void MidiSequence::change_event_data_relative(long a_tick_s, long a_tick_f,
             if ( a_status == EVENT_PITCH_WHEEL )
                 d1 = newdata;
 
-            (*i).set_data( d0, d1 );
+            (*i)->set_data( d0, d1 );
         }
     }
 
+    set_dirty();
+
     unlock();
 }
 
@@ -1957,11 +2003,6 @@ MidiSequence::stream_event(  MidiEvent *a_ev  )
         }
     }
 
-    if ( m_thru )
-    {
-        put_event_on_bus( a_ev );
-    }
-
     link_new();
 
     if ( m_quanized_rec && is_pattern_playing){
@@ -1978,69 +2019,76 @@ MidiSequence::stream_event(  MidiEvent *a_ev  )
 
 
 void
-MidiSequence::set_dirty_mp()
+MidiSequence::prepare_input( )
 {
-    //printf( "set_dirtymp\n" );
-    m_dirty_names =  m_dirty_main =  m_dirty_perf = true;
+    if ( m_input_ring == NULL )
+        m_input_ring = new EventRing();
 }
 
 
-void
-MidiSequence::set_dirty()
+bool
+MidiSequence::push_input( MidiEvent *a_ev )
 {
-    //printf( "set_dirty\n" );
-    m_dirty_names = m_dirty_main =  m_dirty_perf = m_dirty_edit = true;
+    if ( !m_recording || m_input_ring == NULL )
+        return true;
+
+    return m_input_ring->push( a_ev );
 }
 
 
-bool
-MidiSequence::is_dirty_names( )
+void
+MidiSequence::merge_input( )
 {
-    lock();
-
-    bool ret = m_dirty_names;
-    m_dirty_names = false;
+    if ( m_input_ring == NULL || m_input_ring->is_empty() )
+        return;
 
-    unlock();
-
-    return ret;
-}
+    MidiEvent ev;
 
-bool
-MidiSequence::is_dirty_main( )
-{
     lock();
 
-    bool ret = m_dirty_main;
-    m_dirty_main = false;
+    while ( m_input_ring->pop( &ev ))
+        stream_event( &ev );
 
     unlock();
-
-    return ret;
 }
 
 
-bool
-MidiSequence::is_dirty_perf( )
+void
+MidiSequence::set_change_queue( ChangeQueue *a_changes, int a_id )
 {
-    lock();
-
-    bool ret = m_dirty_perf;
-    m_dirty_perf = false;
+    m_changes = a_changes;
+    m_change_id = a_id;
+}
 
-    unlock();
+void
+MidiSequence::notify( int a_changes )
+{
+    if ( m_changes != NULL )
+        m_changes->push( m_change_id, a_changes );
+}
 
-    return ret;
+void
+MidiSequence::set_dirty_mp()
+{
+    //printf( "set_dirtymp\n" );
+    notify( e_change_state );
 }
 
 
-bool
-MidiSequence::is_dirty_edit( )
+void
+MidiSequence::set_dirty()
+{
+    //printf( "set_dirty\n" );
+    m_edit_generation++;
+    notify( e_change_events );
+}
+
+unsigned long
+MidiSequence::get_edit_generation()
 {
     lock();
 
-    bool ret = m_dirty_edit;
-    m_dirty_edit = false;
+    unsigned long ret = m_edit_generation;
 
     unlock();
 
@@ -2089,6 +2137,8 @@ MidiSequence::clear_triggers()
 {
     lock();
     m_list_trigger.clear();
+
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2167,6 +2217,7 @@ MidiSequence::add_trigger( long a_tick, long a_length, long a_offset, bool a_adj
     m_list_trigger.push_front( e );
     m_list_trigger.sort();
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2285,6 +2336,7 @@ MidiSequence::grow_trigger (long a_tick_from, long a_tick_to, long a_length)
         ++i;
     }
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2306,6 +2358,7 @@ MidiSequence::del_trigger( long a_tick )
         ++i;
     }
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2342,6 +2395,7 @@ MidiSequence::split_trigger( MidiTrigger &trig, long a_split_tick)
     if ( length > 1 )
         add_trigger( new_tick_start, length + 1, trig.m_offset );
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2402,6 +2456,7 @@ MidiSequence::adjust_trigger_offsets_to_legnth( long a_new_len )
         ++i;
     }
 
+    notify( e_change_triggers );
     unlock();
 
 }
@@ -2498,6 +2553,7 @@ MidiSequence::copy_triggers( long a_start_tick,
 
     m_list_trigger.sort();
 
+    notify( e_change_triggers );
     unlock();
 
 }
@@ -2528,6 +2584,8 @@ MidiSequence::half_split_trigger( long a_tick )
         }
         ++i;
     }
+
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2551,6 +2609,8 @@ MidiSequence::exact_split_trigger(long a_tick){
         }
         ++i;
     }
+
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2653,6 +2713,7 @@ MidiSequence::move_triggers( long a_start_tick,
 
 
 
+    notify( e_change_triggers );
     unlock();
 
 }
@@ -2808,6 +2869,7 @@ MidiSequence::move_selected_triggers_to(long a_tick, bool a_adjust_offset, trigg
         ++i;
     }
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2839,6 +2901,7 @@ MidiSequence::offset_selected_triggers_by(long a_tick,
         ++i;
     }
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -2913,6 +2976,7 @@ MidiSequence::select_trigger( long a_tick )
         }
     }
 
+    notify( e_change_triggers );
     unlock();
 
     return ret;
@@ -2931,6 +2995,7 @@ MidiSequence::unselect_triggers()
         (*i).m_selected = false;
     }
 
+    notify( e_change_triggers );
     unlock();
 
     return ret;
@@ -2961,6 +3026,7 @@ MidiSequence::del_selected_triggers()
         }
     }
 
+    notify( e_change_triggers );
     unlock();
 }
 
@@ -3075,6 +3141,312 @@ MidiSequence::get_highest_note_event()
     return ret;
 }
 
+void
+MidiSequence::index_notes()
+{
+    if ( !m_note_index_dirty )
+        return;
+
+    for ( int note = 0; note < c_midi_notes; note++ ){
+        m_note_index[note].clear();
+        m_note_index_span[note] = 0;
+    }
+    m_note_index_wrapped.clear();
+
+    list<MidiEvent>::iterator i;
+
+    /* the event list is sorted, so each bucket comes out
+       ordered by onset */
+    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
+
+        int note = (*i).get_note();
+
+        if ( (*i).is_note_on() && (*i).is_linked() ){
+
+            long tick_s = (*i).get_timestamp();
+            long tick_f = (*i).get_linked()->get_timestamp();
+
+            if ( tick_f < tick_s ){
+                m_note_index_wrapped.push_back( &(*i) );
+                continue;
+            }
+
+            if ( tick_f - tick_s > m_note_index_span[note] )
+                m_note_index_span[note] = tick_f - tick_s;
+
+            m_note_index[note].push_back( &(*i) );
+        }
+        else if ( ((*i).is_note_on() || (*i).is_note_off()) &&
+                  ! (*i).is_linked() ){
+
+            m_note_index[note].push_back( &(*i) );
+        }
+    }
+
+    m_note_index_dirty = false;
+}
+
+void
+MidiSequence::index_lanes()
+{
+    if ( !m_lane_index_dirty )
+        return;
+
+    m_lane_index.clear();
+
+    list<MidiEvent>::iterator i;
+
+    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
+
+        unsigned char d0, d1;
+        (*i).get_data( &d0, &d1 );
+        m_lane_index[lane_key( (*i).get_status(), d0 )].push_back( &(*i) );
+    }
+
+    m_lane_index_dirty = false;
+}
+
+void
+MidiSequence::invalidate_indexes()
+{
+    m_note_index_dirty = true;
+    m_lane_index_dirty = true;
+}
+
+void
+MidiSequence::index_add( MidiEvent *a_e )
+{
+    if ( a_e->is_note_on() || a_e->is_note_off() )
+        m_note_index_dirty = true;
+
+    if ( m_lane_index_dirty )
+        return;
+
+    unsigned char d0, d1;
+    a_e->get_data( &d0, &d1 );
+    vector<MidiEvent*> &lane =
+            m_lane_index[lane_key( a_e->get_status(), d0 )];
+
+    /* ahead of any at the same tick, as add_event puts it in
+       the list */
+    lane.insert( lower_bound( lane.begin(), lane.end(),
+                              a_e->get_timestamp(), event_before_tick ),
+                 a_e );
+}
+
+void
+MidiSequence::index_remove( MidiEvent *a_e )
+{
+    if ( a_e->is_note_on() || a_e->is_note_off() )
+        m_note_index_dirty = true;
+
+    if ( m_lane_index_dirty )
+        return;
+
+    unsigned char d0, d1;
+    a_e->get_data( &d0, &d1 );
+
+    map<int, vector<MidiEvent*> >::iterator lane =
+            m_lane_index.find( lane_key( a_e->get_status(), d0 ));
+
+    vector<MidiEvent*>::iterator i;
+
+    if ( lane != m_lane_index.end() ){
+
+        i = lower_bound( lane->second.begin(), lane->second.end(),
+                         a_e->get_timestamp(), event_before_tick );
+
+        while ( i != lane->second.end() && *i != a_e &&
+                (*i)->get_timestamp() == a_e->get_timestamp() )
+            i++;
+    }
+
+    /* not where it should be, so don't trust the rest */
+    if ( lane == m_lane_index.end() ||
+         i == lane->second.end() || *i != a_e ){
+
+        m_lane_index_dirty = true;
+        return;
+    }
+
+    lane->second.erase( i );
+
+    if ( lane->second.empty() )
+        m_lane_index.erase( lane );
+}
+
+void
+MidiSequence::find_notes( long a_tick_s, long a_tick_f,
+                          int a_note_l, int a_note_h, bool a_onsets,
+                          vector<MidiEvent*> *a_found )
+{
+    vector<MidiEvent*>::iterator i;
+
+    a_found->clear();
+    index_notes();
+
+    if ( a_note_l < 0 )
+        a_note_l = 0;
+    if ( a_note_h > c_midi_notes - 1 )
+        a_note_h = c_midi_notes - 1;
+
+    for ( int note = a_note_l; note <= a_note_h; note++ ){
+
+        vector<MidiEvent*> &bucket = m_note_index[note];
+
+        /* nothing starting earlier than the longest note in the
+           bucket can reach into the window. stray ons and offs
+           are drawn 16 ticks wide */
+        long reach = 16;
+        if ( !a_onsets && m_note_index_span[note] > reach )
+            reach = m_note_index_span[note];
+
+        i = lower_bound( bucket.begin(), bucket.end(),
+                         a_tick_s - reach, event_before_tick );
+
+        for ( ; i != bucket.end() &&
+              (*i)->get_timestamp() <= a_tick_f; i++ ){
+
+            long tick_s = (*i)->get_timestamp();
+
+            if ( (*i)->is_linked() ){
+
+                if ( a_onsets ){
+                    if ( tick_s < a_tick_s )
+                        continue;
+                }
+                else if ( (*i)->get_linked()->get_timestamp() < a_tick_s ){
+                    continue;
+                }
+            }
+            else if ( tick_s < a_tick_s - 16 ){
+                continue;
+            }
+
+            a_found->push_back( *i );
+        }
+    }
+
+    /* wrapped notes cover their onset to the end of the
+       loop, and the start of the loop to their offset */
+    for ( i = m_note_index_wrapped.begin();
+          i != m_note_index_wrapped.end(); i++ ){
+
+        if ( (*i)->get_note() < a_note_l ||
+             (*i)->get_note() > a_note_h )
+            continue;
+
+        long tick_s = (*i)->get_timestamp();
+        long tick_f = (*i)->get_linked()->get_timestamp();
+
+        if ( a_onsets ){
+            if ( tick_s >= a_tick_s && tick_s <= a_tick_f )
+                a_found->push_back( *i );
+        }
+        else if ( tick_s <= a_tick_f || tick_f >= a_tick_s ){
+            a_found->push_back( *i );
+        }
+    }
+
+    sort( a_found->begin(), a_found->end(), note_event_before );
+}
+
+vector<MidiEvent*> *
+MidiSequence::get_lane( unsigned char a_status, unsigned char a_cc )
+{
+    index_lanes();
+
+    map<int, vector<MidiEvent*> >::iterator lane =
+            m_lane_index.find( lane_key( a_status, a_cc ));
+
+    if ( lane == m_lane_index.end() )
+        return NULL;
+
+    return &lane->second;
+}
+
+void
+MidiSequence::fill_note_info( MidiEvent *a_e, MidiNoteInfo *a_info )
+{
+    a_info->m_tick_start  = a_e->get_timestamp();
+    a_info->m_tick_finish = 0;
+    a_info->m_note        = a_e->get_note();
+    a_info->m_selected    = a_e->is_selected();
+    a_info->m_velocity    = a_e->get_note_velocity();
+
+    if ( a_e->is_linked() ){
+
+        a_info->m_tick_finish = a_e->get_linked()->get_timestamp();
+        a_info->m_type = DRAW_NORMAL_LINKED;
+    }
+    else if ( a_e->is_note_on() ){
+
+        a_info->m_type = DRAW_NOTE_ON;
+    }
+    else {
+
+        a_info->m_type = DRAW_NOTE_OFF;
+    }
+}
+
+int
+MidiSequence::get_note_events_in_range( long a_tick_s, long a_tick_f,
+                                        int a_note_l, int a_note_h,
+                                        vector<MidiNoteInfo> *a_notes )
+{
+    vector<MidiEvent*> found;
+    MidiNoteInfo info;
+
+    lock();
+
+    find_notes( a_tick_s, a_tick_f, a_note_l, a_note_h, false, &found );
+
+    a_notes->clear();
+    for ( unsigned n = 0; n < found.size(); n++ ){
+
+        fill_note_info( found[n], &info );
+        a_notes->push_back( info );
+    }
+
+    unlock();
+
+    return a_notes->size();
+}
+
+int
+MidiSequence::get_lane_events_in_range( unsigned char a_status,
+                                        unsigned char a_cc,
+                                        long a_tick_s, long a_tick_f,
+                                        vector<MidiEventInfo> *a_events )
+{
+    MidiEventInfo info;
+
+    lock();
+
+    a_events->clear();
+
+    vector<MidiEvent*> *lane = get_lane( a_status, a_cc );
+    if ( lane != NULL ){
+
+        vector<MidiEvent*>::iterator i =
+                lower_bound( lane->begin(), lane->end(),
+                             a_tick_s, event_before_tick );
+
+        for ( ; i != lane->end() &&
+              (*i)->get_timestamp() <= a_tick_f; i++ ){
+
+            info.m_tick = (*i)->get_timestamp();
+            info.m_selected = (*i)->is_selected();
+            (*i)->get_data( &info.m_d0, &info.m_d1 );
+            a_events->push_back( info );
+        }
+    }
+
+    unlock();
+
+    return a_events->size();
+}
+
 draw_type
 MidiSequence::get_next_note_event( long *a_tick_s,
                                    long *a_tick_f,
@@ -3207,6 +3579,8 @@ MidiSequence::remove_all()
 
 
     m_list_event.clear();
+    invalidate_indexes();
+    set_dirty();
 
     unlock();
 
@@ -3222,6 +3596,7 @@ MidiSequence::operator= (const MidiSequence& a_rhs)
 
         m_list_event   = a_rhs.m_list_event;
         m_list_trigger   = a_rhs.m_list_trigger;
+        invalidate_indexes();
 
         m_midi_channel = a_rhs.m_midi_channel;
         m_masterbus    = a_rhs.m_masterbus;
@@ -3591,40 +3966,27 @@ MidiSequence::select_events( unsigned char a_status, unsigned char a_cc, bool a_
 {
     lock();
 
-    unsigned char d0, d1;
-    list<MidiEvent>::iterator i;
-
-    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
-
-        /* initially false */
-        bool set = false;
-        (*i).get_data( &d0, &d1 );
+    vector<MidiEvent*> *lane = get_lane( a_status, a_cc );
+    if ( lane != NULL ){
 
-        /* correct status and not CC */
-        if ( a_status != EVENT_CONTROL_CHANGE &&
-             (*i).get_status() == a_status )
-            set = true;
-
-        /* correct status and correct cc */
-        if ( a_status == EVENT_CONTROL_CHANGE &&
-             (*i).get_status() == a_status &&
-             d0 == a_cc )
-            set = true;
+        for ( unsigned n = 0; n < lane->size(); n++ ){
 
-        if ( set ){
+            MidiEvent *e = (*lane)[n];
 
             if ( a_inverse ){
-                if ( !(*i).is_selected( ) )
-                    (*i).select( );
+                if ( !e->is_selected( ) )
+                    e->select( );
                 else
-                    (*i).unselect( );
+                    e->unselect( );
 
             }
             else
-                (*i).select( );
+                e->select( );
         }
     }
 
+    set_dirty();
+
     unlock();
 }
 
@@ -3685,6 +4047,7 @@ MidiSequence::transpose_notes( int a_steps, int a_scale )
     remove_marked();
     transposed_events.sort();
     m_list_event.merge( transposed_events);
+    invalidate_indexes();
 
 
     verify_and_link();
@@ -3772,14 +4135,15 @@ MidiSequence::quanize_events( unsigned char a_status, unsigned char a_cc,
     remove_marked();
     quantized_events.sort();
     m_list_event.merge(quantized_events);
+    invalidate_indexes();
     verify_and_link();
 
     unlock();
 
 }
 
-void
-addListVar( list<char> *a_list, long a_var )
+static void
+addVar( vector<unsigned char> *a_buffer, long a_var )
 {
     long buffer;
     buffer = a_var & 0x7F;
@@ -3794,7 +4158,7 @@ addListVar( list<char> *a_list, long a_var )
 
     while (true){
 
-        a_list->push_front( (char) buffer & 0xFF );
+        a_buffer->push_back( buffer & 0xFF );
 
         if (buffer & 0x80)
             buffer >>= 8;
@@ -3803,64 +4167,104 @@ addListVar( list<char> *a_list, long a_var )
     }
 }
 
+static void
+addLong( vector<unsigned char> *a_buffer, long a_x )
+{
+    a_buffer->push_back(  (a_x & 0xFF000000) >> 24 );
+    a_buffer->push_back(  (a_x & 0x00FF0000) >> 16 );
+    a_buffer->push_back(  (a_x & 0x0000FF00) >> 8  );
+    a_buffer->push_back(  (a_x & 0x000000FF)       );
+}
+
+
 void
-addLongList( list<char> *a_list, long a_x )
+MidiSequence::copy_for_write( MidiSequenceCopy *a_copy )
 {
-    a_list->push_front(  (a_x & 0xFF000000) >> 24 );
-    a_list->push_front(  (a_x & 0x00FF0000) >> 16 );
-    a_list->push_front(  (a_x & 0x0000FF00) >> 8  );
-    a_list->push_front(  (a_x & 0x000000FF)       );
+    lock();
+
+    a_copy->m_name = m_name;
+    a_copy->m_midi_channel = m_midi_channel;
+    a_copy->m_bus = m_bus;
+    a_copy->m_beats_per_measure = m_time_beats_per_measure;
+    a_copy->m_beat_width = m_time_beat_width;
+    a_copy->m_length = m_length;
+
+    a_copy->m_events.clear();
+    a_copy->m_events.reserve( m_list_event.size() );
+
+    list<MidiEvent>::iterator i;
+    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
+
+        MidiSequenceCopy::Event e;
+        e.m_tick = (*i).get_timestamp();
+        e.m_status = (*i).get_status();
+        e.m_data[0] = (*i).m_data[0];
+        e.m_data[1] = (*i).m_data[1];
+        a_copy->m_events.push_back( e );
+    }
+
+    a_copy->m_triggers.assign( m_list_trigger.begin(), m_list_trigger.end() );
+
+    unlock();
 }
 
 
 void
-MidiSequence::fill_list( list<char> *a_list, int a_pos )
+MidiSequence::fill_buffer( vector<unsigned char> *a_buffer, int a_pos )
 {
+    MidiSequenceCopy copy;
+    copy_for_write( &copy );
+    copy.fill_buffer( a_buffer, a_pos );
+}
 
-    lock();
 
-    /* clear list */
-    *a_list = list<char>();
+void
+MidiSequenceCopy::fill_buffer( vector<unsigned char> *a_buffer, int a_pos ) const
+{
+    /* about four bytes an event plus the meta events, so the buffer
+       grows once rather than along the way */
+    a_buffer->reserve( a_buffer->size() + 64 + m_name.length() +
+                       m_events.size() * 4 +
+                       m_triggers.size() * 12 );
 
     /* sequence number */
-    addListVar( a_list, 0 );
-    a_list->push_front( 0xFF );
-    a_list->push_front( 0x00 );
-    a_list->push_front( 0x02 );
-    a_list->push_front( (a_pos & 0xFF00) >> 8 );
-    a_list->push_front( (a_pos & 0x00FF)      );
+    addVar( a_buffer, 0 );
+    a_buffer->push_back( 0xFF );
+    a_buffer->push_back( 0x00 );
+    a_buffer->push_back( 0x02 );
+    a_buffer->push_back( (a_pos & 0xFF00) >> 8 );
+    a_buffer->push_back( (a_pos & 0x00FF)      );
 
     /* name */
-    addListVar( a_list, 0 );
-    a_list->push_front( 0xFF );
-    a_list->push_front( 0x03 );
+    addVar( a_buffer, 0 );
+    a_buffer->push_back( 0xFF );
+    a_buffer->push_back( 0x03 );
 
     int length =  m_name.length();
     if ( length > 0x7F ) length = 0x7f;
-    a_list->push_front( length );
+    a_buffer->push_back( length );
 
-    for ( int i=0; i< length; i++ )
-        a_list->push_front( m_name.c_str()[i] );
+    a_buffer->insert( a_buffer->end(), m_name.begin(), m_name.begin() + length );
 
     long timestamp = 0, delta_time = 0, prev_timestamp = 0;
-    list<MidiEvent>::iterator i;
+    vector<Event>::const_iterator i;
 
-    for ( i = m_list_event.begin(); i != m_list_event.end(); i++ ){
+    for ( i = m_events.begin(); i != m_events.end(); i++ ){
 
-        MidiEvent e = (*i);
-        timestamp = e.get_timestamp();
+        const Event &e = (*i);
+        timestamp = e.m_tick;
         delta_time = timestamp - prev_timestamp;
         prev_timestamp = timestamp;
 
         /* encode delta_time */
-        addListVar( a_list, delta_time );
+        addVar( a_buffer, delta_time );
 
         /* now that the timestamp is encoded, do the status and
                                        data */
 
-        a_list->push_front( e.get_status() | m_midi_channel );
+        a_buffer->push_back( e.m_status | m_midi_channel );
 
-        switch( e.get_status() & 0xF0 ){
+        switch( e.m_status & 0xF0 ){
 
         case 0x80:
         case 0x90:
@@ -3868,8 +4272,8 @@ MidiSequence::fill_list( list<char> *a_list, int a_pos )
         case 0xB0:
         case 0xE0:
 
-            a_list->push_front(  e.m_data[0] );
-            a_list->push_front(  e.m_data[1] );
+            a_buffer->push_back(  e.m_data[0] );
+            a_buffer->push_back(  e.m_data[1] );
 
             //printf ( "- d[%2X %2X]\n" , e.m_data[0], e.m_data[1] );
 
@@ -3878,7 +4282,7 @@ MidiSequence::fill_list( list<char> *a_list, int a_pos )
         case 0xC0:
         case 0xD0:
 
-            a_list->push_front(  e.m_data[0] );
+            a_buffer->push_back(  e.m_data[0] );
 
             //printf ( "- d[%2X]\n" , e.m_data[0] );
 
@@ -3889,64 +4293,60 @@ MidiSequence::fill_list( list<char> *a_list, int a_pos )
         }
     }
 
-    int num_triggers = m_list_trigger.size();
-    list<MidiTrigger>::iterator t = m_list_trigger.begin();
-    list<MidiTrigger>::iterator p;
+    int num_triggers = m_triggers.size();
+    vector<MidiTrigger>::const_iterator t = m_triggers.begin();
 
-    addListVar( a_list, 0 );
-    a_list->push_front( 0xFF );
-    a_list->push_front( 0x7F );
-    addListVar( a_list, (num_triggers * 3 * 4) + 4);
-    addLongList( a_list, c_triggers_new );
+    addVar( a_buffer, 0 );
+    a_buffer->push_back( 0xFF );
+    a_buffer->push_back( 0x7F );
+    addVar( a_buffer, (num_triggers * 3 * 4) + 4);
+    addLong( a_buffer, c_triggers_new );
 
     //printf( "num_triggers[%d]\n", num_triggers );
 
     for ( int i=0; i<num_triggers; i++ ){
 
-        p = t;
         //printf( "> start[%d] end[%d] offset[%d]\n",
         //        (*t).m_tick_start, (*t).m_tick_end, (*t).m_offset );
 
-        addLongList( a_list, (*t).m_tick_start );
-        addLongList( a_list, (*t).m_tick_end );
-        addLongList( a_list, (*t).m_offset );
+        addLong( a_buffer, (*t).m_tick_start );
+        addLong( a_buffer, (*t).m_tick_end );
+        addLong( a_buffer, (*t).m_offset );
         t++;
     }
 
     /* bus */
-    addListVar( a_list, 0 );
-    a_list->push_front( 0xFF );
-    a_list->push_front( 0x7F );
-    a_list->push_front( 0x05 );
-    addLongList( a_list, c_midibus );
-    a_list->push_front( m_bus  );
+    addVar( a_buffer, 0 );
+    a_buffer->push_back( 0xFF );
+    a_buffer->push_back( 0x7F );
+    a_buffer->push_back( 0x05 );
+    addLong( a_buffer, c_midibus );
+    a_buffer->push_back( m_bus  );
 
     /* timesig */
-    addListVar( a_list, 0 );
-    a_list->push_front( 0xFF );
-    a_list->push_front( 0x7F );
-    a_list->push_front( 0x06 );
-    addLongList( a_list, c_timesig );
-    a_list->push_front( m_time_beats_per_measure  );
-    a_list->push_front( m_time_beat_width  );
+    addVar( a_buffer, 0 );
+    a_buffer->push_back( 0xFF );
+    a_buffer->push_back( 0x7F );
+    a_buffer->push_back( 0x06 );
+    addLong( a_buffer, c_timesig );
+    a_buffer->push_back( m_beats_per_measure  );
+    a_buffer->push_back( m_beat_width  );
 
     /* channel */
-    addListVar( a_list, 0 );
-    a_list->push_front( 0xFF );
-    a_list->push_front( 0x7F );
-    a_list->push_front( 0x05 );
-    addLongList( a_list, c_midich );
-    a_list->push_front( m_midi_channel );
+    addVar( a_buffer, 0 );
+    a_buffer->push_back( 0xFF );
+    a_buffer->push_back( 0x7F );
+    a_buffer->push_back( 0x05 );
+    addLong( a_buffer, c_midich );
+    a_buffer->push_back( m_midi_channel );
 
     delta_time = m_length - prev_timestamp;
 
     /* meta track end */
-    addListVar( a_list, delta_time );
-    a_list->push_front( 0xFF );
-    a_list->push_front( 0x2F );
-    a_list->push_front( 0x00 );
-
-    unlock();
+    addVar( a_buffer, delta_time );
+    a_buffer->push_back( 0xFF );
+    a_buffer->push_back( 0x2F );
+    a_buffer->push_back( 0x00 );
 }
 
 
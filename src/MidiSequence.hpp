@@ -7,13 +7,17 @@ class MidiSequence;
 
 #include <string>
 #include <list>
+#include <map>
 #include <stack>
+#include <vector>
 
 #include "MidiTrigger.hpp"
 #include "MidiEvent.hpp"
 #include "MidiBus.hpp"
 #include "Globals.hpp"
 #include "Mutex.hpp"
+#include "ChangeQueue.hpp"
+#include "EventRing.hpp"
 
 enum draw_type
 {
@@ -30,6 +34,64 @@ enum trigger_edit
     MOVE = 2 //move the entire trigger block
 };
 
+///
+/// \brief The MidiNoteInfo struct
+///
+/// A note as handed out by the editor range queries,
+/// with its on/off pair already resolved
+
+struct MidiNoteInfo
+{
+    draw_type m_type;
+    long m_tick_start;
+    long m_tick_finish;
+    int m_note;
+    int m_velocity;
+    bool m_selected;
+};
+
+///
+/// \brief The MidiEventInfo struct
+///
+/// A single event on a data lane (velocity, a controller,
+/// pitch bend etc) as handed out by the lane range queries
+
+struct MidiEventInfo
+{
+    long m_tick;
+    unsigned char m_d0;
+    unsigned char m_d1;
+    bool m_selected;
+};
+
+///
+/// \brief The MidiSequenceCopy struct
+///
+/// What fill_buffer() writes of a sequence, taken out flat while
+/// the sequence is locked so it can be encoded on another thread
+
+struct MidiSequenceCopy
+{
+    struct Event
+    {
+        long m_tick;
+        unsigned char m_status;
+        unsigned char m_data[2];
+    };
+
+    string m_name;
+    vector<Event> m_events;
+    vector<MidiTrigger> m_triggers;
+    char m_midi_channel;
+    char m_bus;
+    long m_beats_per_measure;
+    long m_beat_width;
+    long m_length;
+
+    /* appends it as the body of an MTrk chunk */
+    void fill_buffer (vector < unsigned char >*a_buffer, int a_pos) const;
+};
+
 ///
 /// \brief The MidiSequence class
 ///
@@ -59,6 +121,25 @@ private:
     list < MidiTrigger >::iterator m_iterator_play_trigger;
     list < MidiTrigger >::iterator m_iterator_draw_trigger;
 
+    /* note index for the editors, one bucket per pitch holding
+       the note ons (and stray offs) ordered by onset, along with
+       the longest note in each bucket. notes wrapping past the
+       end of the loop are kept on their own. rebuilt lazily
+       once note events come or go, or the ons and offs are
+       paired up again */
+    vector < MidiEvent * > m_note_index[c_midi_notes];
+    long m_note_index_span[c_midi_notes];
+    vector < MidiEvent * > m_note_index_wrapped;
+
+    /* data lane index, events ordered by time for each status
+       (and controller number, for control changes). kept up to
+       date as single events come and go, rebuilt lazily when
+       the list is replaced or reordered as a whole */
+    map < int, vector < MidiEvent * > > m_lane_index;
+
+    bool m_note_index_dirty;
+    bool m_lane_index_dirty;
+
     /* contains the proper midi channel */
     char m_midi_channel;
     char m_bus;
@@ -88,12 +169,18 @@ private:
 
     bool m_trigger_copied;
 
-    /* flag indicates that contents has changed from
-       a recording */
-    bool m_dirty_main;
-    bool m_dirty_edit;
-    bool m_dirty_perf;
-    bool m_dirty_names;
+    /* events recorded by the input thread, waiting for the
+       output thread to merge them */
+    EventRing *m_input_ring;
+
+    /* where our changes are announced to the GUI, and the
+       id we are announced under */
+    ChangeQueue *m_changes;
+    int m_change_id;
+
+    /* bumped on every change to the events or their selection,
+       so views can tell when their cached drawing is stale */
+    unsigned long m_edit_generation;
 
     /* used to temporarily block song mode events
      * during live sequence triggering/muting */
@@ -158,6 +245,35 @@ private:
     void remove( list<MidiEvent>::iterator i );
     void remove( MidiEvent* e );
 
+    /* rebuild the note or lane index if they are out of date,
+       call with the lock held */
+    void index_notes ();
+    void index_lanes ();
+
+    /* both indexes start over, for when the event list is
+       replaced or reordered as a whole */
+    void invalidate_indexes ();
+
+    /* a_e was just added to the event list, or is about to be
+       removed from it */
+    void index_add (MidiEvent *a_e);
+    void index_remove (MidiEvent *a_e);
+    void fill_note_info (MidiEvent *a_e, MidiNoteInfo *a_info);
+
+    /* collects the notes touching a tick and note window from
+       the index, in event list order. call with the lock held */
+    void find_notes (long a_tick_s, long a_tick_f,
+                     int a_note_l, int a_note_h, bool a_onsets,
+                     vector < MidiEvent * > *a_found);
+
+    /* the indexed events of a data lane, NULL if there are
+       none. call with the lock held */
+    vector < MidiEvent * > *get_lane (unsigned char a_status,
+                                      unsigned char a_cc);
+
+    /* reads and writes our lists directly */
+    friend class MidiFileCache;
+
 public:
 
     MidiSequence ();
@@ -258,16 +374,17 @@ public:
     void set_thru (bool);
     bool get_thru ();
 
-    /* singals that a redraw is needed from recording */
-    /* resets flag on call */
-    bool is_dirty_main ();
-    bool is_dirty_edit ();
-    bool is_dirty_perf ();
-    bool is_dirty_names ();
+    /* announces our changes on a_changes as sequence a_id,
+       NULL when we are not part of a performance */
+    void set_change_queue (ChangeQueue *a_changes, int a_id);
+    void notify (int a_changes);
 
     void set_dirty_mp();
     void set_dirty();
 
+    /* changes whenever the events or their selection change */
+    unsigned long get_edit_generation ();
+
     /* midi channel */
     unsigned char get_midi_channel ();
     void set_midi_channel (unsigned char a_ch);
@@ -288,6 +405,12 @@ public:
     /* adds event to internal list in a sorted manner */
     void add_event (const MidiEvent * a_e);
 
+    /* for loading: append_event() adds unsorted, sort_events()
+       sorts once at the end, leaving the same order add_event()
+       would have */
+    void append_event (const MidiEvent * a_e);
+    void sort_events ();
+
     /*
      * manage triggers
      * (the blocks of seqs for song playback)
@@ -389,6 +512,17 @@ public:
 
     void stream_event (MidiEvent * a_ev);
 
+    /* allocate the input ring, before we become the input target */
+    void prepare_input ();
+
+    /* input thread: hands recorded events to the output thread,
+       without waiting on the sequence lock for the insert. false
+       if the ring overflowed */
+    bool push_input (MidiEvent * a_ev);
+
+    /* output thread: stream the pushed events into the sequence */
+    void merge_input ();
+
     /* changes velocities in a ramping way from vel_s to vel_f  */
     void change_event_data_range (long a_tick_s, long a_tick_f,
                                   unsigned char a_status,
@@ -451,9 +585,24 @@ public:
                                    int *a_note,
                                    bool * a_selected, int *a_velocity);
 
+    /* fills a_notes with every note overlapping the given
+       tick and note window, returns how many were found.
+       results belong to the caller, so any number of views
+       can query the same sequence */
+    int get_note_events_in_range (long a_tick_s, long a_tick_f,
+                                  int a_note_l, int a_note_h,
+                                  vector < MidiNoteInfo > *a_notes);
+
     int get_lowest_note_event ();
     int get_highest_note_event ();
 
+    /* fills a_events with the events of one data lane that
+       fall between the given ticks, returns how many */
+    int get_lane_events_in_range (unsigned char a_status,
+                                  unsigned char a_cc,
+                                  long a_tick_s, long a_tick_f,
+                                  vector < MidiEventInfo > *a_events);
+
     bool get_next_event (unsigned char a_status,
                          unsigned char a_cc,
                          long *a_tick,
@@ -468,7 +617,12 @@ public:
 
     MidiSequence & operator= (const MidiSequence & a_rhs);
 
-    void fill_list (list < char >*a_list, int a_pos);
+    /* appends the sequence as the body of an MTrk chunk */
+    void fill_buffer (vector < unsigned char >*a_buffer, int a_pos);
+
+    /* takes what fill_buffer() needs into a_copy, holding the lock
+       only as long as the copy takes */
+    void copy_for_write (MidiSequenceCopy *a_copy);
 
     void select_events (unsigned char a_status, unsigned char a_cc,
                         bool a_inverse = false);
@@ -0,0 +1,188 @@
+#include "MidiSetlist.hpp"
+#include "MidiFile.hpp"
+#include "MidiPerformance.hpp"
+
+#include <stdio.h>
+
+
+MidiSetlist::MidiSetlist (MidiPerformance *a_perf) :
+    m_perf(a_perf),
+    m_current(0),
+    m_next(NULL),
+    m_loading(false),
+    m_loaded(false),
+    m_ok(false),
+    m_queued(false)
+{
+}
+
+
+MidiSetlist::~MidiSetlist ()
+{
+    cancel();
+}
+
+
+void
+MidiSetlist::cancel ()
+{
+    if (m_loading)
+    {
+        pthread_join(m_thread, NULL);
+        m_loading = false;
+    }
+
+    /* once queued the sequences belong to the performance, which
+       gives them up unless they are already playing */
+    if (m_queued)
+        m_perf->drop_standby();
+
+    delete m_next;
+    m_next = NULL;
+    m_loaded = false;
+    m_queued = false;
+
+    m_files.clear();
+    m_current = 0;
+}
+
+
+void
+MidiSetlist::set_files (const QStringList &a_files)
+{
+    cancel();
+
+    m_files = a_files;
+    m_current = 0;
+
+    preload(1);
+}
+
+
+QString
+MidiSetlist::current ()
+{
+    if (m_current < m_files.size())
+        return m_files[m_current];
+
+    return QString();
+}
+
+
+static void *
+load_thread_func (void *a_setlist)
+{
+    ((MidiSetlist *) a_setlist)->load_func();
+    return NULL;
+}
+
+
+void
+MidiSetlist::load_func ()
+{
+    m_ok = m_next->prepare(m_perf);
+
+    /* the result has to be there before the flag */
+    __sync_synchronize();
+    m_loaded = true;
+}
+
+
+void
+MidiSetlist::preload (int a_index)
+{
+    if (a_index >= m_files.size())
+        return;
+
+    m_next = new MidiFile(m_files[a_index]);
+    m_loaded = false;
+
+    if (pthread_create(&m_thread, NULL, load_thread_func, this) != 0)
+    {
+        /* no thread, so load it here */
+        load_func();
+        return;
+    }
+
+    m_loading = true;
+}
+
+
+bool
+MidiSetlist::queue_next (long a_bar_ticks)
+{
+    if (m_next == NULL || !m_loaded || m_queued)
+        return false;
+
+    if (m_loading)
+    {
+        pthread_join(m_thread, NULL);
+        m_loading = false;
+    }
+
+    if (!m_ok)
+    {
+        fprintf(stderr, "Error reading setlist file %s\n",
+                m_files[m_current + 1].toUtf8().constData());
+
+        /* skip it and try the one after */
+        delete m_next;
+        m_next = NULL;
+        m_current++;
+        preload(m_current + 1);
+        return false;
+    }
+
+    /* the last swap hasn't been cleaned up */
+    if (m_perf->retired_ready())
+        return false;
+
+    MidiSequence *seqs[c_max_sequence];
+    m_next->place_sequences(seqs);
+
+    if (!m_perf->set_standby(seqs, m_next->bpm()))
+    {
+        for (int i = 0; i < c_max_sequence; i++)
+            delete seqs[i];
+
+        return false;
+    }
+
+    /* the banks of this song it never got to stay unloaded, now
+       that it is going. until then they can still be selected */
+    m_perf->set_lazy_file(NULL);
+
+    m_queued = true;
+    m_perf->post_command(e_command_swap_standby, a_bar_ticks);
+
+    return true;
+}
+
+
+bool
+MidiSetlist::poll ()
+{
+    if (m_loading && m_loaded)
+    {
+        pthread_join(m_thread, NULL);
+        m_loading = false;
+    }
+
+    if (!m_queued || !m_perf->retired_ready())
+        return false;
+
+    m_perf->free_retired();
+
+    /* what the song says beyond its sequences, the bpm changed
+       with the swap */
+    m_next->adopt_settings(m_perf, false);
+
+    delete m_next;
+    m_next = NULL;
+    m_queued = false;
+
+    m_current++;
+    preload(m_current + 1);
+
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Globals.hpp"
+
+#include <pthread.h>
+#include <QString>
+#include <QStringList>
+
+class MidiPerformance;
+class MidiFile;
+
+///
+/// \brief The MidiSetlist class
+///
+/// An ordered list of MIDI files played one after the other without
+/// a gap. While one song plays the next is decoded on a thread of
+/// its own, and when it's asked for its sequences are handed to the
+/// performance, which swaps them in at the next bar line. Nothing
+/// is read from disk or decoded on the output thread
+///
+/// Everything here is called from the GUI thread
+
+class MidiSetlist
+{
+
+private:
+
+    MidiPerformance *m_perf;
+
+    QStringList m_files;
+    int m_current;
+
+    /* the next song, being decoded until m_loaded is set */
+    MidiFile *m_next;
+    pthread_t m_thread;
+    bool m_loading;
+    volatile bool m_loaded;
+    bool m_ok;
+
+    /* its sequences went to the performance, waiting for the swap */
+    bool m_queued;
+
+    void preload( int a_index );
+
+public:
+
+    MidiSetlist( MidiPerformance *a_perf );
+    ~MidiSetlist();
+
+    /* the songs to play, a_files[0] is expected to be playing. a
+       song of the last list still waiting to swap in never does */
+    void set_files( const QStringList &a_files );
+
+    /* ends the setlist, for when another file is opened or a new one
+       started. the next song stops loading and won't swap in */
+    void cancel();
+
+    /* the file currently playing, empty when there isn't one */
+    QString current();
+
+    /* swaps in the next song at the next a_bar_ticks bar line.
+       false if there is none or it isn't loaded yet */
+    bool queue_next( long a_bar_ticks );
+
+    /* from the GUI timer. true once a queued song is playing, its
+       settings are in the performance by then */
+    bool poll();
+
+    /* the body of the load thread */
+    void load_func();
+
+};
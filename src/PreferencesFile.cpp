@@ -65,6 +65,8 @@ PreferencesFile::parse( MidiPerformance *a_perf )
 
         next_data_line(&file);
     }
+    a_perf->rebuild_midi_control_table();
+
     /* group midi control */
     line_after( &file, "[mute-group]");
 
@@ -302,6 +304,7 @@ PreferencesFile::write( MidiPerformance *a_perf  )
         case c_midi_control_mod_gmute    :  file << "# mod gmute\n"; break;
         case c_midi_control_mod_glearn   :  file << "# mod glearn\n"; break;
         case c_midi_control_play_ss      :  file << "# screen set play\n"; break;
+        case c_midi_control_next_song    :  file << "# next song in setlist\n"; break;
 
 
         default: break;
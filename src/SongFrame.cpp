@@ -197,6 +197,25 @@ void SongFrame::updateSizes()
     mContainer->adjustSize();
 }
 
+void SongFrame::refreshSequence(int seqId, int changes)
+{
+    if (changes & (e_change_events | e_change_triggers |
+                   e_change_state | e_change_active))
+        m_perfroll->refreshSequence(seqId);
+
+    if (changes & (e_change_state | e_change_active))
+        m_perfnames->refreshSequence(seqId);
+}
+
+void SongFrame::refreshPerformance(int changes)
+{
+    if (changes & e_change_tick)
+        m_perfroll->refreshPlayhead();
+
+    if (changes & e_change_markers)
+        m_perftime->update();
+}
+
 void SongFrame::markerCollapse()
 {
     m_mainperf->push_trigger_undo();
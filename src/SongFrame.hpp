@@ -39,6 +39,10 @@ public:
     //in MIDI file sizes
     void updateSizes();
 
+    //repaint whatever shows a change pushed by the performance
+    void refreshSequence(int seqId, int changes);
+    void refreshPerformance(int changes);
+
 private:
     /* set snap to in pulses */
     int m_snap;
@@ -12,6 +12,7 @@ SongSequenceGrid::SongSequenceGrid(MidiPerformance *a_perf,
     m_adding_pressed(false),
     zoom(1),
     mLastTick(0),
+    m_progress_x(0),
     seq_h(-1),
     seq_l(-1)
 {
@@ -21,24 +22,19 @@ SongSequenceGrid::SongSequenceGrid(MidiPerformance *a_perf,
     setFocusPolicy(Qt::StrongFocus);
 
     for( int i=0; i<c_total_seqs; ++i )
+    {
         m_sequence_active[i]=false;
+        m_preview_seqs[i]=NULL;
+        m_preview_generations[i]=0;
+    }
 
     m_roll_length_ticks = mPerf->get_max_trigger();
     m_roll_length_ticks = m_roll_length_ticks -
             ( m_roll_length_ticks % ( c_ppqn * 16 ));
     m_roll_length_ticks +=  c_ppqn * 64;
-
-    //start refresh timer to queue regular redraws
-    mTimer = new QTimer(this);
-    mTimer->setInterval(50);
-    QObject::connect(mTimer,
-                     SIGNAL(timeout()),
-                     this,
-                     SLOT(update()));
-    mTimer->start();
 }
 
-void SongSequenceGrid::paintEvent(QPaintEvent *)
+void SongSequenceGrid::paintEvent(QPaintEvent *event)
 {
     mPainter = new QPainter(this);
     mBrush = new QBrush(Qt::NoBrush);
@@ -49,11 +45,27 @@ void SongSequenceGrid::paintEvent(QPaintEvent *)
     mPainter->setBrush(*mBrush);
     mPainter->setFont(mFont);
 
+    //only the exposed part of the grid gets drawn, the song
+    //editor scrolls us around inside a much smaller viewport
+    QRect area = event->rect();
+
     int beats = m_measure_length / m_beat_length;
+    int beat_step = 1;
+
+    // jump 2 if 16th notes
+    if ( m_beat_length < c_ppqn/2 )
+        beat_step = c_ppqn / m_beat_length;
+
+    int beat_s = area.left() * (c_perf_scale_x * zoom) / m_beat_length;
+    beat_s -= beat_s % beat_step;
 
     /* draw vert lines */
-    for (int i = 0; i < width();)
+    for (int i = beat_s; i < width(); i += beat_step)
     {
+        int x_line = i * m_beat_length / (c_perf_scale_x * zoom);
+        if ( x_line > area.right() )
+            break;
+
         /* solid line on every beat */
         if ( i % beats == 0 )
         {
@@ -67,38 +79,28 @@ void SongSequenceGrid::paintEvent(QPaintEvent *)
         }
 
         mPainter->setPen(*mPen);
-        mPainter->drawLine(i * m_beat_length / (c_perf_scale_x * zoom),
+        mPainter->drawLine(x_line,
                            1,
-                           i * m_beat_length / (c_perf_scale_x * zoom),
+                           x_line,
                            height() - 1);
-
-        // jump 2 if 16th notes
-        if ( m_beat_length < c_ppqn/2 )
-        {
-            i += (c_ppqn / m_beat_length);
-        }
-        else
-        {
-            ++i;
-        }
-
     }
 
     //draw horizontal lines
-    for (int i = 0; i < height(); i += c_names_y)
+    for (int i = area.top() - area.top() % c_names_y;
+         i <= area.bottom(); i += c_names_y)
     {
         mPen->setColor(Qt::black);
         mPen->setStyle(Qt::DotLine);
         mPainter->setPen(*mPen);
-        mPainter->drawLine(0,
+        mPainter->drawLine(area.left(),
                            i,
-                           width(),
+                           area.right() + 1,
                            i);
     }
 
     //draw background
-    int y_s = 0;
-    int y_f = height() / c_names_y;
+    int y_s = area.top() / c_names_y;
+    int y_f = area.bottom() / c_names_y;
 
     //draw sequence block
     long tick_on;
@@ -110,6 +112,8 @@ void SongSequenceGrid::paintEvent(QPaintEvent *)
     long tick_offset = 0;
     long x_offset = tick_offset / (c_perf_scale_x * zoom);
 
+    long tick_view_s = (area.left() + x_offset) * (c_perf_scale_x * zoom);
+
     for ( int y = y_s; y <= y_f; y++ )
     {
         int seqId = y;
@@ -127,6 +131,16 @@ void SongSequenceGrid::paintEvent(QPaintEvent *)
                 long seq_length = seq->getLength();
                 int length_w = seq_length / (c_perf_scale_x * zoom);
 
+                bool have_preview = false;
+
+                //get seq's assigned colour and beautify
+                QColor colourSpec = QColor(colourMap.value(mPerf->getSequenceColour(seqId)));
+                QColor backColour = QColor(colourSpec);
+                if (backColour.value() != 255) //dont do this if we're white
+                    backColour.setHsv(colourSpec.hue(),
+                                      colourSpec.saturation() * 0.65,
+                                      colourSpec.value() * 1.2);
+
                 while ( seq->get_next_trigger( &tick_on, &tick_off, &selected, &offset  )){
 
                     if ( tick_off > 0 ){
@@ -142,19 +156,22 @@ void SongSequenceGrid::paintEvent(QPaintEvent *)
                         // adjust to screen corrids
                         x = x - x_offset;
 
+                        //skip blocks scrolled out of view
+                        if ( x > area.right() || x + w < area.left() )
+                            continue;
+
+                        //the notes only get drawn once per edit,
+                        //every block of this seq reuses them
+                        if ( !have_preview ){
+                            update_preview( seqId, seq, length_w );
+                            have_preview = true;
+                        }
+
                         if ( selected )
                             mPen->setColor(Qt::red);
                         else
                             mPen->setColor(Qt::black);
 
-                        //get seq's assigned colour and beautify
-                        QColor colourSpec = QColor(colourMap.value(mPerf->getSequenceColour(seqId)));
-                        QColor backColour = QColor(colourSpec);
-                        if (backColour.value() != 255) //dont do this if we're white
-                            backColour.setHsv(colourSpec.hue(),
-                                              colourSpec.saturation() * 0.65,
-                                              colourSpec.value() * 1.2);
-
                         //main seq icon box
                         mPen->setStyle(Qt::SolidLine);
                         mBrush->setColor(backColour);
@@ -182,67 +199,34 @@ void SongSequenceGrid::paintEvent(QPaintEvent *)
                                            c_perfroll_size_box_w,
                                            c_perfroll_size_box_w);
 
-                        mPen->setColor(Qt::black);
-                        mPainter->setPen(*mPen);
-
                         long length_marker_first_tick = ( tick_on - (tick_on % seq_length) + (offset % seq_length) - seq_length);
 
                         long tick_marker = length_marker_first_tick;
 
+                        //skip the repeats left of the view
+                        long skip = (tick_view_s - tick_marker) / seq_length;
+                        if ( skip > 1 )
+                            tick_marker += (skip - 1) * seq_length;
+
                         while ( tick_marker < tick_off ){
 
                             long tick_marker_x = (tick_marker / (c_perf_scale_x * zoom)) - x_offset;
 
-                            int lowest_note = seq->get_lowest_note_event( );
-                            int highest_note = seq->get_highest_note_event( );
-
-                            int height = highest_note - lowest_note;
-                            height += 2;
-
-                            int length = seq->getLength( );
-
-                            long tick_s;
-                            long tick_f;
-                            int note;
-
-                            bool selected;
-
-                            int velocity;
-                            draw_type dt;
-
-                            seq->reset_draw_marker();
-
-                            mPen->setColor(Qt::black);
-                            mPainter->setPen(*mPen);
-
-                            while ( (dt = seq->get_next_note_event( &tick_s, &tick_f, &note,
-                                                                    &selected, &velocity )) != DRAW_FIN ){
+                            if ( tick_marker_x > area.right() )
+                                break;
 
-                                int note_y = ((c_names_y-6) -
-                                              ((c_names_y-6)  * (note - lowest_note)) / height) + 1;
+                            //blit the repeat, clipped to the block
+                            const QPixmap &preview = m_previews[seqId];
 
-                                int tick_s_x = ((tick_s * length_w)  / length) + tick_marker_x;
-                                int tick_f_x = ((tick_f * length_w)  / length) + tick_marker_x;
+                            int src_l = qMax( (long) x, tick_marker_x );
+                            int src_r = qMin( (long) x + w,
+                                              tick_marker_x + preview.width() - 1 );
 
-                                if ( dt == DRAW_NOTE_ON || dt == DRAW_NOTE_OFF )
-                                    tick_f_x = tick_s_x + 1;
-                                if ( tick_f_x <= tick_s_x )
-                                    tick_f_x = tick_s_x + 1;
-
-                                if ( tick_s_x < x ){
-                                    tick_s_x = x;
-                                }
-
-                                if ( tick_f_x > x + w ){
-                                    tick_f_x = x + w;
-                                }
-
-                                if ( tick_f_x >= x && tick_s_x <= x+w )
-                                    mPainter->drawLine(tick_s_x,
-                                                       y + note_y,
-                                                       tick_f_x,
-                                                       y + note_y);
-                            }
+                            if ( src_r >= src_l )
+                                mPainter->drawPixmap( src_l, y,
+                                                      preview,
+                                                      src_l - tick_marker_x, 0,
+                                                      src_r - src_l + 1, h );
 
                             if ( tick_marker > tick_on ){
 
@@ -306,21 +290,97 @@ void SongSequenceGrid::paintEvent(QPaintEvent *)
                        height() - 1);
 
     //draw playhead
-    long tick = mPerf->get_tick();
+    TransportState state;
+    mPerf->get_transport_state(&state);
+
+    long tick = state.m_tick;
 
-    int progress_x = tick / (c_perf_scale_x * zoom);
+    m_progress_x = tick / (c_perf_scale_x * zoom);
 
     mPen->setColor(Qt::red);
     mPen->setStyle(Qt::SolidLine);
     mPainter->setPen(*mPen);
-    mPainter->drawLine(progress_x, 1,
-                       progress_x, height() - 2);
+    mPainter->drawLine(m_progress_x, 1,
+                       m_progress_x, height() - 2);
 
     delete mPainter;
     delete mBrush;
     delete mPen;
 }
 
+void SongSequenceGrid::update_preview(int a_seq, MidiSequence *a_sequence,
+                                      int a_length_w)
+{
+    unsigned long generation = a_sequence->get_edit_generation();
+
+    if ( m_preview_seqs[a_seq] == a_sequence &&
+         m_preview_generations[a_seq] == generation &&
+         m_previews[a_seq].width() == a_length_w + 1 )
+        return;
+
+    m_preview_seqs[a_seq] = a_sequence;
+    m_preview_generations[a_seq] = generation;
+
+    //one repeat of the sequence's notes, shrunk into a block
+    int h = c_names_y - 2;
+    m_previews[a_seq] = QPixmap(a_length_w + 1, h);
+    m_previews[a_seq].fill(Qt::transparent);
+
+    int lowest_note = a_sequence->get_lowest_note_event( );
+    int highest_note = a_sequence->get_highest_note_event( );
+
+    int height = highest_note - lowest_note;
+    height += 2;
+
+    long length = a_sequence->getLength( );
+
+    a_sequence->get_note_events_in_range( 0, length, 0, c_num_keys - 1,
+                                          &m_preview_notes );
+
+    QPainter painter(&m_previews[a_seq]);
+    painter.setPen(QPen(Qt::black));
+
+    for ( unsigned n = 0; n < m_preview_notes.size(); n++ ){
+
+        const MidiNoteInfo &info = m_preview_notes[n];
+
+        int note_y = ((c_names_y-6) -
+                      ((c_names_y-6)  * (info.m_note - lowest_note)) / height) + 1;
+
+        int tick_s_x = (info.m_tick_start * a_length_w)  / length;
+        int tick_f_x = (info.m_tick_finish * a_length_w)  / length;
+
+        if ( info.m_type == DRAW_NOTE_ON || info.m_type == DRAW_NOTE_OFF )
+            tick_f_x = tick_s_x + 1;
+        if ( tick_f_x <= tick_s_x )
+            tick_f_x = tick_s_x + 1;
+
+        painter.drawLine(tick_s_x,
+                         note_y,
+                         tick_f_x,
+                         note_y);
+    }
+}
+
+void SongSequenceGrid::refreshSequence(int a_seq)
+{
+    update(0, c_names_y * a_seq, width(), c_names_y + 1);
+}
+
+void SongSequenceGrid::refreshPlayhead()
+{
+    TransportState state;
+    mPerf->get_transport_state(&state);
+
+    int progress_x = state.m_tick / (c_perf_scale_x * zoom);
+
+    if (progress_x != m_progress_x)
+    {
+        update(m_progress_x - 1, 0, 3, height());
+        update(progress_x - 1, 0, 3, height());
+    }
+}
+
 int SongSequenceGrid::getSnap() const
 {
     return m_snap;
@@ -482,6 +542,7 @@ void SongSequenceGrid::mousePressEvent(QMouseEvent *event)
         }
     }
 
+    update();
 }
 
 void SongSequenceGrid::mouseReleaseEvent(QMouseEvent *event)
@@ -528,6 +589,8 @@ void SongSequenceGrid::mouseReleaseEvent(QMouseEvent *event)
     m_adding_pressed = false;
     mBoxSelect = false;
     mLastTick = 0;
+
+    update();
 }
 
 void SongSequenceGrid::mouseMoveEvent(QMouseEvent *event)
@@ -619,6 +682,8 @@ void SongSequenceGrid::mouseMoveEvent(QMouseEvent *event)
     }
 
     mLastTick = tick;
+
+    update();
 }
 
 void SongSequenceGrid::keyPressEvent(QKeyEvent *event)
@@ -661,6 +726,7 @@ void SongSequenceGrid::keyPressEvent(QKeyEvent *event)
         }
     }
 
+    update();
 }
 void SongSequenceGrid::keyReleaseEvent(QKeyEvent *event)
 {
@@ -725,6 +791,7 @@ void SongSequenceGrid::set_guides( int a_snap, int a_measure, int a_beat )
     m_snap = a_snap;
     m_measure_length = a_measure;
     m_beat_length = a_beat;
+    update();
 }
 
 void SongSequenceGrid::set_adding(bool a_adding)
@@ -758,11 +825,13 @@ void SongSequenceGrid::zoomIn()
 {
     if (zoom > 1)
         zoom *= 0.5;
+    update();
 }
 
 void SongSequenceGrid::zoomOut()
 {
     zoom *= 2;
+    update();
 }
 
 void SongSequenceGrid::xy_to_rect(int a_x1, int a_y1, int a_x2, int a_y2,
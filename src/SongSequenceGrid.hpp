@@ -6,10 +6,10 @@
 #include "seq24Rect.hpp"
 
 #include <QWidget>
-#include <QTimer>
 #include <QObject>
 #include <QPainter>
 #include <QPen>
+#include <QPixmap>
 #include <QMouseEvent>
 
 const int c_perfroll_background_x = (c_ppqn * 4 * 16) / c_perf_scale_x;
@@ -39,6 +39,12 @@ public:
     void zoomIn();
     void zoomOut();
 
+    //repaint the row of a sequence that has changed
+    void refreshSequence(int a_seq);
+
+    //repaint the playhead if it has moved
+    void refreshPlayhead();
+
 protected:
     //override painting event to draw on the frame
     void paintEvent         (QPaintEvent *);
@@ -70,13 +76,17 @@ private:
     void half_split_trigger(int a_sequence, long a_tick);
     void set_adding(bool a_adding);
 
+    /* redraws the cached notes of one sequence repeat if
+       the sequence has been edited since */
+    void update_preview(int a_seq, MidiSequence *a_sequence,
+                        int a_length_w);
+
     MidiPerformance *mPerf;
 
     QPen        *mPen;
     QBrush      *mBrush;
     QPainter    *mPainter;
     QFont        mFont;
-    QTimer      *mTimer;
 
     seq24Rect m_old;
 
@@ -99,7 +109,14 @@ private:
     long    m_drop_tick_trigger_offset; //how far in ticks we clicked from
                                         //the start of this trigger
     long    mLastTick; //tick we we're using at last mouse event
+    int     m_progress_x; //where the playhead was last drawn
     bool    m_sequence_active[c_total_seqs];
+
+    //per sequence miniature of its notes, blitted into each trigger
+    QPixmap         m_previews[c_total_seqs];
+    MidiSequence   *m_preview_seqs[c_total_seqs];
+    unsigned long   m_preview_generations[c_total_seqs];
+    vector<MidiNoteInfo> m_preview_notes;
     bool    m_moving;
     bool    mBoxSelect;
     bool    m_growing;
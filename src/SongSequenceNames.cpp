@@ -17,6 +17,11 @@ SongSequenceNames::SongSequenceNames(MidiPerformance *a_perf,
         m_sequence_active[i]=false;
 }
 
+void SongSequenceNames::refreshSequence(int a_seq)
+{
+    update(0, c_names_y * a_seq, width(), c_names_y + 1);
+}
+
 void SongSequenceNames::paintEvent(QPaintEvent *)
 {
     mPainter = new QPainter(this);
@@ -22,6 +22,9 @@ public:
                                QWidget *parent);
     ~SongSequenceNames();
 
+    //repaint the label of a sequence that has changed
+    void refreshSequence(int a_seq);
+
 protected:
     //override painting event to draw on the frame
     void paintEvent         (QPaintEvent *);
@@ -9,15 +9,6 @@ SongTimeBar::SongTimeBar(MidiPerformance *a_perf,
     m_measure_length(c_ppqn * 4),
     zoom(1)
 {
-    //start refresh timer to queue regular redraws
-    mTimer = new QTimer(this);
-    mTimer->setInterval(50);
-    QObject::connect(mTimer,
-                     SIGNAL(timeout()),
-                     this,
-                     SLOT(update()));
-    mTimer->start();
-
     setSizePolicy(QSizePolicy::Fixed,
                   QSizePolicy::Fixed);
 }
@@ -160,15 +151,18 @@ void SongTimeBar::zoomIn()
 {
     if (zoom > 1)
         zoom *= 0.5;
+    update();
 }
 
 void SongTimeBar::zoomOut()
 {
     zoom *= 2;
+    update();
 }
 
 void SongTimeBar::set_guides(int a_snap, int a_measure)
 {
     m_snap = a_snap;
     m_measure_length = a_measure;
+    update();
 }
@@ -5,7 +5,6 @@
 #include "MidiPerformance.hpp"
 
 #include <QWidget>
-#include <QTimer>
 #include <QPainter>
 #include <QObject>
 #include <QPen>
@@ -43,7 +42,6 @@ protected:
 private:
     MidiPerformance *m_mainperf;
 
-    QTimer      *mTimer;
     QPen        *mPen;
     QBrush      *mBrush;
     QPainter    *mPainter;
@@ -14,6 +14,7 @@ TEMPLATE = app
 
 SOURCES +=\
     Main.cpp \
+    Globals.cpp \
     MainWindow.cpp \
     LiveFrame.cpp \
     SongFrame.cpp \
@@ -22,6 +23,12 @@ SOURCES +=\
     MidiSequence.cpp \
     MidiEvent.cpp \
     Mutex.cpp \
+    ChangeQueue.cpp \
+    CommandQueue.cpp \
+    EventRing.cpp \
+    MidiJournal.cpp \
+    MidiSetlist.cpp \
+    MidiFileCache.cpp \
     MidiBus.cpp \
     Lash.cpp \
     ConfigFile.cpp \
@@ -53,6 +60,12 @@ HEADERS  += \
     Globals.hpp \
     MidiBus.hpp \
     Mutex.hpp \
+    ChangeQueue.hpp \
+    CommandQueue.hpp \
+    EventRing.hpp \
+    MidiJournal.hpp \
+    MidiSetlist.hpp \
+    MidiFileCache.hpp \
     Lash.hpp \
     UserFile.hpp \
     ConfigFile.hpp \